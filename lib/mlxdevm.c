@@ -14,15 +14,37 @@
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <limits.h>
 
 #include "mlxdevm_netlink.h"
 #include "mlxdevm.h"
+#include "mlxdevm_attr.h"
+#include "mlxdevm_priv.h"
+#include "mlxdevm_trace.h"
+
+#ifndef MLXDEVM_GENL_MCGRP_CONFIG_NAME
+#define MLXDEVM_GENL_MCGRP_CONFIG_NAME "config"
+#endif
+
+static void mlxdevm_async_destroy(struct mlxdevm_async *async);
 
 void mlxdevm_close(struct mlxdevm *dl)
 {
-	netlink_socket_close(&dl->nls);
-	free(dl->bus);
-	free(dl->dev);
+	if (dl->async)
+		mlxdevm_async_destroy(dl->async);
+	if (dl->ntf)
+		mnl_socket_close(dl->ntf);
+	free(dl->ntf_buf);
+	if (dl->sf_drv)
+		mlxdevm_sf_drv_destroy(dl->sf_drv);
+	mlxdevm_stats_destroy(dl);
+	if (!dl->nls_shared)
+		netlink_socket_close(dl->nls);
+	if (!dl->names_shared) {
+		free(dl->bus);
+		free(dl->dev);
+	}
 	free(dl);
 }
 
@@ -35,7 +57,8 @@ struct mlxdevm *mlxdevm_open(const char *dl_sock_name, const char *dl_bus, const
 	if (!dl)
 		return NULL;
 
-	err = netlink_socket_open(&dl->nls, dl_sock_name, MLXDEVM_GENL_VERSION);
+	dl->nls = &dl->own_nls;
+	err = netlink_socket_open(dl->nls, dl_sock_name, MLXDEVM_GENL_VERSION);
 	if (err) {
 		fprintf(stderr, "Failed to connect to mlxdevm Netlink %d\n", errno);
 		goto sock_err;
@@ -48,7 +71,7 @@ struct mlxdevm *mlxdevm_open(const char *dl_sock_name, const char *dl_bus, const
 	return dl;
 
 str_err:
-	netlink_socket_close(&dl->nls);
+	netlink_socket_close(dl->nls);
 	free(dl->bus);
 	free(dl->dev);
 sock_err:
@@ -56,104 +79,175 @@ sock_err:
 	return NULL;
 }
 
-static const enum mnl_attr_data_type mlxdevm_policy[MLXDEVM_ATTR_MAX + 1] = {
-	[MLXDEVM_ATTR_DEV_BUS_NAME] = MNL_TYPE_NUL_STRING,
-	[MLXDEVM_ATTR_DEV_NAME] = MNL_TYPE_NUL_STRING,
-	[MLXDEVM_ATTR_PORT_INDEX] = MNL_TYPE_U32,
-	[MLXDEVM_ATTR_PORT_TYPE] = MNL_TYPE_U16,
-	[MLXDEVM_ATTR_PORT_NETDEV_IFINDEX] = MNL_TYPE_U32,
-	[MLXDEVM_ATTR_PORT_NETDEV_NAME] = MNL_TYPE_NUL_STRING,
-	[MLXDEVM_ATTR_PORT_IBDEV_NAME] = MNL_TYPE_NUL_STRING,
-	[MLXDEVM_ATTR_PARAM_NAME] = MNL_TYPE_STRING,
-	[MLXDEVM_ATTR_PARAM_TYPE] = MNL_TYPE_U8,
-	[MLXDEVM_ATTR_PARAM_VALUES_LIST] = MNL_TYPE_NESTED,
-	[MLXDEVM_ATTR_PARAM_VALUE] = MNL_TYPE_NESTED,
-	[MLXDEVM_ATTR_PARAM_VALUE_CMODE] = MNL_TYPE_U8,
-};
-
-static int attr_parse_cb(const struct nlattr *attr, void *data)
+struct mlxdevm *mlxdevm_open_shared(struct mlxdevm *parent,
+				    const char *dl_bus, const char *dl_dev)
 {
-	const struct nlattr **tb = data;
-	int type;
-
-	if (mnl_attr_type_valid(attr, MLXDEVM_ATTR_MAX) < 0)
-		return MNL_CB_OK;
-
-	type = mnl_attr_get_type(attr);
-	if (mnl_attr_validate(attr, mlxdevm_policy[type]) < 0)
-		return MNL_CB_ERROR;
-
-	tb[type] = attr;
-	return MNL_CB_OK;
-}
-
-static const enum mnl_attr_data_type
-mlxdevm_function_policy[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {
-	[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR ] = MNL_TYPE_BINARY,
-	[MLXDEVM_PORT_FN_ATTR_STATE] = MNL_TYPE_U8,
-	[MLXDEVM_PORT_FN_ATTR_OPSTATE] = MNL_TYPE_U8,
-	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE] = MNL_TYPE_U8,
-        [MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST] = MNL_TYPE_U32,
-};
+	struct mlxdevm *dl;
 
-static int function_attr_parse_cb(const struct nlattr *attr, void *data)
-{
-	const struct nlattr **tb = data;
-	int type;
+	dl = calloc(1, sizeof(*dl));
+	if (!dl)
+		return NULL;
 
-	if (mnl_attr_type_valid(attr, MLXDEVM_PORT_FUNCTION_ATTR_MAX) < 0)
-		return MNL_CB_OK;
+	dl->nls = parent->nls;
+	dl->nls_shared = true;
+	dl->bus = strdup(dl_bus);
+	dl->dev = strdup(dl_dev);
+	if (!dl->bus || !dl->dev)
+		goto str_err;
 
-	type = mnl_attr_get_type(attr);
-	if (mnl_attr_validate(attr, mlxdevm_function_policy[type]) < 0)
-		return MNL_CB_ERROR;
+	return dl;
 
-	tb[type] = attr;
-	return MNL_CB_OK;
+str_err:
+	free(dl->bus);
+	free(dl->dev);
+	free(dl);
+	return NULL;
 }
 
 static void cmd_port_fn_get(struct nlattr **tb_port, struct mlxdevm_port *port)
 {
-	struct nlattr *tb[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {};
+	struct nlattr *tb[MLXDEVM_FN_ATTR_IDX_MAX + 1] = {};
 	int err;
 
-	err = mnl_attr_parse_nested(tb_port[MLXDEVM_ATTR_PORT_FUNCTION],
-				    function_attr_parse_cb, tb);
+	err = mlxdevm_fn_attr_parse_nested(tb_port[MLXDEVM_ATTR_IDX_PORT_FUNCTION],
+					   tb);
 	if (err != MNL_CB_OK)
 		return;
 
-	port->state = mnl_attr_get_u8(tb[MLXDEVM_PORT_FN_ATTR_STATE]);
-	port->opstate = mnl_attr_get_u8(tb[MLXDEVM_PORT_FN_ATTR_OPSTATE]);
+	port->state = mnl_attr_get_u8(tb[MLXDEVM_FN_ATTR_IDX_STATE]);
+	port->opstate = mnl_attr_get_u8(tb[MLXDEVM_FN_ATTR_IDX_OPSTATE]);
+	port->fn_valid |= MLXDEVM_PORT_FN_VALID_STATE;
+
+	if (tb[MLXDEVM_FN_ATTR_IDX_HW_ADDR] &&
+	    mnl_attr_get_payload_len(tb[MLXDEVM_FN_ATTR_IDX_HW_ADDR]) ==
+	    sizeof(port->mac_addr)) {
+		memcpy(port->mac_addr,
+		       mnl_attr_get_payload(tb[MLXDEVM_FN_ATTR_IDX_HW_ADDR]),
+		       sizeof(port->mac_addr));
+		port->fn_valid |= MLXDEVM_PORT_FN_VALID_MAC;
+	}
 
-	if (tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE]) {
+	if (tb[MLXDEVM_FN_ATTR_IDX_EXT_CAP_ROCE]) {
 		port->ext_cap.roce =
-			mnl_attr_get_u8(tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE]);
+			mnl_attr_get_u8(tb[MLXDEVM_FN_ATTR_IDX_EXT_CAP_ROCE]);
 		port->ext_cap.roce_valid = true;
 	}
-	if (tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST]) {
+	if (tb[MLXDEVM_FN_ATTR_IDX_EXT_CAP_UC_LIST]) {
 		port->ext_cap.max_uc_macs =
-			mnl_attr_get_u32(tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST]);
+			mnl_attr_get_u32(tb[MLXDEVM_FN_ATTR_IDX_EXT_CAP_UC_LIST]);
 		port->ext_cap.max_uc_macs_valid = true;
 	}
+	port->fn_valid |= MLXDEVM_PORT_FN_VALID_EXT_CAP;
+}
+
+static void port_fn_mac_addr_update(struct mlxdevm_port *port,
+				    const uint8_t *addr)
+{
+	memcpy(port->mac_addr, addr, sizeof(port->mac_addr));
+	port->fn_valid |= MLXDEVM_PORT_FN_VALID_MAC;
+}
+
+static void port_fn_state_update(struct mlxdevm_port *port, uint8_t state)
+{
+	port->state = state;
+	port->fn_valid |= MLXDEVM_PORT_FN_VALID_STATE;
+}
+
+static void port_fn_ext_cap_update(struct mlxdevm_port *port,
+				   const struct mlxdevm_port_fn_ext_cap *cap)
+{
+	if (cap->roce_valid)
+		port->ext_cap.roce = cap->roce;
+	if (cap->max_uc_macs_valid)
+		port->ext_cap.max_uc_macs = cap->max_uc_macs;
+	port->fn_valid |= MLXDEVM_PORT_FN_VALID_EXT_CAP;
+}
+
+/* In cached mode, a set which would not change the last known port
+ * function state is skipped and accounted for.
+ */
+static bool cache_skip(struct mlxdevm *dl, bool unchanged)
+{
+	if (!dl->cache || !unchanged)
+		return false;
+	dl->cache_skipped++;
+	return true;
+}
+
+static bool port_fn_mac_addr_cached(struct mlxdevm *dl,
+				    const struct mlxdevm_port *port,
+				    const uint8_t *addr)
+{
+	return cache_skip(dl, (port->fn_valid & MLXDEVM_PORT_FN_VALID_MAC) &&
+			  !memcmp(port->mac_addr, addr, sizeof(port->mac_addr)));
+}
+
+static bool port_fn_state_cached(struct mlxdevm *dl,
+				 const struct mlxdevm_port *port, uint8_t state)
+{
+	return cache_skip(dl, (port->fn_valid & MLXDEVM_PORT_FN_VALID_STATE) &&
+			  port->state == state);
+}
+
+static bool port_fn_ext_cap_cached(struct mlxdevm *dl,
+				   const struct mlxdevm_port *port,
+				   const struct mlxdevm_port_fn_ext_cap *cap)
+{
+	const struct mlxdevm_port_fn_ext_cap *cur = &port->ext_cap;
+
+	return cache_skip(dl, (port->fn_valid & MLXDEVM_PORT_FN_VALID_EXT_CAP) &&
+			  (!cap->roce_valid ||
+			   (cur->roce_valid && cur->roce == cap->roce)) &&
+			  (!cap->max_uc_macs_valid ||
+			   (cur->max_uc_macs_valid &&
+			    cur->max_uc_macs == cap->max_uc_macs)));
+}
+
+void mlxdevm_cache_enable(struct mlxdevm *dl, bool enable)
+{
+	dl->cache = enable;
+}
+
+unsigned long mlxdevm_cache_skipped_get(const struct mlxdevm *dl)
+{
+	return dl->cache_skipped;
+}
+
+static inline uint8_t genl_cmd(const struct nlmsghdr *nlh)
+{
+	const struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+
+	return genl->cmd;
 }
 
 static int cmd_port_show_cb(const struct nlmsghdr *nlh, void *data)
 {
-	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
-	struct nlattr *tb[MLXDEVM_ATTR_MAX + 1] = {};
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
 	struct mlxdevm_port *port = data;
 
-	mnl_attr_parse(nlh, sizeof(*genl), attr_parse_cb, tb);
-	if (!tb[MLXDEVM_ATTR_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_DEV_NAME] ||
-	    !tb[MLXDEVM_ATTR_PORT_INDEX])
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_IDX_DEV_NAME] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_INDEX])
 		return MNL_CB_ERROR;
 
-	port->port_index = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_INDEX]);
-	port->ndev_ifindex = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_NETDEV_IFINDEX]);
+	port->port_index = mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_INDEX]);
+	port->ndev_ifindex = mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_NETDEV_IFINDEX]);
 	cmd_port_fn_get(tb, port);
+	MLXDEVM_TRACE(parse_port, genl_cmd(nlh), port->port_index, port->sfnum);
 	return MNL_CB_OK;
 }
 
+static void sf_port_add_put(struct nlmsghdr *nlh, const struct mlxdevm *dl,
+			    uint32_t pfnum, uint32_t sfnum)
+{
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_BUS_NAME, dl->bus);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_NAME, dl->dev);
+
+	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_FLAVOUR, MLXDEVM_PORT_FLAVOUR_PCI_SF);
+	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_PCI_PF_NUMBER, pfnum);
+	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_PCI_SF_NUMBER, sfnum);
+}
+
 struct mlxdevm_port *
 mlxdevm_sf_port_add(struct mlxdevm *dl, uint32_t pfnum, uint32_t sfnum)
 {
@@ -165,20 +259,17 @@ mlxdevm_sf_port_add(struct mlxdevm *dl, uint32_t pfnum, uint32_t sfnum)
 	if (!port)
 		return NULL;
 
+	MLXDEVM_TRACE_ENTRY(0, sfnum);
+
 	port->pfnum = pfnum;
 	port->sfnum = sfnum;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_NEW,
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_NEW,
 					 NLM_F_REQUEST | NLM_F_ACK);
+	sf_port_add_put(nlh, dl, pfnum, sfnum);
 
-	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_BUS_NAME, dl->bus);
-	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_NAME, dl->dev);
-
-	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_FLAVOUR, MLXDEVM_PORT_FLAVOUR_PCI_SF);
-	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_PCI_PF_NUMBER, pfnum);
-	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_PCI_SF_NUMBER, sfnum);
-
-	err = netlink_socket_sndrcv(&dl->nls, nlh, cmd_port_show_cb, port);
+	err = mlxdevm_cmd_sndrcv(dl, nlh, cmd_port_show_cb, port);
+	MLXDEVM_TRACE_EXIT(port->port_index, sfnum, err);
 	if (err)
 		goto sock_err;
 
@@ -189,40 +280,73 @@ sock_err:
 	return NULL;
 }
 
-static int cmd_port_dump_cb_to_list(const struct nlmsghdr *nlh, void *data)
+/* Decode an SF port of a dump reply; return false for other port flavours */
+static bool sf_port_decode(const struct nlmsghdr *nlh, struct mlxdevm_port *port)
 {
-	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
-	struct nlattr *tb[MLXDEVM_ATTR_MAX + 1] = {};
-	struct mlxdevm_port_list_head *head = data;
-	struct mlxdevm_port_list *cur;
-	struct mlxdevm_port *port;
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
 	uint16_t flavour;
 
-	mnl_attr_parse(nlh, sizeof(*genl), attr_parse_cb, tb);
-	if (!tb[MLXDEVM_ATTR_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_DEV_NAME] ||
-	    !tb[MLXDEVM_ATTR_PORT_INDEX] || !tb[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER] ||
-	    !tb[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER] ||
-	    !tb[MLXDEVM_ATTR_PORT_FLAVOUR])
-		return 0;
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_IDX_DEV_NAME] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_INDEX] || !tb[MLXDEVM_ATTR_IDX_PORT_PCI_PF_NUMBER] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_PCI_SF_NUMBER] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_FLAVOUR])
+		return false;
 
-	flavour = mnl_attr_get_u16(tb[MLXDEVM_ATTR_PORT_FLAVOUR]);
+	flavour = mnl_attr_get_u16(tb[MLXDEVM_ATTR_IDX_PORT_FLAVOUR]);
 	if (flavour != MLXDEVM_PORT_FLAVOUR_PCI_SF)
+		return false;
+
+	memset(port, 0, sizeof(*port));
+	port->port_index = mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_INDEX]);
+	port->ndev_ifindex = mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_NETDEV_IFINDEX]);
+	port->pfnum = mnl_attr_get_u16(tb[MLXDEVM_ATTR_IDX_PORT_PCI_PF_NUMBER]);
+	port->sfnum = mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_PCI_SF_NUMBER]);
+
+	cmd_port_fn_get(tb, port);
+	MLXDEVM_TRACE(parse_port, genl_cmd(nlh), port->port_index, port->sfnum);
+	return true;
+}
+
+static int cmd_port_dump_cb_to_list(const struct nlmsghdr *nlh, void *data)
+{
+	struct mlxdevm_port_list_head *head = data;
+	struct mlxdevm_port_list *cur;
+	struct mlxdevm_port port;
+
+	if (!sf_port_decode(nlh, &port))
 		return MNL_CB_OK;
 
 	cur = calloc(1, sizeof(struct mlxdevm_port_list));
 	if (!cur)
 		return -ENOMEM;
 
-	port = &cur->port;
-	port->port_index = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_INDEX]);
-	port->ndev_ifindex = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_NETDEV_IFINDEX]);
-	port->pfnum = mnl_attr_get_u16(tb[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER]);
-	port->sfnum = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER]);
+	cur->port = port;
+	TAILQ_INSERT_TAIL(head, cur, entry);
 
-	cmd_port_fn_get(tb, port);
+	return MNL_CB_OK;
+}
 
-	TAILQ_INSERT_TAIL(head, cur, entry);
+struct port_foreach_ctx {
+	struct mlxdevm *dl;
+	mlxdevm_port_cb_t cb;
+	void *priv;
+	int ret;
+};
+
+static int cmd_port_dump_cb_foreach(const struct nlmsghdr *nlh, void *data)
+{
+	struct port_foreach_ctx *ctx = data;
+	struct mlxdevm_port port;
 
+	/* Once stopped, the rest of the dump is still received so that it
+	 * doesn't end up as the reply of the next command on the socket.
+	 */
+	if (ctx->ret)
+		return MNL_CB_OK;
+
+	if (sf_port_decode(nlh, &port))
+		ctx->ret = ctx->cb(ctx->dl, &port, ctx->priv);
 	return MNL_CB_OK;
 }
 
@@ -239,39 +363,113 @@ static void port_handle_set(struct nlmsghdr *nlh, const struct mlxdevm *dl,
 	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_INDEX, port->port_index);
 }
 
+static int port_dump(struct mlxdevm *dl, mnl_cb_t data_cb, void *data)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_GET,
+					 NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
+
+	dev_handle_set(nlh, dl);
+
+	return mlxdevm_cmd_sndrcv(dl, nlh, data_cb, data);
+}
+
 int mlxdevm_sf_port_list_dump(struct mlxdevm *dl,
 			      struct mlxdevm_port_list_head *head)
 {
-	struct nlmsghdr *nlh;
+	int err;
 
 	if (!TAILQ_EMPTY(head))
 		return -EINVAL;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_GET,
-					 NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = port_dump(dl, cmd_port_dump_cb_to_list, head);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
 
-	dev_handle_set(nlh, dl);
+int mlxdevm_sf_port_foreach(struct mlxdevm *dl, mlxdevm_port_cb_t cb,
+			    void *priv)
+{
+	struct port_foreach_ctx ctx = {
+		.dl = dl,
+		.cb = cb,
+		.priv = priv,
+	};
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = port_dump(dl, cmd_port_dump_cb_foreach, &ctx);
+	if (!err)
+		err = ctx.ret;
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+#define MLXDEVM_PORT_SNAPSHOT_MIN 64
+
+static int port_snapshot_add(struct mlxdevm *dl,
+			     const struct mlxdevm_port *port, void *priv)
+{
+	struct mlxdevm_port_snapshot *snap = priv;
+	struct mlxdevm_port *ports;
+	unsigned int capacity;
+
+	if (snap->count == snap->capacity) {
+		capacity = snap->capacity ? snap->capacity * 2 :
+					    MLXDEVM_PORT_SNAPSHOT_MIN;
+		ports = realloc(snap->ports, capacity * sizeof(*ports));
+		if (!ports)
+			return -ENOMEM;
+		snap->ports = ports;
+		snap->capacity = capacity;
+	}
+	snap->ports[snap->count++] = *port;
+	return 0;
+}
 
-	return netlink_socket_sndrcv(&dl->nls, nlh, cmd_port_dump_cb_to_list, head);
+int mlxdevm_port_snapshot_fill(struct mlxdevm *dl,
+			       struct mlxdevm_port_snapshot *snap)
+{
+	int err;
+
+	snap->count = 0;
+	err = mlxdevm_sf_port_foreach(dl, port_snapshot_add, snap);
+	if (err)
+		snap->count = 0;
+	return err;
+}
+
+void mlxdevm_port_snapshot_free(struct mlxdevm_port_snapshot *snap)
+{
+	free(snap->ports);
+	snap->ports = NULL;
+	snap->count = 0;
+	snap->capacity = 0;
 }
 
 static int mlxdevm_port_del_cmd(struct mlxdevm *dl, struct mlxdevm_port *port)
 {
 	struct nlmsghdr *nlh = NULL;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_DEL,
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_DEL,
 					 NLM_F_REQUEST | NLM_F_ACK);
 
 	port_handle_set(nlh, dl, port);
 
-	return netlink_socket_sndrcv(&dl->nls, nlh, NULL, NULL);
+	return mlxdevm_cmd_sndrcv(dl, nlh, NULL, NULL);
 }
 
 void mlxdevm_sf_port_list_item_del(struct mlxdevm *dl,
 				   struct mlxdevm_port_list_head *head,
 				   struct mlxdevm_port_list *port)
 {
-	mlxdevm_port_del_cmd(dl, &port->port);
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(port->port.port_index, port->port.sfnum);
+	err = mlxdevm_port_del_cmd(dl, &port->port);
+	MLXDEVM_TRACE_EXIT(port->port.port_index, port->port.sfnum, err);
 
 	TAILQ_REMOVE(head, port, entry);
 
@@ -282,7 +480,9 @@ void mlxdevm_sf_port_del(struct mlxdevm *dl, struct mlxdevm_port *port)
 {
 	int err;
 
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
 	err = mlxdevm_port_del_cmd(dl, port);
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
 	if (err)
 		return;
 
@@ -303,18 +503,23 @@ int mlxdevm_port_fn_macaddr_set(struct mlxdevm *dl, struct mlxdevm_port *port,
 				const uint8_t *addr)
 {
 	struct nlmsghdr *nlh;
-	int err;
+	int err = 0;
+
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+	if (port_fn_mac_addr_cached(dl, port, addr))
+		goto out;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_SET,
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_SET,
 					 NLM_F_REQUEST | NLM_F_ACK);
 	port_handle_set(nlh, dl, port);
 	port_fn_mac_addr_put(nlh, addr);
 
-	err = netlink_socket_sndrcv(&dl->nls, nlh, NULL, NULL);
-	if (err)
-		return err;
-	memcpy(port->mac_addr, addr, sizeof(port->mac_addr));
-	return 0;
+	err = mlxdevm_cmd_sndrcv(dl, nlh, NULL, NULL);
+	if (!err)
+		port_fn_mac_addr_update(port, addr);
+out:
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
 }
 
 static void port_fn_state_put(struct nlmsghdr *nlh, uint8_t state)
@@ -331,18 +536,22 @@ int mlxdevm_port_fn_state_set(struct mlxdevm *dl, struct mlxdevm_port *port,
 			      uint8_t state)
 {
 	struct nlmsghdr *nlh;
-	int err;
+	int err = 0;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_SET,
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+	if (port_fn_state_cached(dl, port, state))
+		goto out;
+
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_SET,
 					 NLM_F_REQUEST | NLM_F_ACK);
 	port_handle_set(nlh, dl, port);
 	port_fn_state_put(nlh, state);
-	err = netlink_socket_sndrcv(&dl->nls, nlh, NULL, NULL);
-	if (err)
-		return err;
-
-	port->state = state;
-	return 0;
+	err = mlxdevm_cmd_sndrcv(dl, nlh, NULL, NULL);
+	if (!err)
+		port_fn_state_update(port, state);
+out:
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
 }
 
 int mlxdevm_port_fn_state_get(struct mlxdevm *dl, struct mlxdevm_port *port,
@@ -351,32 +560,32 @@ int mlxdevm_port_fn_state_get(struct mlxdevm *dl, struct mlxdevm_port *port,
 	struct nlmsghdr *nlh;
 	int err;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_GET,
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_GET,
 					 NLM_F_REQUEST | NLM_F_ACK);
 
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
 	port_handle_set(nlh, dl, port);
-	err = netlink_socket_sndrcv(&dl->nls, nlh, cmd_port_show_cb, port);
-	if (err)
-		return err;
-
-	*state = port->state;
-	*opstate = port->opstate;
-	return 0;
+	err = mlxdevm_cmd_sndrcv(dl, nlh, cmd_port_show_cb, port);
+	if (!err) {
+		*state = port->state;
+		*opstate = port->opstate;
+	}
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
 }
 
 static int cmd_netdev_get_cb(const struct nlmsghdr *nlh, void *data)
 {
-	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
-	struct nlattr *tb[MLXDEVM_ATTR_MAX + 1] = {};
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
 	const char *ifname = NULL;
 
-	mnl_attr_parse(nlh, sizeof(*genl), attr_parse_cb, tb);
-	if (!tb[MLXDEVM_ATTR_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_DEV_NAME] ||
-	    !tb[MLXDEVM_ATTR_PORT_INDEX] ||
-	    !tb[MLXDEVM_ATTR_PORT_NETDEV_NAME])
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_IDX_DEV_NAME] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_INDEX] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_NETDEV_NAME])
 		return MNL_CB_ERROR;
 
-	ifname = mnl_attr_get_str(tb[MLXDEVM_ATTR_PORT_NETDEV_NAME]);
+	ifname = mnl_attr_get_str(tb[MLXDEVM_ATTR_IDX_PORT_NETDEV_NAME]);
 	strcpy(data, ifname);
 	return MNL_CB_OK;
 }
@@ -387,11 +596,13 @@ int mlxdevm_port_netdev_get(struct mlxdevm *dl, struct mlxdevm_port *port,
 	struct nlmsghdr *nlh;
 	int err;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PORT_GET,
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_GET,
 					 NLM_F_REQUEST | NLM_F_ACK);
 
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
 	port_handle_set(nlh, dl, port);
-	err = netlink_socket_sndrcv(&dl->nls, nlh, cmd_netdev_get_cb, ifname);
+	err = mlxdevm_cmd_sndrcv(dl, nlh, cmd_netdev_get_cb, ifname);
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
 	return err;
 }
 
@@ -410,102 +621,431 @@ static int msleep(long msec)
 	return res;
 }
 
+#define MLXDEVM_OPSTATE_WAIT_MSEC		4000
+#define MLXDEVM_OPSTATE_POLL_MSEC		1
+/* Poll interval when notifications are used, in case one is missed */
+#define MLXDEVM_OPSTATE_NTF_POLL_MSEC		20
+
+static long long monotonic_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ll + ts.tv_nsec / 1000000;
+}
+
+static int mlxdevm_ntf_open(struct mlxdevm *dl)
+{
+	uint32_t group;
+
+	if (dl->ntf)
+		return 0;
+	if (dl->ntf_unsupported)
+		return -EOPNOTSUPP;
+
+	if (netlink_socket_mcgrp_get(dl->nls, MLXDEVM_GENL_MCGRP_CONFIG_NAME,
+				     &group))
+		goto unsupported;
+
+	dl->ntf_buf = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (!dl->ntf_buf)
+		goto unsupported;
+
+	dl->ntf = netlink_mcgrp_socket_open(group);
+	if (!dl->ntf)
+		goto sock_err;
+	return 0;
+
+sock_err:
+	free(dl->ntf_buf);
+	dl->ntf_buf = NULL;
+unsupported:
+	dl->ntf_unsupported = true;
+	return -EOPNOTSUPP;
+}
+
+struct port_ntf_ctx {
+	const struct mlxdevm *dl;
+	struct mlxdevm_port *port;
+	bool seen;
+};
+
+static int cmd_port_ntf_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
+	struct port_ntf_ctx *ctx = data;
+
+	if (genl->cmd != MLXDEVM_CMD_PORT_NEW)
+		return MNL_CB_OK;
+
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_IDX_DEV_NAME] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_INDEX] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_FUNCTION])
+		return MNL_CB_OK;
+
+	if (mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_INDEX]) !=
+	    ctx->port->port_index ||
+	    strcmp(mnl_attr_get_str(tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME]),
+		   ctx->dl->bus) ||
+	    strcmp(mnl_attr_get_str(tb[MLXDEVM_ATTR_IDX_DEV_NAME]), ctx->dl->dev))
+		return MNL_CB_OK;
+
+	cmd_port_fn_get(tb, ctx->port);
+	ctx->seen = true;
+	MLXDEVM_TRACE(parse_port, genl->cmd, ctx->port->port_index,
+		      ctx->port->sfnum);
+	return MNL_CB_OK;
+}
+
+/* Receive pending notifications without blocking. Returns 0 when the
+ * socket is drained, or a negative error, -ENOBUFS meaning that some
+ * notifications were lost.
+ */
+static int mlxdevm_ntf_rcv(struct mlxdevm *dl, struct port_ntf_ctx *ctx)
+{
+	int fd = mnl_socket_get_fd(dl->ntf);
+	int len;
+
+	while (1) {
+		len = recv(fd, dl->ntf_buf, MNL_SOCKET_BUFFER_SIZE, MSG_DONTWAIT);
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -errno;
+
+		mnl_cb_run(dl->ntf_buf, len, 0, 0, cmd_port_ntf_cb, ctx);
+	}
+}
+
 static int
 mlxdevm_port_fn_opstate_wait(struct mlxdevm *dl,
 			     struct mlxdevm_port *port,
 			     enum mlxdevm_port_fn_opstate desired_opstate)
 {
-	int count = 4000; /* 400msec timeout */
+	long long deadline = monotonic_msec() + MLXDEVM_OPSTATE_WAIT_MSEC;
+	int interval = MLXDEVM_OPSTATE_POLL_MSEC;
+	struct port_ntf_ctx ctx = {
+		.dl = dl,
+		.port = port,
+	};
+	struct pollfd pfd = {
+		.fd = -1,
+		.events = POLLIN,
+	};
+	unsigned int iteration = 0;
+	long long remaining;
 	uint8_t opstate;
 	uint8_t state;
 	int err;
 
-	while (count) {
+	if (!mlxdevm_ntf_open(dl)) {
+		/* Notifications queued by earlier waits are stale; the port
+		 * is queried right after.
+		 */
+		mlxdevm_ntf_rcv(dl, &ctx);
+		pfd.fd = mnl_socket_get_fd(dl->ntf);
+		interval = MLXDEVM_OPSTATE_NTF_POLL_MSEC;
+	}
+
+	while (1) {
 		err = mlxdevm_port_fn_state_get(dl, port, &state, &opstate);
 		if (err)
 			return err;
+		MLXDEVM_TRACE(opstate_wait, port->port_index, port->sfnum,
+			      iteration++, opstate);
 		if (opstate == desired_opstate)
 			return 0;
 
-		msleep(1);
-		count--;
+		do {
+			remaining = deadline - monotonic_msec();
+			if (remaining <= 0)
+				return EINVAL;
+			if (remaining > interval)
+				remaining = interval;
+
+			if (pfd.fd < 0) {
+				msleep(remaining);
+				break;
+			}
+
+			if (poll(&pfd, 1, remaining) <= 0)
+				break;
+
+			ctx.seen = false;
+			if (mlxdevm_ntf_rcv(dl, &ctx))
+				break;
+			if (ctx.seen && port->opstate == desired_opstate)
+				return 0;
+		} while (1);
 	}
-	return EINVAL;
 }
 
 int mlxdevm_port_fn_opstate_wait_attached(struct mlxdevm *dl,
 					  struct mlxdevm_port *port)
 {
-	return mlxdevm_port_fn_opstate_wait(dl, port,
-					    MLXDEVM_PORT_FN_OPSTATE_ATTACHED);
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+	err = mlxdevm_port_fn_opstate_wait(dl, port,
+					   MLXDEVM_PORT_FN_OPSTATE_ATTACHED);
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
 }
 
 int mlxdevm_port_fn_opstate_wait_detached(struct mlxdevm *dl,
 					  struct mlxdevm_port *port)
 {
-	return mlxdevm_port_fn_opstate_wait(dl, port,
-					    MLXDEVM_PORT_FN_OPSTATE_DETACHED);
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+	err = mlxdevm_port_fn_opstate_wait(dl, port,
+					   MLXDEVM_PORT_FN_OPSTATE_DETACHED);
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
 }
 
-static void port_fn_ext_cap_put(struct nlmsghdr *nlh,
-				const struct mlxdevm_port_fn_ext_cap *cap)
-{
-	struct nlattr *nest;
+/* Bulk opstate wait polling interval grows up to this value */
+#define MLXDEVM_PORTS_OPSTATE_POLL_MAX_MSEC	16
 
-	nest = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_EXT_PORT_FN_CAP);
+struct port_wait_ent {
+	uint32_t port_index;
+	unsigned int i;
+};
 
-	if (cap->roce_valid)
-		mnl_attr_put_u8(nlh, MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE, cap->roce);
-	if (cap->max_uc_macs_valid)
-		mnl_attr_put_u32(nlh, MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST,
-				 cap->max_uc_macs);
+struct ports_wait_ctx {
+	const struct mlxdevm *dl;
+	struct mlxdevm_port **ports;
+	struct port_wait_ent *ents;
+	unsigned int n;
+};
 
-	mnl_attr_nest_end(nlh, nest);
+static int port_wait_ent_cmp(const void *a, const void *b)
+{
+	const struct port_wait_ent *x = a;
+	const struct port_wait_ent *y = b;
+
+	if (x->port_index == y->port_index)
+		return 0;
+	return x->port_index < y->port_index ? -1 : 1;
 }
 
-int mlxdevm_port_fn_cap_set(struct mlxdevm *dl, struct mlxdevm_port *port,
-			    const struct mlxdevm_port_fn_ext_cap *cap)
+static struct port_wait_ent *
+ports_wait_ents_alloc(struct mlxdevm_port **ports, unsigned int n)
 {
-	struct nlmsghdr *nlh;
-	int err;
+	struct port_wait_ent *ents;
+	unsigned int i;
 
-	if (!port->ext_cap.roce_valid && !port->ext_cap.max_uc_macs_valid)
-		return -EOPNOTSUPP;
+	ents = calloc(n, sizeof(*ents));
+	if (!ents)
+		return NULL;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_EXT_CAP_SET,
-					 NLM_F_REQUEST | NLM_F_ACK);
-	port_handle_set(nlh, dl, port);
-	port_fn_ext_cap_put(nlh, cap);
-	err = netlink_socket_sndrcv(&dl->nls, nlh, NULL, NULL);
-	if (err)
-		return err;
+	for (i = 0; i < n; i++) {
+		ents[i].port_index = ports[i]->port_index;
+		ents[i].i = i;
+	}
+	qsort(ents, n, sizeof(*ents), port_wait_ent_cmp);
+	return ents;
+}
 
-	if (cap->roce_valid)
-		port->ext_cap.roce = cap->roce;
+/* Port indices are only unique within a device */
+static bool dev_attrs_match(struct nlattr **tb, const char *bus,
+			    const char *dev)
+{
+	return tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] &&
+	       tb[MLXDEVM_ATTR_IDX_DEV_NAME] &&
+	       !strcmp(mnl_attr_get_str(tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME]), bus) &&
+	       !strcmp(mnl_attr_get_str(tb[MLXDEVM_ATTR_IDX_DEV_NAME]), dev);
+}
+
+static int cmd_port_dump_cb_to_set(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
+	struct ports_wait_ctx *ctx = data;
+	struct port_wait_ent *end = ctx->ents + ctx->n;
+	struct port_wait_ent key;
+	struct port_wait_ent *ent;
+
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_PORT_INDEX] ||
+	    !tb[MLXDEVM_ATTR_IDX_PORT_FUNCTION])
+		return MNL_CB_OK;
+	if (!dev_attrs_match(tb, ctx->dl->bus, ctx->dl->dev))
+		return MNL_CB_OK;
+
+	key.port_index = mnl_attr_get_u32(tb[MLXDEVM_ATTR_IDX_PORT_INDEX]);
+	ent = bsearch(&key, ctx->ents, ctx->n, sizeof(*ent), port_wait_ent_cmp);
+	if (!ent)
+		return MNL_CB_OK;
+
+	/* Every entry of a port listed more than once is updated */
+	while (ent > ctx->ents && ent[-1].port_index == key.port_index)
+		ent--;
+	for (; ent < end && ent->port_index == key.port_index; ent++) {
+		cmd_port_fn_get(tb, ctx->ports[ent->i]);
+		MLXDEVM_TRACE(parse_port, genl_cmd(nlh), key.port_index,
+			      ctx->ports[ent->i]->sfnum);
+	}
+	return MNL_CB_OK;
+}
+
+static unsigned int ports_opstate_pending(struct mlxdevm_port **ports,
+					  unsigned int n, uint8_t desired,
+					  unsigned int *stragglers)
+{
+	unsigned int pending = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (ports[i]->opstate == desired)
+			continue;
+		if (stragglers)
+			stragglers[pending] = i;
+		pending++;
+	}
+	return pending;
+}
+
+int mlxdevm_ports_refresh(struct mlxdevm *dl, struct mlxdevm_port **ports,
+			  unsigned int n)
+{
+	struct ports_wait_ctx ctx = {
+		.dl = dl,
+		.ports = ports,
+		.n = n,
+	};
+	int err;
+
+	if (!n)
+		return 0;
+
+	ctx.ents = ports_wait_ents_alloc(ports, n);
+	if (!ctx.ents)
+		return -ENOMEM;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = port_dump(dl, cmd_port_dump_cb_to_set, &ctx);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	free(ctx.ents);
+	return err;
+}
+
+int mlxdevm_ports_opstate_wait(struct mlxdevm *dl, struct mlxdevm_port **ports,
+			       unsigned int n, uint8_t desired,
+			       const struct timespec *deadline,
+			       unsigned int *stragglers)
+{
+	int interval = MLXDEVM_OPSTATE_POLL_MSEC;
+	struct ports_wait_ctx ctx = {
+		.dl = dl,
+		.ports = ports,
+		.n = n,
+	};
+	unsigned int iteration = 0;
+	long long remaining;
+	long long end;
+	unsigned int pending = 0;
+	int err;
+
+	if (!n)
+		return 0;
+
+	if (deadline)
+		end = deadline->tv_sec * 1000ll + deadline->tv_nsec / 1000000;
+	else
+		end = monotonic_msec() + MLXDEVM_OPSTATE_WAIT_MSEC;
+
+	ctx.ents = ports_wait_ents_alloc(ports, n);
+	if (!ctx.ents)
+		return -ENOMEM;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	while (1) {
+		err = port_dump(dl, cmd_port_dump_cb_to_set, &ctx);
+		if (err)
+			goto out;
+
+		pending = ports_opstate_pending(ports, n, desired, NULL);
+		MLXDEVM_TRACE(ports_opstate_wait, iteration++, pending);
+		if (!pending)
+			goto out;
+
+		remaining = end - monotonic_msec();
+		if (remaining <= 0)
+			break;
+		msleep(remaining < interval ? remaining : interval);
+		if (interval < MLXDEVM_PORTS_OPSTATE_POLL_MAX_MSEC)
+			interval *= 2;
+	}
+
+	pending = ports_opstate_pending(ports, n, desired, stragglers);
+out:
+	free(ctx.ents);
+	MLXDEVM_TRACE_EXIT(0, 0, err ? err : (int)pending);
+	return err ? err : pending;
+}
+
+static void port_fn_ext_cap_put(struct nlmsghdr *nlh,
+				const struct mlxdevm_port_fn_ext_cap *cap)
+{
+	struct nlattr *nest;
+
+	nest = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_EXT_PORT_FN_CAP);
+
+	if (cap->roce_valid)
+		mnl_attr_put_u8(nlh, MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE, cap->roce);
 	if (cap->max_uc_macs_valid)
-		port->ext_cap.max_uc_macs = cap->max_uc_macs;
-	return 0;
+		mnl_attr_put_u32(nlh, MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST,
+				 cap->max_uc_macs);
+
+	mnl_attr_nest_end(nlh, nest);
 }
 
-static void parse_param_value(struct mlxdevm_param *param, const char *nla_name,
+int mlxdevm_port_fn_cap_set(struct mlxdevm *dl, struct mlxdevm_port *port,
+			    const struct mlxdevm_port_fn_ext_cap *cap)
+{
+	struct nlmsghdr *nlh;
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+	err = -EOPNOTSUPP;
+	if (!port->ext_cap.roce_valid && !port->ext_cap.max_uc_macs_valid)
+		goto out;
+
+	err = 0;
+	if (port_fn_ext_cap_cached(dl, port, cap))
+		goto out;
+
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_EXT_CAP_SET,
+					 NLM_F_REQUEST | NLM_F_ACK);
+	port_handle_set(nlh, dl, port);
+	port_fn_ext_cap_put(nlh, cap);
+	err = mlxdevm_cmd_sndrcv(dl, nlh, NULL, NULL);
+	if (!err)
+		port_fn_ext_cap_update(port, cap);
+out:
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
+}
+
+static bool parse_param_value(struct mlxdevm_param *param, const char *nla_name,
 			      int nla_type, struct nlattr *nl)
 {
-	struct nlattr *nla_value[MLXDEVM_ATTR_MAX + 1] = {};
+	struct nlattr *nla_value[MLXDEVM_ATTR_IDX_MAX + 1] = {};
 	struct nlattr *val_attr;
 	int err;
 
-	err = mnl_attr_parse_nested(nl, attr_parse_cb, nla_value);
+	err = mlxdevm_attr_parse_nested(nl, nla_value);
 	if (err != MNL_CB_OK)
-		return;
+		return false;
 
-	if (!nla_value[MLXDEVM_ATTR_PARAM_VALUE_CMODE] ||
+	if (!nla_value[MLXDEVM_ATTR_IDX_PARAM_VALUE_CMODE] ||
 	    (nla_type != MNL_TYPE_FLAG &&
-	     !nla_value[MLXDEVM_ATTR_PARAM_VALUE_DATA]))
-		return;
+	     !nla_value[MLXDEVM_ATTR_IDX_PARAM_VALUE_DATA]))
+		return false;
 
 	param->cmode =
-		mnl_attr_get_u8(nla_value[MLXDEVM_ATTR_PARAM_VALUE_CMODE]);
-	val_attr = nla_value[MLXDEVM_ATTR_PARAM_VALUE_DATA];
+		mnl_attr_get_u8(nla_value[MLXDEVM_ATTR_IDX_PARAM_VALUE_CMODE]);
+	val_attr = nla_value[MLXDEVM_ATTR_IDX_PARAM_VALUE_DATA];
 
 	switch (nla_type) {
 	case MNL_TYPE_U8:
@@ -523,46 +1063,47 @@ static void parse_param_value(struct mlxdevm_param *param, const char *nla_name,
 	default:
 		break;
 	}
+	return true;
 }
 
 static void parse_params(struct mlxdevm_param *param, struct nlattr **tb)
 {
-	struct nlattr *nla_param[MLXDEVM_ATTR_MAX + 1] = {};
+	struct nlattr *nla_param[MLXDEVM_ATTR_IDX_MAX + 1] = {};
 	struct nlattr *param_value_attr;
 	const char *nla_name;
 	int nla_type;
 	int err;
 
-	err = mnl_attr_parse_nested(tb[MLXDEVM_ATTR_PARAM], attr_parse_cb, nla_param);
+	err = mlxdevm_attr_parse_nested(tb[MLXDEVM_ATTR_IDX_PARAM], nla_param);
 	if (err != MNL_CB_OK)
 		return;
-	if (!nla_param[MLXDEVM_ATTR_PARAM_NAME] ||
-	    !nla_param[MLXDEVM_ATTR_PARAM_TYPE] ||
-	    !nla_param[MLXDEVM_ATTR_PARAM_VALUES_LIST])
+	if (!nla_param[MLXDEVM_ATTR_IDX_PARAM_NAME] ||
+	    !nla_param[MLXDEVM_ATTR_IDX_PARAM_TYPE] ||
+	    !nla_param[MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST])
 		return;
 
-	if (nla_param[MLXDEVM_ATTR_PARAM_GENERIC])
+	if (nla_param[MLXDEVM_ATTR_IDX_PARAM_GENERIC])
 		return;
 
-	nla_type = mnl_attr_get_u8(nla_param[MLXDEVM_ATTR_PARAM_TYPE]);
+	nla_type = mnl_attr_get_u8(nla_param[MLXDEVM_ATTR_IDX_PARAM_TYPE]);
 	param->nla_type = nla_type;
 
-	nla_name = mnl_attr_get_str(nla_param[MLXDEVM_ATTR_PARAM_NAME]);
+	nla_name = mnl_attr_get_str(nla_param[MLXDEVM_ATTR_IDX_PARAM_NAME]);
+	MLXDEVM_TRACE(parse_param, MLXDEVM_CMD_PARAM_GET, nla_name);
 
 	mnl_attr_for_each_nested(param_value_attr,
-				 nla_param[MLXDEVM_ATTR_PARAM_VALUES_LIST]) {
+				 nla_param[MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST]) {
 		parse_param_value(param, nla_name, nla_type, param_value_attr);
 	}
 }
 
 static int cmd_dev_param_show_cb(const struct nlmsghdr *nlh, void *data)
 {
-	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
-	struct nlattr *tb[MLXDEVM_ATTR_MAX + 1] = {};
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
 
-	mnl_attr_parse(nlh, sizeof(*genl), attr_parse_cb, tb);
-	if (!tb[MLXDEVM_ATTR_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_DEV_NAME] ||
-	    !tb[MLXDEVM_ATTR_PARAM])
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_IDX_DEV_NAME] ||
+	    !tb[MLXDEVM_ATTR_IDX_PARAM])
 		return MNL_CB_ERROR;
 	parse_params(data, tb);
 	return MNL_CB_OK;
@@ -572,24 +1113,181 @@ int mlxdevm_dev_driver_param_get(struct mlxdevm *dl, const char *param_name,
 				 struct mlxdevm_param *param)
 {
 	struct nlmsghdr *nlh;
+	int err;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PARAM_GET,
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PARAM_GET,
 					 NLM_F_REQUEST | NLM_F_ACK);
 
 	dev_handle_set(nlh, dl);
         mnl_attr_put_strz(nlh, MLXDEVM_ATTR_PARAM_NAME, param_name);
-	return netlink_socket_sndrcv(&dl->nls, nlh, cmd_dev_param_show_cb, param);
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = mlxdevm_cmd_sndrcv(dl, nlh, cmd_dev_param_show_cb, param);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
 }
 
-int mlxdevm_dev_driver_param_set(struct mlxdevm *dl, const char *param_name,
-				 const struct mlxdevm_param *param)
+#define MLXDEVM_PARAMS_MIN 16
+
+static struct mlxdevm_param_entry *params_entry_get(struct mlxdevm_params *params)
+{
+	struct mlxdevm_param_entry *entries;
+	unsigned int capacity;
+
+	if (params->count == params->capacity) {
+		capacity = params->capacity ? params->capacity * 2 :
+					      MLXDEVM_PARAMS_MIN;
+		entries = realloc(params->entries, capacity * sizeof(*entries));
+		if (!entries)
+			return NULL;
+		params->entries = entries;
+		params->capacity = capacity;
+	}
+	return &params->entries[params->count];
+}
+
+struct params_dump_ctx {
+	const char *bus;
+	const char *dev;
+	struct mlxdevm_params *params;
+};
+
+static int cmd_dev_params_dump_cb(const struct nlmsghdr *nlh, void *data)
 {
+	struct nlattr *nla_param[MLXDEVM_ATTR_IDX_MAX + 1] = {};
+	struct nlattr *tb[MLXDEVM_ATTR_IDX_MAX + 1] = {};
+	struct params_dump_ctx *ctx = data;
+	struct mlxdevm_param_entry *entry;
+	struct nlattr *param_value_attr;
+	const char *nla_name;
+	bool generic;
+	int nla_type;
+	int err;
+
+	mlxdevm_attr_parse(nlh, tb);
+	if (!tb[MLXDEVM_ATTR_IDX_PARAM])
+		return MNL_CB_OK;
+
+	/* The kernel may dump the parameters of all the devices */
+	if (!dev_attrs_match(tb, ctx->bus, ctx->dev))
+		return MNL_CB_OK;
+
+	err = mlxdevm_attr_parse_nested(tb[MLXDEVM_ATTR_IDX_PARAM], nla_param);
+	if (err != MNL_CB_OK)
+		return MNL_CB_OK;
+	if (!nla_param[MLXDEVM_ATTR_IDX_PARAM_NAME] ||
+	    !nla_param[MLXDEVM_ATTR_IDX_PARAM_TYPE] ||
+	    !nla_param[MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST])
+		return MNL_CB_OK;
+
+	nla_name = mnl_attr_get_str(nla_param[MLXDEVM_ATTR_IDX_PARAM_NAME]);
+	if (strlen(nla_name) >= MLXDEVM_PARAM_NAME_LEN)
+		return MNL_CB_OK;
+	MLXDEVM_TRACE(parse_param, genl_cmd(nlh), nla_name);
+	nla_type = mnl_attr_get_u8(nla_param[MLXDEVM_ATTR_IDX_PARAM_TYPE]);
+	generic = !!nla_param[MLXDEVM_ATTR_IDX_PARAM_GENERIC];
+
+	/* One entry per configuration mode the parameter has a value for */
+	mnl_attr_for_each_nested(param_value_attr,
+				 nla_param[MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST]) {
+		entry = params_entry_get(ctx->params);
+		if (!entry)
+			return -ENOMEM;
+
+		memset(entry, 0, sizeof(*entry));
+		entry->param.nla_type = nla_type;
+		if (!parse_param_value(&entry->param, nla_name, nla_type,
+				       param_value_attr))
+			continue;
+		strcpy(entry->name, nla_name);
+		entry->generic = generic;
+		ctx->params->count++;
+	}
+	return MNL_CB_OK;
+}
+
+/* Entries of parameter @name only, or of all of them when NULL */
+static int params_get_dev(struct mlxdevm *dl, const char *bus,
+			  const char *dev, const char *name,
+			  struct mlxdevm_params *params)
+{
+	struct params_dump_ctx ctx = {
+		.bus = bus,
+		.dev = dev,
+		.params = params,
+	};
+	uint16_t flags = NLM_F_REQUEST | NLM_F_ACK;
 	struct nlmsghdr *nlh;
+	int err;
 
-	nlh = netlink_socket_cmd_prepare(&dl->nls, MLXDEVM_CMD_PARAM_SET,
-					 NLM_F_REQUEST | NLM_F_ACK);
+	params->count = 0;
 
-	dev_handle_set(nlh, dl);
+	if (!name)
+		flags |= NLM_F_DUMP;
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PARAM_GET, flags);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_BUS_NAME, bus);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_NAME, dev);
+	if (name)
+		mnl_attr_put_strz(nlh, MLXDEVM_ATTR_PARAM_NAME, name);
+
+	err = mlxdevm_cmd_sndrcv(dl, nlh, cmd_dev_params_dump_cb, &ctx);
+	if (err)
+		params->count = 0;
+	return err;
+}
+
+int mlxdevm_params_dump_dev(struct mlxdevm *dl, const char *bus,
+			    const char *dev, struct mlxdevm_params *params)
+{
+	return params_get_dev(dl, bus, dev, NULL, params);
+}
+
+int mlxdevm_param_get_dev(struct mlxdevm *dl, const char *bus,
+			  const char *dev, const char *name,
+			  struct mlxdevm_params *params)
+{
+	return params_get_dev(dl, bus, dev, name, params);
+}
+
+int mlxdevm_dev_driver_params_dump(struct mlxdevm *dl,
+				   struct mlxdevm_params *params)
+{
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = mlxdevm_params_dump_dev(dl, dl->bus, dl->dev, params);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+const struct mlxdevm_param_entry *
+mlxdevm_params_find(const struct mlxdevm_params *params, const char *name,
+		    uint8_t cmode)
+{
+	unsigned int i;
+
+	for (i = 0; i < params->count; i++) {
+		if (params->entries[i].param.cmode == cmode &&
+		    !strcmp(params->entries[i].name, name))
+			return &params->entries[i];
+	}
+	return NULL;
+}
+
+void mlxdevm_params_free(struct mlxdevm_params *params)
+{
+	free(params->entries);
+	params->entries = NULL;
+	params->count = 0;
+	params->capacity = 0;
+}
+
+static void param_set_put(struct nlmsghdr *nlh, const char *bus,
+			  const char *dev, const char *param_name,
+			  const struct mlxdevm_param *param)
+{
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_BUS_NAME, bus);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_NAME, dev);
 	mnl_attr_put_u8(nlh, MLXDEVM_ATTR_PARAM_VALUE_CMODE, param->cmode);
         mnl_attr_put_strz(nlh, MLXDEVM_ATTR_PARAM_NAME, param_name);
 	mnl_attr_put_u8(nlh, MLXDEVM_ATTR_PARAM_TYPE, param->nla_type);
@@ -612,6 +1310,770 @@ int mlxdevm_dev_driver_param_set(struct mlxdevm *dl, const char *param_name,
 			mnl_attr_put(nlh, MLXDEVM_ATTR_PARAM_VALUE_DATA, 0, NULL);
 		break;
 	}
+}
+
+int mlxdevm_dev_driver_param_set(struct mlxdevm *dl, const char *param_name,
+				 const struct mlxdevm_param *param)
+{
+	struct nlmsghdr *nlh;
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PARAM_SET,
+					 NLM_F_REQUEST | NLM_F_ACK);
+	param_set_put(nlh, dl->bus, dl->dev, param_name, param);
+
+	err = mlxdevm_cmd_sndrcv(dl, nlh, NULL, NULL);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+enum mlxdevm_port_op_type {
+	MLXDEVM_PORT_OP_ADD,
+	MLXDEVM_PORT_OP_DEL,
+	MLXDEVM_PORT_OP_GET,
+	MLXDEVM_PORT_OP_MAC_ADDR,
+	MLXDEVM_PORT_OP_STATE,
+	MLXDEVM_PORT_OP_EXT_CAP,
+};
+
+/* Port command in flight on a batch or on the non-blocking socket. Port
+ * fields are updated once the command completes successfully.
+ */
+struct mlxdevm_port_op {
+	struct mlxdevm *dl;
+	struct mlxdevm_port *port;
+	enum mlxdevm_port_op_type type;
+	union {
+		uint8_t mac_addr[6];
+		uint8_t state;
+		struct mlxdevm_port_fn_ext_cap cap;
+	} u;
+	/* batch completion */
+	int *err;
+	/* non-blocking completion */
+	mlxdevm_cb_t cb;
+	void *priv;
+	int token;
+};
+
+struct mlxdevm_batch {
+	struct mlxdevm *dl;
+	struct netlink_batch nb;
+	struct mlxdevm_port_op *ops;
+};
+
+struct mlxdevm_async {
+	struct netlink_async na;
+	struct mlxdevm_port_op *ops;
+};
+
+struct mlxdevm_batch *mlxdevm_batch_create(struct mlxdevm *dl,
+					   unsigned int depth)
+{
+	struct mlxdevm_batch *b;
+	int err;
 
-	return netlink_socket_sndrcv(&dl->nls, nlh, NULL, NULL);
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	err = netlink_batch_init(&b->nb, dl->nls, depth);
+	if (err)
+		goto nb_err;
+
+	b->ops = calloc(b->nb.depth, sizeof(*b->ops));
+	if (!b->ops)
+		goto ops_err;
+
+	b->dl = dl;
+	return b;
+
+ops_err:
+	netlink_batch_fini(&b->nb);
+nb_err:
+	free(b);
+	return NULL;
+}
+
+void mlxdevm_batch_destroy(struct mlxdevm_batch *b)
+{
+	netlink_batch_fini(&b->nb);
+	free(b->ops);
+	free(b);
+}
+
+int mlxdevm_batch_flush(struct mlxdevm_batch *b)
+{
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = netlink_batch_flush(&b->nb);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+/* The value changed by a set in flight is unknown until the set succeeds,
+ * so that the cache does not skip a set behind it or after its failure.
+ */
+static void port_op_forget(struct mlxdevm_port_op *op)
+{
+	switch (op->type) {
+	case MLXDEVM_PORT_OP_ADD:
+	case MLXDEVM_PORT_OP_DEL:
+	case MLXDEVM_PORT_OP_GET:
+		break;
+	case MLXDEVM_PORT_OP_MAC_ADDR:
+		op->port->fn_valid &= ~MLXDEVM_PORT_FN_VALID_MAC;
+		break;
+	case MLXDEVM_PORT_OP_STATE:
+		op->port->fn_valid &= ~MLXDEVM_PORT_FN_VALID_STATE;
+		break;
+	case MLXDEVM_PORT_OP_EXT_CAP:
+		op->port->fn_valid &= ~MLXDEVM_PORT_FN_VALID_EXT_CAP;
+		break;
+	}
+}
+
+static void port_op_done(int err, void *data)
+{
+	struct mlxdevm_port_op *op = data;
+	struct mlxdevm_port *port = op->port;
+
+	if (!err) {
+		switch (op->type) {
+		case MLXDEVM_PORT_OP_ADD:
+		case MLXDEVM_PORT_OP_DEL:
+		case MLXDEVM_PORT_OP_GET:
+			break;
+		case MLXDEVM_PORT_OP_MAC_ADDR:
+			port_fn_mac_addr_update(port, op->u.mac_addr);
+			break;
+		case MLXDEVM_PORT_OP_STATE:
+			port_fn_state_update(port, op->u.state);
+			break;
+		case MLXDEVM_PORT_OP_EXT_CAP:
+			port_fn_ext_cap_update(port, &op->u.cap);
+			break;
+		}
+	}
+	if (op->err)
+		*op->err = err;
+	if (op->cb)
+		op->cb(op->dl, op->token, err, op->priv);
+}
+
+static int port_op_show_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct mlxdevm_port_op *op = data;
+
+	return cmd_port_show_cb(nlh, op->port);
+}
+
+/* Complete a command which could not be queued because the implicit
+ * flush failed; the error is also returned to the caller.
+ */
+static int batch_prepare_err(int *err)
+{
+	int ret = -errno;
+
+	if (err)
+		*err = ret;
+	return ret;
+}
+
+int mlxdevm_batch_sf_port_add(struct mlxdevm_batch *b,
+			      struct mlxdevm_port *port,
+			      uint32_t pfnum, uint32_t sfnum, int *err)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	memset(port, 0, sizeof(*port));
+	port->pfnum = pfnum;
+	port->sfnum = sfnum;
+
+	nlh = netlink_batch_cmd_prepare(&b->nb, MLXDEVM_CMD_PORT_NEW,
+					NLM_F_REQUEST | NLM_F_ACK);
+	if (!nlh)
+		return batch_prepare_err(err);
+	op = &b->ops[b->nb.queued];
+	memset(op, 0, sizeof(*op));
+	op->dl = b->dl;
+	op->port = port;
+	op->err = err;
+	op->type = MLXDEVM_PORT_OP_ADD;
+
+	sf_port_add_put(nlh, b->dl, pfnum, sfnum);
+
+	return netlink_batch_queue(&b->nb, nlh, port_op_show_cb,
+				   port_op_done, op);
+}
+
+static struct nlmsghdr *
+batch_port_cmd_prepare(struct mlxdevm_batch *b, uint8_t cmd,
+		       struct mlxdevm_port *port, int *err,
+		       struct mlxdevm_port_op **op)
+{
+	struct nlmsghdr *nlh;
+
+	/* Preparing may flush the batch, so pick the op slot afterwards */
+	nlh = netlink_batch_cmd_prepare(&b->nb, cmd, NLM_F_REQUEST | NLM_F_ACK);
+	if (!nlh)
+		return NULL;
+	*op = &b->ops[b->nb.queued];
+	memset(*op, 0, sizeof(**op));
+	(*op)->dl = b->dl;
+	(*op)->port = port;
+	(*op)->err = err;
+	port_handle_set(nlh, b->dl, port);
+	return nlh;
+}
+
+static void port_fn_attrs_put(struct nlmsghdr *nlh, const uint8_t *addr,
+			      const uint8_t *state)
+{
+	struct nlattr *nest;
+
+	nest = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_PORT_FUNCTION);
+
+	if (addr)
+		mnl_attr_put(nlh, MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR, 6, addr);
+	if (state)
+		mnl_attr_put_u8(nlh, MLXDEVM_PORT_FN_ATTR_STATE, *state);
+	mnl_attr_nest_end(nlh, nest);
+}
+
+int mlxdevm_port_fn_apply(struct mlxdevm *dl, struct mlxdevm_port *port,
+			  const struct mlxdevm_port_fn_config *cfg)
+{
+	const uint8_t *state = NULL;
+	const uint8_t *addr = NULL;
+	struct nlmsghdr *nlh;
+	int err = 0;
+
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+
+	/* Capabilities have their own command and must be in place before
+	 * the function is activated, so they are set first.
+	 */
+	if (cfg->ext_cap.roce_valid || cfg->ext_cap.max_uc_macs_valid) {
+		err = mlxdevm_port_fn_cap_set(dl, port, &cfg->ext_cap);
+		if (err)
+			goto out;
+	}
+
+	if (cfg->mac_addr_valid &&
+	    !port_fn_mac_addr_cached(dl, port, cfg->mac_addr))
+		addr = cfg->mac_addr;
+	if (cfg->state_valid && !port_fn_state_cached(dl, port, cfg->state))
+		state = &cfg->state;
+	if (!addr && !state)
+		goto out;
+
+	nlh = netlink_socket_cmd_prepare(dl->nls, MLXDEVM_CMD_PORT_SET,
+					 NLM_F_REQUEST | NLM_F_ACK);
+	port_handle_set(nlh, dl, port);
+	port_fn_attrs_put(nlh, addr, state);
+	err = mlxdevm_cmd_sndrcv(dl, nlh, NULL, NULL);
+	if (err)
+		goto out;
+
+	if (addr)
+		port_fn_mac_addr_update(port, addr);
+	if (state)
+		port_fn_state_update(port, *state);
+out:
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, err);
+	return err;
+}
+
+/* Complete a batched set skipped by the cache */
+static int batch_cached(int *err)
+{
+	if (err)
+		*err = 0;
+	return 0;
+}
+
+int mlxdevm_batch_port_fn_macaddr_set(struct mlxdevm_batch *b,
+				      struct mlxdevm_port *port,
+				      const uint8_t *addr, int *err)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	if (port_fn_mac_addr_cached(b->dl, port, addr))
+		return batch_cached(err);
+
+	nlh = batch_port_cmd_prepare(b, MLXDEVM_CMD_PORT_SET, port, err, &op);
+	if (!nlh)
+		return batch_prepare_err(err);
+	port_fn_mac_addr_put(nlh, addr);
+	op->type = MLXDEVM_PORT_OP_MAC_ADDR;
+	memcpy(op->u.mac_addr, addr, sizeof(op->u.mac_addr));
+	port_op_forget(op);
+
+	return netlink_batch_queue(&b->nb, nlh, NULL, port_op_done, op);
+}
+
+int mlxdevm_batch_port_fn_state_set(struct mlxdevm_batch *b,
+				    struct mlxdevm_port *port,
+				    uint8_t state, int *err)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	if (port_fn_state_cached(b->dl, port, state))
+		return batch_cached(err);
+
+	nlh = batch_port_cmd_prepare(b, MLXDEVM_CMD_PORT_SET, port, err, &op);
+	if (!nlh)
+		return batch_prepare_err(err);
+	port_fn_state_put(nlh, state);
+	op->type = MLXDEVM_PORT_OP_STATE;
+	op->u.state = state;
+	port_op_forget(op);
+
+	return netlink_batch_queue(&b->nb, nlh, NULL, port_op_done, op);
+}
+
+int mlxdevm_batch_port_fn_cap_set(struct mlxdevm_batch *b,
+				  struct mlxdevm_port *port,
+				  const struct mlxdevm_port_fn_ext_cap *cap,
+				  int *err)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	if (!port->ext_cap.roce_valid && !port->ext_cap.max_uc_macs_valid) {
+		if (err)
+			*err = -EOPNOTSUPP;
+		return 0;
+	}
+	if (port_fn_ext_cap_cached(b->dl, port, cap))
+		return batch_cached(err);
+
+	nlh = batch_port_cmd_prepare(b, MLXDEVM_CMD_EXT_CAP_SET, port, err,
+				     &op);
+	if (!nlh)
+		return batch_prepare_err(err);
+	port_fn_ext_cap_put(nlh, cap);
+	op->type = MLXDEVM_PORT_OP_EXT_CAP;
+	op->u.cap = *cap;
+	port_op_forget(op);
+
+	return netlink_batch_queue(&b->nb, nlh, NULL, port_op_done, op);
+}
+
+int mlxdevm_batch_sf_port_del(struct mlxdevm_batch *b,
+			      struct mlxdevm_port *port, int *err)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	nlh = batch_port_cmd_prepare(b, MLXDEVM_CMD_PORT_DEL, port, err, &op);
+	if (!nlh)
+		return batch_prepare_err(err);
+	op->type = MLXDEVM_PORT_OP_DEL;
+
+	return netlink_batch_queue(&b->nb, nlh, NULL, port_op_done, op);
+}
+
+static int batch_result_count(const int *errs, unsigned int count)
+{
+	unsigned int i;
+	int done = 0;
+
+	for (i = 0; i < count; i++) {
+		if (!errs[i])
+			done++;
+	}
+	return done;
+}
+
+int mlxdevm_sf_port_add_batch(struct mlxdevm *dl,
+			      const struct mlxdevm_sf_port_id *ids,
+			      struct mlxdevm_port *ports, int *errs,
+			      unsigned int count)
+{
+	struct mlxdevm_batch *b;
+	unsigned int i;
+	int err;
+
+	b = mlxdevm_batch_create(dl, 0);
+	if (!b)
+		return -ENOMEM;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	for (i = 0; i < count; i++) {
+		errs[i] = -EINPROGRESS;
+		mlxdevm_batch_sf_port_add(b, &ports[i], ids[i].pfnum,
+					  ids[i].sfnum, &errs[i]);
+	}
+	err = mlxdevm_batch_flush(b);
+	mlxdevm_batch_destroy(b);
+	if (!err || batch_result_count(errs, count))
+		err = batch_result_count(errs, count);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+int mlxdevm_sf_port_del_batch(struct mlxdevm *dl, struct mlxdevm_port *ports,
+			      int *errs, unsigned int count)
+{
+	struct mlxdevm_batch *b;
+	unsigned int i;
+	int err;
+
+	b = mlxdevm_batch_create(dl, 0);
+	if (!b)
+		return -ENOMEM;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	for (i = 0; i < count; i++) {
+		errs[i] = -EINPROGRESS;
+		mlxdevm_batch_sf_port_del(b, &ports[i], &errs[i]);
+	}
+	err = mlxdevm_batch_flush(b);
+	mlxdevm_batch_destroy(b);
+	if (!err || batch_result_count(errs, count))
+		err = batch_result_count(errs, count);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+static int mlxdevm_async_get(struct mlxdevm *dl)
+{
+	struct mlxdevm_async *async;
+	int err;
+
+	if (dl->async)
+		return 0;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return -ENOMEM;
+
+	err = netlink_async_init(&async->na, dl->nls, 0);
+	if (err)
+		goto na_err;
+
+	async->ops = calloc(async->na.depth, sizeof(*async->ops));
+	if (!async->ops) {
+		err = -ENOMEM;
+		goto ops_err;
+	}
+
+	dl->async = async;
+	return 0;
+
+ops_err:
+	netlink_async_fini(&async->na);
+na_err:
+	free(async);
+	return err;
+}
+
+static void mlxdevm_async_destroy(struct mlxdevm_async *async)
+{
+	netlink_async_fini(&async->na);
+	free(async->ops);
+	free(async);
+}
+
+int mlxdevm_get_fd(struct mlxdevm *dl)
+{
+	int err;
+
+	err = mlxdevm_async_get(dl);
+	if (err)
+		return err;
+
+	return netlink_socket_get_fd(&dl->async->na.nls);
+}
+
+int mlxdevm_process(struct mlxdevm *dl)
+{
+	int err;
+
+	if (!dl->async)
+		return 0;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	err = netlink_async_process(&dl->async->na);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+static struct nlmsghdr *
+async_port_cmd_prepare(struct mlxdevm *dl, uint8_t cmd,
+		       struct mlxdevm_port *port, mlxdevm_cb_t cb, void *priv,
+		       struct mlxdevm_port_op **op)
+{
+	struct mlxdevm_async *async;
+	struct nlmsghdr *nlh;
+	int err;
+
+	err = mlxdevm_async_get(dl);
+	if (err) {
+		errno = -err;
+		return NULL;
+	}
+	async = dl->async;
+
+	nlh = netlink_async_cmd_prepare(&async->na, cmd,
+					NLM_F_REQUEST | NLM_F_ACK);
+	if (!nlh)
+		return NULL;
+
+	*op = &async->ops[nlh->nlmsg_seq % async->na.depth];
+	memset(*op, 0, sizeof(**op));
+	(*op)->dl = dl;
+	(*op)->port = port;
+	(*op)->cb = cb;
+	(*op)->priv = priv;
+	(*op)->token = nlh->nlmsg_seq & INT_MAX;
+	return nlh;
+}
+
+static int async_port_cmd_submit(struct mlxdevm *dl, struct nlmsghdr *nlh,
+				 mnl_cb_t data_cb, struct mlxdevm_port_op *op)
+{
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(op->port->port_index, op->port->sfnum);
+	port_op_forget(op);
+	err = netlink_async_submit(&dl->async->na, nlh, data_cb,
+				   port_op_done, op);
+	if (!err)
+		err = op->token;
+	MLXDEVM_TRACE_EXIT(op->port->port_index, op->port->sfnum, err);
+	return err;
+}
+
+/* Complete a non-blocking set skipped by the cache right away, under a
+ * sequence number of its own so that its token stays unique.
+ */
+static int async_cached(struct mlxdevm *dl, struct mlxdevm_port *port,
+			mlxdevm_cb_t cb, void *priv)
+{
+	int token;
+	int err;
+
+	err = mlxdevm_async_get(dl);
+	if (err)
+		return err;
+
+	MLXDEVM_TRACE_ENTRY(port->port_index, port->sfnum);
+	token = ++dl->async->na.nls.seq & INT_MAX;
+	if (cb)
+		cb(dl, token, 0, priv);
+	MLXDEVM_TRACE_EXIT(port->port_index, port->sfnum, token);
+	return token;
+}
+
+int mlxdevm_submit_sf_port_add(struct mlxdevm *dl, struct mlxdevm_port *port,
+			       uint32_t pfnum, uint32_t sfnum,
+			       mlxdevm_cb_t cb, void *priv)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	nlh = async_port_cmd_prepare(dl, MLXDEVM_CMD_PORT_NEW, port, cb, priv,
+				     &op);
+	if (!nlh)
+		return -errno;
+
+	memset(port, 0, sizeof(*port));
+	port->pfnum = pfnum;
+	port->sfnum = sfnum;
+	op->type = MLXDEVM_PORT_OP_ADD;
+	sf_port_add_put(nlh, dl, pfnum, sfnum);
+
+	return async_port_cmd_submit(dl, nlh, port_op_show_cb, op);
+}
+
+int mlxdevm_submit_sf_port_del(struct mlxdevm *dl, struct mlxdevm_port *port,
+			       mlxdevm_cb_t cb, void *priv)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	nlh = async_port_cmd_prepare(dl, MLXDEVM_CMD_PORT_DEL, port, cb, priv,
+				     &op);
+	if (!nlh)
+		return -errno;
+
+	op->type = MLXDEVM_PORT_OP_DEL;
+	port_handle_set(nlh, dl, port);
+
+	return async_port_cmd_submit(dl, nlh, NULL, op);
+}
+
+int mlxdevm_submit_port_fn_state_get(struct mlxdevm *dl,
+				     struct mlxdevm_port *port,
+				     mlxdevm_cb_t cb, void *priv)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	nlh = async_port_cmd_prepare(dl, MLXDEVM_CMD_PORT_GET, port, cb, priv,
+				     &op);
+	if (!nlh)
+		return -errno;
+
+	op->type = MLXDEVM_PORT_OP_GET;
+	port_handle_set(nlh, dl, port);
+
+	return async_port_cmd_submit(dl, nlh, port_op_show_cb, op);
+}
+
+int mlxdevm_submit_port_fn_macaddr_set(struct mlxdevm *dl,
+				       struct mlxdevm_port *port,
+				       const uint8_t *addr,
+				       mlxdevm_cb_t cb, void *priv)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	if (port_fn_mac_addr_cached(dl, port, addr))
+		return async_cached(dl, port, cb, priv);
+
+	nlh = async_port_cmd_prepare(dl, MLXDEVM_CMD_PORT_SET, port, cb, priv,
+				     &op);
+	if (!nlh)
+		return -errno;
+
+	op->type = MLXDEVM_PORT_OP_MAC_ADDR;
+	memcpy(op->u.mac_addr, addr, sizeof(op->u.mac_addr));
+	port_handle_set(nlh, dl, port);
+	port_fn_mac_addr_put(nlh, addr);
+
+	return async_port_cmd_submit(dl, nlh, NULL, op);
+}
+
+int mlxdevm_submit_port_fn_state_set(struct mlxdevm *dl,
+				     struct mlxdevm_port *port, uint8_t state,
+				     mlxdevm_cb_t cb, void *priv)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	if (port_fn_state_cached(dl, port, state))
+		return async_cached(dl, port, cb, priv);
+
+	nlh = async_port_cmd_prepare(dl, MLXDEVM_CMD_PORT_SET, port, cb, priv,
+				     &op);
+	if (!nlh)
+		return -errno;
+
+	op->type = MLXDEVM_PORT_OP_STATE;
+	op->u.state = state;
+	port_handle_set(nlh, dl, port);
+	port_fn_state_put(nlh, state);
+
+	return async_port_cmd_submit(dl, nlh, NULL, op);
+}
+
+int mlxdevm_submit_port_fn_cap_set(struct mlxdevm *dl,
+				   struct mlxdevm_port *port,
+				   const struct mlxdevm_port_fn_ext_cap *cap,
+				   mlxdevm_cb_t cb, void *priv)
+{
+	struct mlxdevm_port_op *op;
+	struct nlmsghdr *nlh;
+
+	if (!port->ext_cap.roce_valid && !port->ext_cap.max_uc_macs_valid)
+		return -EOPNOTSUPP;
+	if (port_fn_ext_cap_cached(dl, port, cap))
+		return async_cached(dl, port, cb, priv);
+
+	nlh = async_port_cmd_prepare(dl, MLXDEVM_CMD_EXT_CAP_SET, port, cb,
+				     priv, &op);
+	if (!nlh)
+		return -errno;
+
+	op->type = MLXDEVM_PORT_OP_EXT_CAP;
+	op->u.cap = *cap;
+	port_handle_set(nlh, dl, port);
+	port_fn_ext_cap_put(nlh, cap);
+
+	return async_port_cmd_submit(dl, nlh, NULL, op);
+}
+
+/* Keep the first error of a device */
+static void dev_param_set_done(int err, void *data)
+{
+	int *dev_err = data;
+
+	if (err && !*dev_err)
+		*dev_err = err;
+}
+
+int mlxdevm_devs_params_apply(struct mlxdevm *dl,
+			      const struct mlxdevm_dev_id *devs,
+			      unsigned int ndevs,
+			      const struct mlxdevm_param_profile *profile,
+			      unsigned int nprofile, int *errs)
+{
+	struct mlxdevm_param param;
+	struct netlink_batch nb;
+	struct nlmsghdr *nlh;
+	unsigned int i, j;
+	char *driver;
+	int err;
+
+	err = netlink_batch_init(&nb, dl->nls, 0);
+	if (err)
+		return err;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	for (i = 0; i < ndevs; i++) {
+		errs[i] = 0;
+		driver = mlxdevm_dev_driver_key(devs[i].bus, devs[i].dev);
+		if (!driver && errno != ENOENT) {
+			errs[i] = -errno;
+			continue;
+		}
+
+		for (j = 0; j < nprofile; j++) {
+			param.cmode = profile[j].cmode;
+			param.u = profile[j].value;
+			/* May dump the schema of a new driver; queued messages
+			 * are not sent yet, so the socket is free for it.
+			 */
+			err = mlxdevm_param_type_get(dl, devs[i].bus,
+						     devs[i].dev, driver,
+						     profile[j].name,
+						     param.cmode,
+						     &param.nla_type);
+			if (err) {
+				dev_param_set_done(err, &errs[i]);
+				continue;
+			}
+
+			nlh = netlink_batch_cmd_prepare(&nb, MLXDEVM_CMD_PARAM_SET,
+							NLM_F_REQUEST | NLM_F_ACK);
+			if (!nlh) {
+				dev_param_set_done(-errno, &errs[i]);
+				continue;
+			}
+			param_set_put(nlh, devs[i].bus, devs[i].dev,
+				      profile[j].name, &param);
+			/* Errors, including those of a flush triggered by a
+			 * full batch, are reported by dev_param_set_done()
+			 */
+			netlink_batch_queue(&nb, nlh, NULL, dev_param_set_done,
+					    &errs[i]);
+		}
+		free(driver);
+	}
+
+	err = netlink_batch_flush(&nb);
+	netlink_batch_fini(&nb);
+	if (!err || batch_result_count(errs, ndevs))
+		err = batch_result_count(errs, ndevs);
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
 }
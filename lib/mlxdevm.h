@@ -22,10 +22,33 @@
 
 #include "netlink_utils.h"
 
+struct mlxdevm_async;
+struct mlxdevm_stats_block;
+
 struct mlxdevm {
-	struct netlink_socket nls;
+	/* Socket of the commands, own_nls unless shared with another handle */
+	struct netlink_socket *nls;
+	struct netlink_socket own_nls;
 	char *bus;
 	char *dev;
+	/* Port notifications socket, opened by the first opstate wait */
+	struct mnl_socket *ntf;
+	char *ntf_buf;
+	bool ntf_unsupported;
+	/* Non-blocking requests, created by first use */
+	struct mlxdevm_async *async;
+	/* Skip port function sets which change nothing */
+	bool cache;
+	unsigned long cache_skipped;
+	/* Socket borrowed from another handle by mlxdevm_open_shared() */
+	bool nls_shared;
+	/* bus and dev owned by a mlxdevm_mt */
+	bool names_shared;
+	/* SF driver bind files, opened by first use */
+	struct mlxdevm_sf_drv *sf_drv;
+	/* Command counters of the handle, allocated by the first command */
+	struct mlxdevm_stats_block *stats;
+	unsigned long stats_gen;
 };
 
 /**
@@ -40,6 +63,59 @@ struct mlxdevm {
 struct mlxdevm *mlxdevm_open(const char *dl_sock_name,
 			     const char *dl_bus, const char *dl_dev);
 
+/**
+ * mlxdevm_open_shared - Open a handle on the netlink socket of another one
+ *
+ * @parent: open handle whose socket is used
+ * @dl_bus: mlxdevm instance bus name such as auxiliary
+ * @dl_dev: mlxdevm instance device name
+ *
+ * No socket is created and no family lookup is done, which makes this a
+ * cheap way to get short lived handles, such as one per SF. The handle
+ * must be closed before @parent, and it must not be used concurrently
+ * with @parent or with other handles sharing the socket.
+ * On success it returns valid handle or returns NULL on error.
+ */
+struct mlxdevm *mlxdevm_open_shared(struct mlxdevm *parent,
+				    const char *dl_bus, const char *dl_dev);
+
+/**
+ * mlxdevm_mt - Handle usable from multiple threads
+ *
+ * A handle cannot be used by several threads at the same time, as its
+ * requests share the socket buffer and sequence numbers. A mlxdevm_mt
+ * gives each thread a handle of its own, with its own socket, created on
+ * the first mlxdevm_mt_handle() call of the thread and closed when the
+ * thread exits. Bus and dev names and the family are shared, so creating
+ * a thread handle involves no family lookup.
+ */
+struct mlxdevm_mt;
+
+/**
+ * mlxdevm_mt_open - Open a handle usable from multiple threads
+ *
+ * Same arguments as mlxdevm_open().
+ * Return: handle or NULL on error.
+ */
+struct mlxdevm_mt *mlxdevm_mt_open(const char *dl_sock_name,
+				   const char *dl_bus, const char *dl_dev);
+
+/**
+ * mlxdevm_mt_handle - Get the handle of the calling thread
+ *
+ * The returned handle is used with the regular API by the calling thread
+ * only; it must not be closed. Finding the handle of a thread is lock free.
+ * Return: handle or NULL on error.
+ */
+struct mlxdevm *mlxdevm_mt_handle(struct mlxdevm_mt *mt);
+
+/**
+ * mlxdevm_mt_close - Close the handles of all the threads
+ *
+ * Threads must have stopped using their handles.
+ */
+void mlxdevm_mt_close(struct mlxdevm_mt *mt);
+
 /**
  * mlxdevm_close - Close a previously open mlxdevm connection.
  * 
@@ -68,8 +144,14 @@ struct mlxdevm_port {
 	uint8_t state;
 	uint8_t opstate;
 	struct mlxdevm_port_fn_ext_cap ext_cap;
+	/* MLXDEVM_PORT_FN_VALID_* fields known from the kernel */
+	uint8_t fn_valid;
 };
 
+#define MLXDEVM_PORT_FN_VALID_STATE	(1 << 0)
+#define MLXDEVM_PORT_FN_VALID_MAC	(1 << 1)
+#define MLXDEVM_PORT_FN_VALID_EXT_CAP	(1 << 2)
+
 /**
  * mlxdevm_port_list - filled by mlxdevm_sf_port_list_dump
  */
@@ -92,12 +174,172 @@ TAILQ_HEAD(mlxdevm_port_list_head, mlxdevm_port_list);
 struct mlxdevm_port *
 mlxdevm_sf_port_add(struct mlxdevm *dl, uint32_t pfnum, uint32_t sfnum);
 
+/**
+ * mlxdevm_sf_port_id - SF port to be added by mlxdevm_sf_port_add_batch
+ */
+struct mlxdevm_sf_port_id {
+	uint32_t pfnum;
+	uint32_t sfnum;
+};
+
+/**
+ * mlxdevm_sf_port_add_batch - Add multiple mlxdevm SF ports
+ *
+ * Add one SF port for each of the @count entries of @ids. Port add
+ * commands are packed together and sent with few system calls. Entry i
+ * of the caller provided @ports array is filled when port i is added;
+ * entry i of @errs is set to 0 or to the negative error code of that port.
+ * Ports added this way are owned by the caller and must be deleted with
+ * mlxdevm_sf_port_del_batch(), not with mlxdevm_sf_port_del().
+ * Return: number of ports added or a negative error code when no port
+ * could be added because of a socket error.
+ */
+int mlxdevm_sf_port_add_batch(struct mlxdevm *dl,
+			      const struct mlxdevm_sf_port_id *ids,
+			      struct mlxdevm_port *ports, int *errs,
+			      unsigned int count);
+
+/**
+ * mlxdevm_sf_port_del_batch - Delete multiple SF ports without freeing them
+ *
+ * Entry i of @errs is set to 0 or the negative error code of port i.
+ * Return: number of ports deleted or a negative error code when no port
+ * could be deleted because of a socket error.
+ */
+int mlxdevm_sf_port_del_batch(struct mlxdevm *dl, struct mlxdevm_port *ports,
+			      int *errs, unsigned int count);
+
 /**
  * mlxdevm_sf_port_list_dump - Dump a port list into the list defined by head
  */
 int mlxdevm_sf_port_list_dump(struct mlxdevm *dl,
 			      struct mlxdevm_port_list_head *head);
 
+/**
+ * mlxdevm_port_cb_t - Callback invoked by mlxdevm_sf_port_foreach
+ *
+ * @port is only valid for the duration of the call.
+ * Return: 0 to continue the iteration, any other value stops it.
+ */
+typedef int (*mlxdevm_port_cb_t)(struct mlxdevm *dl,
+				 const struct mlxdevm_port *port, void *priv);
+
+/**
+ * mlxdevm_sf_port_foreach - Invoke @cb for every SF port of the device
+ *
+ * Same as mlxdevm_sf_port_list_dump() without building a list: each port
+ * is decoded into a temporary and passed to @cb, so no memory is allocated.
+ * Return: 0 when all ports were visited, the non zero value returned by
+ * @cb which stopped the iteration, or a negative error code.
+ */
+int mlxdevm_sf_port_foreach(struct mlxdevm *dl, mlxdevm_port_cb_t cb,
+			    void *priv);
+
+/**
+ * mlxdevm_port_snapshot - SF ports of a device stored in one array
+ *
+ * Must be zero initialized before the first mlxdevm_port_snapshot_fill().
+ * The array is kept between fills, so refreshing a snapshot of a device
+ * whose port count doesn't grow does not allocate memory.
+ */
+struct mlxdevm_port_snapshot {
+	struct mlxdevm_port *ports;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+/**
+ * mlxdevm_port_snapshot_fill - Replace the content of @snap by the current
+ * SF ports of the device
+ *
+ * Previous entries of @snap, and pointers to them, are invalidated. On
+ * error the snapshot is left empty.
+ * Return: 0 on success or a negative error code.
+ */
+int mlxdevm_port_snapshot_fill(struct mlxdevm *dl,
+			       struct mlxdevm_port_snapshot *snap);
+
+/**
+ * mlxdevm_port_snapshot_free - Free the memory of the snapshot
+ */
+void mlxdevm_port_snapshot_free(struct mlxdevm_port_snapshot *snap);
+
+/**
+ * mlxdevm_port_table - Hash indexes on ports owned by the caller
+ *
+ * Ports are looked up in constant time by port index, by (pfnum, sfnum)
+ * and by netdevice ifindex. The table only stores pointers: a port must
+ * stay valid while it is in the table and be removed before it is freed
+ * or deleted. Ports are indexed by the ifindex they have when inserted;
+ * mlxdevm_port_table_update() must be called when it changes. The table
+ * is not thread safe.
+ */
+struct mlxdevm_port_table;
+
+/**
+ * mlxdevm_port_table_create - Create a port table sized for @size_hint ports
+ *
+ * The table grows as needed when more ports are inserted.
+ * Return: table or NULL on error.
+ */
+struct mlxdevm_port_table *mlxdevm_port_table_create(unsigned int size_hint);
+
+/**
+ * mlxdevm_port_table_destroy - Destroy a port table; ports are not freed
+ */
+void mlxdevm_port_table_destroy(struct mlxdevm_port_table *t);
+
+/**
+ * mlxdevm_port_table_insert - Insert a port into the table
+ * Return: 0 on success, -EEXIST if a port with the same port index is
+ * present or another negative error code.
+ */
+int mlxdevm_port_table_insert(struct mlxdevm_port_table *t,
+			      struct mlxdevm_port *port);
+
+/**
+ * mlxdevm_port_table_remove - Remove a port from the table
+ * Return: 0 on success or -ENOENT if the port is not in the table.
+ */
+int mlxdevm_port_table_remove(struct mlxdevm_port_table *t,
+			      struct mlxdevm_port *port);
+
+/**
+ * mlxdevm_port_table_update - Re-index a port whose ifindex changed
+ * Return: 0 on success or -ENOENT if the port is not in the table.
+ */
+int mlxdevm_port_table_update(struct mlxdevm_port_table *t,
+			      struct mlxdevm_port *port);
+
+/**
+ * mlxdevm_port_table_add_list - Insert all the ports of a list filled by
+ * mlxdevm_sf_port_list_dump()
+ *
+ * Entries must be removed from the table before mlxdevm_sf_port_list_item_del().
+ * Return: 0 on success or a negative error code.
+ */
+int mlxdevm_port_table_add_list(struct mlxdevm_port_table *t,
+				struct mlxdevm_port_list_head *head);
+
+/**
+ * mlxdevm_port_table_count - Number of ports in the table
+ */
+unsigned int mlxdevm_port_table_count(const struct mlxdevm_port_table *t);
+
+/*
+ * mlxdevm_port_table_find_* - Look up a port
+ * Return: port or NULL if there is no matching port in the table.
+ */
+struct mlxdevm_port *
+mlxdevm_port_table_find_index(const struct mlxdevm_port_table *t,
+			      uint32_t port_index);
+struct mlxdevm_port *
+mlxdevm_port_table_find_sfnum(const struct mlxdevm_port_table *t,
+			      uint32_t pfnum, uint32_t sfnum);
+struct mlxdevm_port *
+mlxdevm_port_table_find_ifindex(const struct mlxdevm_port_table *t,
+				uint32_t ifindex);
+
 /**
  * mlxdevm_sf_port_del_list_item - Delete an item in the port list
  */
@@ -119,6 +361,64 @@ int mlxdevm_port_fn_macaddr_set(struct mlxdevm *dl, struct mlxdevm_port *port,
 int mlxdevm_port_fn_state_set(struct mlxdevm *dl, struct mlxdevm_port *port,
 			      uint8_t state);
 
+/**
+ * mlxdevm_port_fn_config - Port function configuration
+ *
+ * Only the fields whose valid flag is set are configured.
+ */
+struct mlxdevm_port_fn_config {
+	uint8_t mac_addr[6];
+	bool mac_addr_valid;
+	uint8_t state;
+	bool state_valid;
+	struct mlxdevm_port_fn_ext_cap ext_cap;
+};
+
+/**
+ * mlxdevm_port_fn_apply - Configure several port function fields at once
+ *
+ * The MAC address and the state are sent in a single port set command.
+ * Capabilities need a command of their own, which is sent first so that
+ * they are in place before the function is activated. Port fields are
+ * updated once the command which sets them succeeds, so a failure of the
+ * port set command leaves the port MAC address and state unchanged.
+ * Return: 0 on success or a negative error code.
+ */
+int mlxdevm_port_fn_apply(struct mlxdevm *dl, struct mlxdevm_port *port,
+			  const struct mlxdevm_port_fn_config *cfg);
+
+/**
+ * mlxdevm_cache_enable - Enable or disable cached mode on the handle
+ *
+ * In cached mode, port function MAC address, state and capability sets,
+ * including batched ones, complete successfully without any command when
+ * the port already has the requested value according to its last known
+ * kernel state. That state is updated by the port add and get commands,
+ * by successful sets, by the opstate waits and by mlxdevm_ports_refresh();
+ * ports whose state may have been changed by someone else should be
+ * refreshed before relying on the cache. A batched or non-blocking set
+ * forgets the value it changes until it completes, and for good when it
+ * fails. Cached mode is disabled by default.
+ */
+void mlxdevm_cache_enable(struct mlxdevm *dl, bool enable);
+
+/**
+ * mlxdevm_cache_skipped_get - Number of sets skipped in cached mode
+ */
+unsigned long mlxdevm_cache_skipped_get(const struct mlxdevm *dl);
+
+/**
+ * mlxdevm_ports_refresh - Update the port function state of @n ports
+ *
+ * The ports of the device are dumped once and all the ports of the set
+ * are updated from the dump. Ports of other devices in the dump are
+ * ignored. A port listed more than once in @ports has all its entries
+ * updated.
+ * Return: 0 on success or a negative error code.
+ */
+int mlxdevm_ports_refresh(struct mlxdevm *dl, struct mlxdevm_port **ports,
+			  unsigned int n);
+
 int mlxdevm_port_fn_state_get(struct mlxdevm *dl, struct mlxdevm_port *port,
 			      uint8_t *state, uint8_t *opstate);
 
@@ -128,6 +428,10 @@ int mlxdevm_port_netdev_get(struct mlxdevm *dl, struct mlxdevm_port *port,
 /**
  * mlxdevm_port_fn_opstate_wait_attached - Wait for port function operational
  * state to become attached. Caller must first active the port function.
+ * When the kernel exposes the mlxdevm config multicast group, the wait
+ * sleeps until a port notification arrives and polls the port only when no
+ * notification arrives for a while. Otherwise the port is polled every
+ * millisecond.
  */
 int mlxdevm_port_fn_opstate_wait_attached(struct mlxdevm *dl,
 					  struct mlxdevm_port *port);
@@ -139,6 +443,27 @@ int mlxdevm_port_fn_opstate_wait_attached(struct mlxdevm *dl,
 int mlxdevm_port_fn_opstate_wait_detached(struct mlxdevm *dl,
 					  struct mlxdevm_port *port);
 
+/**
+ * mlxdevm_ports_opstate_wait - Wait for the port function operational state
+ * of @n ports to become @desired.
+ *
+ * All ports must belong to the device of the handle. The ports of the
+ * device are dumped once per poll interval and the state of every port of
+ * the set is updated from the dump, so the cost per interval does not
+ * depend on @n. The wait ends when all ports reach the desired state or at
+ * the absolute CLOCK_MONOTONIC @deadline; a NULL @deadline selects the
+ * same timeout as mlxdevm_port_fn_opstate_wait_attached().
+ * When @stragglers is not NULL, the indices in @ports of the ports which
+ * did not reach the desired state are stored in it; it must have room for
+ * @n entries.
+ * Return: number of ports which did not reach the desired state, so 0 on
+ * success, or a negative error code.
+ */
+int mlxdevm_ports_opstate_wait(struct mlxdevm *dl, struct mlxdevm_port **ports,
+			       unsigned int n, uint8_t desired,
+			       const struct timespec *deadline,
+			       unsigned int *stragglers);
+
 /**
  * mlxdevm_port_fn_cap_set - Set optional function capabilities if it is
  * supported. Each capability has a value and a valid bit mask. Caller
@@ -156,7 +481,7 @@ int mlxdevm_port_fn_cap_set(struct mlxdevm *dl, struct mlxdevm_port *port,
 struct mlxdevm_param {
 	uint8_t cmode;
 	uint8_t nla_type;
-	union {
+	union mlxdevm_param_value {
 		uint8_t val_u8;
 		uint16_t val_u16;
 		uint32_t val_u32;
@@ -180,4 +505,590 @@ int mlxdevm_dev_driver_param_get(struct mlxdevm *dl, const char *param_name,
 int mlxdevm_dev_driver_param_set(struct mlxdevm *dl, const char *param_name,
 				 const struct mlxdevm_param *param);
 
+#define MLXDEVM_PARAM_NAME_LEN 64
+
+/**
+ * mlxdevm_param_entry - Parameter value for one configuration mode
+ */
+struct mlxdevm_param_entry {
+	char name[MLXDEVM_PARAM_NAME_LEN];
+	bool generic;
+	/* cmode, type and value, usable with mlxdevm_dev_driver_param_set() */
+	struct mlxdevm_param param;
+};
+
+/**
+ * mlxdevm_params - Parameters of a device filled by
+ * mlxdevm_dev_driver_params_dump()
+ *
+ * Must be zero initialized before the first dump. The entries array is
+ * kept between dumps, so dumping again into the same table does not
+ * allocate memory once it is large enough.
+ */
+struct mlxdevm_params {
+	struct mlxdevm_param_entry *entries;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+/**
+ * mlxdevm_dev_driver_params_dump - Get all the parameters of the device
+ *
+ * A single parameter dump replaces one mlxdevm_dev_driver_param_get() per
+ * parameter. Previous entries of @params are replaced; a parameter has one
+ * entry for each configuration mode it has a value for. Unlike
+ * mlxdevm_dev_driver_param_get(), generic parameters are included.
+ * Return: 0 on success or a negative error code; the table is left empty
+ * on error.
+ */
+int mlxdevm_dev_driver_params_dump(struct mlxdevm *dl,
+				   struct mlxdevm_params *params);
+
+/**
+ * mlxdevm_params_find - Find the entry of a parameter for a configuration
+ * mode
+ * Return: entry or NULL when the device has no such value.
+ */
+const struct mlxdevm_param_entry *
+mlxdevm_params_find(const struct mlxdevm_params *params, const char *name,
+		    uint8_t cmode);
+
+/**
+ * mlxdevm_params_free - Free the memory of the parameter table
+ */
+void mlxdevm_params_free(struct mlxdevm_params *params);
+
+/**
+ * mlxdevm_dev_driver_param_set_by_name - Set a parameter without getting it
+ *
+ * The type of the parameter and its supported configuration modes come
+ * from a process wide cache of parameter schemas, shared by all the
+ * devices bound to the same driver. The schema of a driver is dumped from
+ * the first device which needs it; later sets on any device of that
+ * driver take a single round trip. The driver is looked up on every call,
+ * so a device moved to another driver uses the schema of the new one.
+ * Devices bound to no driver are not cached: the parameter is read before
+ * it is set.
+ * Return: 0 on success, -ENOENT for an unknown parameter, -EOPNOTSUPP when
+ * the parameter doesn't support @cmode or another negative error code.
+ */
+int mlxdevm_dev_driver_param_set_by_name(struct mlxdevm *dl, const char *name,
+					 uint8_t cmode,
+					 const union mlxdevm_param_value *value);
+
+/**
+ * mlxdevm_dev_id - Device handle of mlxdevm_devs_params_apply targets
+ */
+struct mlxdevm_dev_id {
+	const char *bus;
+	const char *dev;
+};
+
+/**
+ * mlxdevm_param_profile - Parameter value set by mlxdevm_devs_params_apply
+ */
+struct mlxdevm_param_profile {
+	const char *name;
+	uint8_t cmode;
+	union mlxdevm_param_value value;
+};
+
+/**
+ * mlxdevm_devs_params_apply - Set the parameters of a profile on many
+ * devices
+ *
+ * The @nprofile parameters of @profile are set on each of the @ndevs
+ * devices through the socket of @dl, which doesn't need to be a handle of
+ * any of these devices. Parameter types come from the schema cache of
+ * mlxdevm_dev_driver_param_set_by_name() and the set commands of all the
+ * devices are pipelined. Entry i of @errs is set to 0 or to the first
+ * error of device i.
+ * Return: number of devices fully configured or a negative error code
+ * when none could be configured because of a socket error.
+ */
+int mlxdevm_devs_params_apply(struct mlxdevm *dl,
+			      const struct mlxdevm_dev_id *devs,
+			      unsigned int ndevs,
+			      const struct mlxdevm_param_profile *profile,
+			      unsigned int nprofile, int *errs);
+
+/**
+ * mlxdevm_param_cache_clear - Forget all the cached parameter schemas,
+ * such as after a driver upgrade.
+ */
+void mlxdevm_param_cache_clear(void);
+
+/* Command statistics
+ *
+ * Every request sent and waited for by the library is counted per
+ * MLXDEVM_CMD_* command, both for the handle it was sent on and for the
+ * whole process. Counters are kept per thread and updated without locks.
+ * Requests sent through batches or the non-blocking API are not counted.
+ */
+
+#define MLXDEVM_STATS_CMD_MAX		255
+#define MLXDEVM_STATS_HIST_SHIFT	10
+#define MLXDEVM_STATS_HIST_BUCKETS	32
+
+/**
+ * mlxdevm_cmd_stats - Counters of one command
+ * @errors: requests which failed, included in @count
+ * @tx_bytes: bytes of the requests
+ * @rx_bytes: bytes of the replies and acks
+ * @hist: latency histogram; bucket 0 counts requests which took less than
+ * 2^MLXDEVM_STATS_HIST_SHIFT ns and bucket i > 0 the ones which took less
+ * than 2^(MLXDEVM_STATS_HIST_SHIFT + i) ns but longer than bucket i - 1.
+ * The last bucket has no upper bound.
+ */
+struct mlxdevm_cmd_stats {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t hist[MLXDEVM_STATS_HIST_BUCKETS];
+};
+
+/* Indexed by MLXDEVM_CMD_* */
+struct mlxdevm_stats {
+	struct mlxdevm_cmd_stats cmds[MLXDEVM_STATS_CMD_MAX + 1];
+};
+
+/**
+ * mlxdevm_stats_get - Read the counters of handle @dl, or of all the
+ * handles of the process when @dl is NULL
+ *
+ * May be called from any thread. Counters of requests in flight may be
+ * partially updated in the snapshot.
+ */
+void mlxdevm_stats_get(struct mlxdevm *dl, struct mlxdevm_stats *stats);
+
+/**
+ * mlxdevm_stats_reset - Clear the counters of handle @dl, or the process
+ * wide counters when @dl is NULL; may be called from any thread
+ */
+void mlxdevm_stats_reset(struct mlxdevm *dl);
+
+/**
+ * mlxdevm_cb_t - Completion callback of a non-blocking request
+ * @token: token returned when the request was submitted
+ * @err: 0 on success or a negative error code
+ */
+typedef void (*mlxdevm_cb_t)(struct mlxdevm *dl, int token, int err,
+			     void *priv);
+
+/**
+ * mlxdevm_get_fd - Get the file descriptor of the non-blocking requests
+ *
+ * Non-blocking requests use their own netlink socket, so they don't
+ * interfere with the blocking API used on the same handle. The descriptor
+ * becomes readable when replies are available; it can be added to an
+ * epoll or poll set, in which case mlxdevm_process() must be called when
+ * it is readable.
+ * Return: file descriptor or a negative error code.
+ */
+int mlxdevm_get_fd(struct mlxdevm *dl);
+
+/**
+ * mlxdevm_process - Receive available replies without blocking and run
+ * the completion callback of every request which completed.
+ * When receiving fails, for instance with -ENOBUFS after replies were
+ * dropped, every request in flight completes with that error, which is
+ * also returned. Requests still in flight when the handle is closed
+ * complete with -ECANCELED.
+ * Return: number of completed requests or a negative error code.
+ */
+int mlxdevm_process(struct mlxdevm *dl);
+
+/*
+ * mlxdevm_submit_* - Non-blocking variants of the port API
+ *
+ * The request is sent right away and @cb is invoked from mlxdevm_process()
+ * once it completes. Port fields are updated before @cb is invoked, only
+ * when the request succeeded. A set skipped in cached mode sends nothing
+ * and invokes @cb with 0 before returning its token. @port must remain valid until then; for
+ * mlxdevm_submit_sf_port_add() it is caller owned storage which is filled
+ * on completion and mlxdevm_submit_sf_port_del() does not free it.
+ * Return: request token (>= 0) or a negative error code; -EBUSY when too
+ * many requests are in flight, in which case mlxdevm_process() must run
+ * before submitting more.
+ */
+int mlxdevm_submit_sf_port_add(struct mlxdevm *dl, struct mlxdevm_port *port,
+			       uint32_t pfnum, uint32_t sfnum,
+			       mlxdevm_cb_t cb, void *priv);
+int mlxdevm_submit_sf_port_del(struct mlxdevm *dl, struct mlxdevm_port *port,
+			       mlxdevm_cb_t cb, void *priv);
+int mlxdevm_submit_port_fn_state_get(struct mlxdevm *dl,
+				     struct mlxdevm_port *port,
+				     mlxdevm_cb_t cb, void *priv);
+int mlxdevm_submit_port_fn_macaddr_set(struct mlxdevm *dl,
+				       struct mlxdevm_port *port,
+				       const uint8_t *addr,
+				       mlxdevm_cb_t cb, void *priv);
+int mlxdevm_submit_port_fn_state_set(struct mlxdevm *dl,
+				     struct mlxdevm_port *port, uint8_t state,
+				     mlxdevm_cb_t cb, void *priv);
+int mlxdevm_submit_port_fn_cap_set(struct mlxdevm *dl,
+				   struct mlxdevm_port *port,
+				   const struct mlxdevm_port_fn_ext_cap *cap,
+				   mlxdevm_cb_t cb, void *priv);
+
+/**
+ * mlxdevm_batch - Pipelined command submission on a mlxdevm handle.
+ *
+ * Commands queued on a batch are sent back-to-back without waiting for
+ * each other's reply. Replies are matched to commands by sequence number
+ * when the batch is flushed, either explicitly or implicitly when it is
+ * full. Each queued command reports its result through the caller
+ * provided @err pointer, which is written when the command completes.
+ * Port fields are updated only for commands which succeeded.
+ * A batch must not be shared between threads; the regular API may be used
+ * on the same handle in between, but not while a batch is being flushed.
+ */
+struct mlxdevm_batch;
+
+/**
+ * mlxdevm_batch_create - Create a batch on the handle with up to @depth
+ * commands in flight, or the default depth when @depth is 0.
+ * Return: valid batch on success or NULL on error.
+ */
+struct mlxdevm_batch *mlxdevm_batch_create(struct mlxdevm *dl,
+					   unsigned int depth);
+
+/**
+ * mlxdevm_batch_destroy - Flush outstanding commands and free the batch.
+ */
+void mlxdevm_batch_destroy(struct mlxdevm_batch *b);
+
+/**
+ * mlxdevm_batch_flush - Send all queued commands and wait for all of them
+ * to complete.
+ * Return: 0 or a negative error code when the socket failed. Per command
+ * errors are reported through their @err pointers.
+ */
+int mlxdevm_batch_flush(struct mlxdevm_batch *b);
+
+/**
+ * mlxdevm_batch_sf_port_add - Queue addition of a SF port. @port is caller
+ * owned storage which is filled when the command completes successfully.
+ * Return: 0 or a negative socket error code from an implicit flush.
+ */
+int mlxdevm_batch_sf_port_add(struct mlxdevm_batch *b,
+			      struct mlxdevm_port *port,
+			      uint32_t pfnum, uint32_t sfnum, int *err);
+
+/**
+ * mlxdevm_batch_sf_port_del - Queue deletion of a SF port. @port is not
+ * freed.
+ * Return: 0 or a negative socket error code from an implicit flush.
+ */
+int mlxdevm_batch_sf_port_del(struct mlxdevm_batch *b,
+			      struct mlxdevm_port *port, int *err);
+
+/**
+ * mlxdevm_batch_port_fn_macaddr_set - Queue a port function mac address set.
+ * Return: 0 or a negative socket error code from an implicit flush.
+ */
+int mlxdevm_batch_port_fn_macaddr_set(struct mlxdevm_batch *b,
+				      struct mlxdevm_port *port,
+				      const uint8_t *addr, int *err);
+
+/**
+ * mlxdevm_batch_port_fn_state_set - Queue a port function state set.
+ * Return: 0 or a negative socket error code from an implicit flush.
+ */
+int mlxdevm_batch_port_fn_state_set(struct mlxdevm_batch *b,
+				    struct mlxdevm_port *port,
+				    uint8_t state, int *err);
+
+/**
+ * mlxdevm_batch_port_fn_cap_set - Queue a port function capabilities set.
+ * When port doesn't have capability exposed, @err is set to -EOPNOTSUPP
+ * right away.
+ * Return: 0 or a negative socket error code from an implicit flush.
+ */
+int mlxdevm_batch_port_fn_cap_set(struct mlxdevm_batch *b,
+				  struct mlxdevm_port *port,
+				  const struct mlxdevm_port_fn_ext_cap *cap,
+				  int *err);
+
+/**
+ * mlxdevm_sf_stage - Stages of the SF provisioning pipeline
+ * @MLXDEVM_SF_STAGE_PORT: add the port, set its function and activate it
+ * @MLXDEVM_SF_STAGE_AUX_DEV: wait for the auxiliary device of the SF to be
+ * bound to a driver
+ * @MLXDEVM_SF_STAGE_PARAMS: set the parameters of the auxiliary device
+ * @MLXDEVM_SF_STAGE_BIND: move the auxiliary device to the SF driver and
+ * optionally wait for the port function to be attached
+ */
+enum mlxdevm_sf_stage {
+	MLXDEVM_SF_STAGE_PORT,
+	MLXDEVM_SF_STAGE_AUX_DEV,
+	MLXDEVM_SF_STAGE_PARAMS,
+	MLXDEVM_SF_STAGE_BIND,
+	MLXDEVM_SF_STAGE_MAX,
+};
+
+/**
+ * mlxdevm_sf_step - Steps of the stages, timed separately
+ * @MLXDEVM_SF_STEP_PORT_ADD: add the port
+ * @MLXDEVM_SF_STEP_PORT_CAP: set the capabilities of the port function
+ * @MLXDEVM_SF_STEP_PORT_ACTIVATE: set the MAC address and activate it
+ * @MLXDEVM_SF_STEP_AUX_DEV: MLXDEVM_SF_STAGE_AUX_DEV
+ * @MLXDEVM_SF_STEP_PARAMS: MLXDEVM_SF_STAGE_PARAMS
+ * @MLXDEVM_SF_STEP_DRV_BIND: move the auxiliary device to the SF driver
+ * @MLXDEVM_SF_STEP_PORT_ATTACHED: wait for the port function to be attached
+ */
+enum mlxdevm_sf_step {
+	MLXDEVM_SF_STEP_PORT_ADD,
+	MLXDEVM_SF_STEP_PORT_CAP,
+	MLXDEVM_SF_STEP_PORT_ACTIVATE,
+	MLXDEVM_SF_STEP_AUX_DEV,
+	MLXDEVM_SF_STEP_PARAMS,
+	MLXDEVM_SF_STEP_DRV_BIND,
+	MLXDEVM_SF_STEP_PORT_ATTACHED,
+	MLXDEVM_SF_STEP_MAX,
+};
+
+/**
+ * mlxdevm_sf_spec - SF to provision
+ * @fn: port function configuration; the state is ignored as the function
+ * is always activated and capabilities the port doesn't expose are skipped
+ * @params: parameters set on the auxiliary device of the SF
+ */
+struct mlxdevm_sf_spec {
+	uint32_t pfnum;
+	uint32_t sfnum;
+	struct mlxdevm_port_fn_config fn;
+	const struct mlxdevm_param_profile *params;
+	unsigned int nparams;
+};
+
+#define MLXDEVM_SF_AUX_DEV_LEN 64
+
+/**
+ * mlxdevm_sf_result - Outcome of the provisioning of one SF
+ * @port: port of the SF on success, owned by the caller which deletes it
+ * with mlxdevm_sf_port_del(); NULL on failure, in which case the port is
+ * deleted if it was added
+ * @aux_dev: name of the auxiliary device of the SF, once known
+ * @err: 0 or the negative error code of the failed stage
+ * @stage: failed stage, or MLXDEVM_SF_STAGE_MAX on success
+ * @stage_ns: time spent in each of the stages which ran, from the time the
+ * stage took the SF off its queue
+ * @step_ns: time spent in each of the steps which ran, 0 for the others
+ */
+struct mlxdevm_sf_result {
+	const struct mlxdevm_sf_spec *spec;
+	struct mlxdevm_port *port;
+	char aux_dev[MLXDEVM_SF_AUX_DEV_LEN];
+	int err;
+	enum mlxdevm_sf_stage stage;
+	uint64_t stage_ns[MLXDEVM_SF_STAGE_MAX];
+	uint64_t step_ns[MLXDEVM_SF_STEP_MAX];
+};
+
+/**
+ * mlxdevm_sf_stage_stats - Latency of a stage over all the SFs it handled
+ */
+struct mlxdevm_sf_stage_stats {
+	unsigned int count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+};
+
+/**
+ * mlxdevm_sf_provision_opts - Options of mlxdevm_sf_provision
+ * @workers: threads of each stage, 1 when 0; a single thread waits for all
+ * the auxiliary devices, so the MLXDEVM_SF_STAGE_AUX_DEV entry is ignored
+ * @aux_dev_timeout_ms: time an activated SF may take to get a bound
+ * auxiliary device, 10 seconds when 0
+ * @cfg_driver: driver the auxiliary devices are first bound to,
+ * "mlx5_core.sf_cfg" when NULL
+ * @driver: driver the auxiliary devices are moved to, "mlx5_core.sf" when
+ * NULL
+ * @wait_attached: wait for the port functions to become attached
+ * @stats: when not NULL, MLXDEVM_SF_STAGE_MAX entries filled with the
+ * latency of each stage
+ */
+struct mlxdevm_sf_provision_opts {
+	unsigned int workers[MLXDEVM_SF_STAGE_MAX];
+	unsigned int aux_dev_timeout_ms;
+	const char *cfg_driver;
+	const char *driver;
+	bool wait_attached;
+	struct mlxdevm_sf_stage_stats *stats;
+};
+
+/**
+ * mlxdevm_sf_provision_cbs - Callbacks of mlxdevm_sf_provision
+ * @done: called once per SF when it is provisioned or failed; calls are
+ * serialized but made from the pipeline threads. @res is valid during the
+ * call only.
+ */
+struct mlxdevm_sf_provision_cbs {
+	void (*done)(const struct mlxdevm_sf_result *res, void *priv);
+	void *priv;
+};
+
+/**
+ * mlxdevm_sf_provision - Bring up SFs of the device of the handle
+ *
+ * Each of the @n SFs of @specs goes through the stages of
+ * enum mlxdevm_sf_stage in order. Stages run concurrently, each with its
+ * own threads and netlink sockets, so while some SFs are being added
+ * others wait for their auxiliary device or are bound to their driver.
+ * @dl is only used to create the sockets of the stages; it may be used by
+ * the caller meanwhile. @opts may be NULL for the defaults.
+ * Return: number of SFs provisioned or a negative error code when the
+ * pipeline could not be started.
+ */
+int mlxdevm_sf_provision(struct mlxdevm *dl,
+			 const struct mlxdevm_sf_spec *specs, unsigned int n,
+			 const struct mlxdevm_sf_provision_opts *opts,
+			 const struct mlxdevm_sf_provision_cbs *cbs);
+
+/**
+ * mlxdevm_aux_watch - Watcher of auxiliary device events
+ *
+ * Kernel uevents are read directly from a NETLINK_KOBJECT_UEVENT socket,
+ * so events don't wait for udevd to relay them. They are parsed in place
+ * without allocation; the SF number of a device is read from sysfs the
+ * first time the device is seen and cached until the device is removed.
+ */
+struct mlxdevm_aux_watch;
+
+enum mlxdevm_aux_action {
+	MLXDEVM_AUX_ADD,
+	MLXDEVM_AUX_REMOVE,
+	MLXDEVM_AUX_BIND,
+	MLXDEVM_AUX_UNBIND,
+	MLXDEVM_AUX_OTHER,
+};
+
+/**
+ * mlxdevm_aux_event - Event of an auxiliary device
+ * @dev: name of the auxiliary device, such as mlx5_core.sf.2
+ * @parent: name of its parent device, such as 0000:03:00.0
+ * @driver: driver of a bind event, NULL otherwise
+ * @sfnum: SF number of the device, when @sfnum_valid is set
+ *
+ * Strings point into the watcher buffer and are valid until the next
+ * mlxdevm_aux_watch_recv() call.
+ */
+struct mlxdevm_aux_event {
+	enum mlxdevm_aux_action action;
+	const char *dev;
+	const char *parent;
+	const char *driver;
+	uint32_t sfnum;
+	bool sfnum_valid;
+};
+
+/**
+ * mlxdevm_aux_watch_open - Start watching auxiliary device events
+ * Return: watcher or NULL on error.
+ */
+struct mlxdevm_aux_watch *mlxdevm_aux_watch_open(void);
+
+void mlxdevm_aux_watch_close(struct mlxdevm_aux_watch *w);
+
+/**
+ * mlxdevm_aux_watch_get_fd - File descriptor which becomes readable when
+ * events are available
+ */
+int mlxdevm_aux_watch_get_fd(const struct mlxdevm_aux_watch *w);
+
+/**
+ * mlxdevm_aux_watch_recv - Get the next auxiliary device event without
+ * blocking
+ * Return: 1 when @ev is filled, 0 when no event is available or a
+ * negative error code; -ENOBUFS means that events were lost and the
+ * state of the devices of interest must be read from sysfs again.
+ */
+int mlxdevm_aux_watch_recv(struct mlxdevm_aux_watch *w,
+			   struct mlxdevm_aux_event *ev);
+
+/**
+ * mlxdevm_sf_driver_rebind - Move SF auxiliary devices to the SF driver
+ *
+ * Each of the @n auxiliary devices of @names is unbound from the
+ * mlx5_core.sf_cfg driver, when bound to it, and bound to the mlx5_core.sf
+ * driver. The driver files are opened by the first call and stay open
+ * until the handle is closed; the unbinds of all the devices are written
+ * back-to-back, then their binds. Entry i of @errs is set to 0 or to the
+ * negative error code of device i.
+ * Return: number of devices bound to the SF driver or a negative error
+ * code when the driver files can't be opened.
+ */
+int mlxdevm_sf_driver_rebind(struct mlxdevm *dl, const char * const *names,
+			     unsigned int n, int *errs);
+
+/**
+ * mlxdevm_aux_waiter - Wait for the auxiliary devices of SFs to be bound
+ *
+ * Waiters are registered per SF number and their callbacks run from
+ * mlxdevm_aux_waiter_dispatch(), which sleeps on an epoll set until a
+ * uevent arrives, a deadline expires or mlxdevm_aux_waiter_wake() is
+ * called. A device bound before its waiter is added is remembered, so
+ * the waiter completes right away; the waiter should be created before
+ * the SFs are activated. Up to 4096 such devices are remembered, after
+ * which new waiters also look for their device in sysfs. When uevents are
+ * lost, the bound devices are read from sysfs again; when they can't be
+ * received, sysfs is polled every millisecond while waiters are
+ * registered.
+ * A waiter is used by one thread at a time, except for
+ * mlxdevm_aux_waiter_wake().
+ */
+struct mlxdevm_aux_waiter;
+
+/**
+ * mlxdevm_aux_wait_cb_t - Completion of the wait for a SF
+ * @dev: name of the bound auxiliary device
+ * @err: 0 or -ETIMEDOUT when the deadline expired first
+ */
+typedef void (*mlxdevm_aux_wait_cb_t)(uint32_t sfnum, const char *dev,
+				      int err, void *priv);
+
+/**
+ * mlxdevm_aux_waiter_create - Create a waiter for SFs of device @parent,
+ * such as 0000:03:00.0
+ * Return: waiter or NULL on error.
+ */
+struct mlxdevm_aux_waiter *mlxdevm_aux_waiter_create(const char *parent);
+
+void mlxdevm_aux_waiter_destroy(struct mlxdevm_aux_waiter *wt);
+
+/**
+ * mlxdevm_aux_waiter_get_fd - Epoll file descriptor of the waiter, which
+ * can be added to the caller's event loop
+ */
+int mlxdevm_aux_waiter_get_fd(const struct mlxdevm_aux_waiter *wt);
+
+/**
+ * mlxdevm_aux_waiter_add - Wait for the auxiliary device of SF @sfnum
+ * @deadline: absolute CLOCK_MONOTONIC time, or NULL to wait forever
+ * Return: 0, -EEXIST when the SF already has a waiter or another negative
+ * error code.
+ */
+int mlxdevm_aux_waiter_add(struct mlxdevm_aux_waiter *wt, uint32_t sfnum,
+			   const struct timespec *deadline,
+			   mlxdevm_aux_wait_cb_t cb, void *priv);
+
+/**
+ * mlxdevm_aux_waiter_wake - Make a blocked mlxdevm_aux_waiter_dispatch()
+ * return; may be called from any thread
+ */
+void mlxdevm_aux_waiter_wake(struct mlxdevm_aux_waiter *wt);
+
+/**
+ * mlxdevm_aux_waiter_dispatch - Wait up to @timeout_ms, -1 for no limit,
+ * for events and run the callbacks of the completed waiters
+ * Return: number of callbacks run or a negative error code.
+ */
+int mlxdevm_aux_waiter_dispatch(struct mlxdevm_aux_waiter *wt, int timeout_ms);
+
 #endif
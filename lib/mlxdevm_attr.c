@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <linux/genetlink.h>
+
+#include "mlxdevm_netlink.h"
+#include "mlxdevm_attr.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+/* Attribute type to compact index, for types below MLXDEVM_ATTR_EXT_START */
+static const uint8_t mlxdevm_attr_idx[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER + 1] = {
+	[MLXDEVM_ATTR_DEV_BUS_NAME] = MLXDEVM_ATTR_IDX_DEV_BUS_NAME,
+	[MLXDEVM_ATTR_DEV_NAME] = MLXDEVM_ATTR_IDX_DEV_NAME,
+	[MLXDEVM_ATTR_PORT_INDEX] = MLXDEVM_ATTR_IDX_PORT_INDEX,
+	[MLXDEVM_ATTR_PORT_TYPE] = MLXDEVM_ATTR_IDX_PORT_TYPE,
+	[MLXDEVM_ATTR_PORT_NETDEV_IFINDEX] = MLXDEVM_ATTR_IDX_PORT_NETDEV_IFINDEX,
+	[MLXDEVM_ATTR_PORT_NETDEV_NAME] = MLXDEVM_ATTR_IDX_PORT_NETDEV_NAME,
+	[MLXDEVM_ATTR_PORT_IBDEV_NAME] = MLXDEVM_ATTR_IDX_PORT_IBDEV_NAME,
+	[MLXDEVM_ATTR_PORT_FLAVOUR] = MLXDEVM_ATTR_IDX_PORT_FLAVOUR,
+	[MLXDEVM_ATTR_PORT_NUMBER] = MLXDEVM_ATTR_IDX_PORT_NUMBER,
+	[MLXDEVM_ATTR_PORT_FUNCTION] = MLXDEVM_ATTR_IDX_PORT_FUNCTION,
+	[MLXDEVM_ATTR_PORT_EXTERNAL] = MLXDEVM_ATTR_IDX_PORT_EXTERNAL,
+	[MLXDEVM_ATTR_PORT_CONTROLLER_NUMBER] = MLXDEVM_ATTR_IDX_PORT_CONTROLLER_NUMBER,
+	[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER] = MLXDEVM_ATTR_IDX_PORT_PCI_PF_NUMBER,
+	[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER] = MLXDEVM_ATTR_IDX_PORT_PCI_SF_NUMBER,
+	[MLXDEVM_ATTR_PARAM] = MLXDEVM_ATTR_IDX_PARAM,
+	[MLXDEVM_ATTR_PARAM_NAME] = MLXDEVM_ATTR_IDX_PARAM_NAME,
+	[MLXDEVM_ATTR_PARAM_GENERIC] = MLXDEVM_ATTR_IDX_PARAM_GENERIC,
+	[MLXDEVM_ATTR_PARAM_TYPE] = MLXDEVM_ATTR_IDX_PARAM_TYPE,
+	[MLXDEVM_ATTR_PARAM_VALUES_LIST] = MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST,
+	[MLXDEVM_ATTR_PARAM_VALUE] = MLXDEVM_ATTR_IDX_PARAM_VALUE,
+	[MLXDEVM_ATTR_PARAM_VALUE_DATA] = MLXDEVM_ATTR_IDX_PARAM_VALUE_DATA,
+	[MLXDEVM_ATTR_PARAM_VALUE_CMODE] = MLXDEVM_ATTR_IDX_PARAM_VALUE_CMODE,
+};
+
+/* Attribute type to compact index, for devm specific types */
+static const uint8_t
+mlxdevm_ext_attr_idx[MLXDEVM_ATTR_MAX - MLXDEVM_ATTR_EXT_START + 1] = {
+	[MLXDEVM_ATTR_EXT_PORT_FN_CAP - MLXDEVM_ATTR_EXT_START] =
+		MLXDEVM_ATTR_IDX_EXT_PORT_FN_CAP,
+};
+
+static const enum mnl_attr_data_type mlxdevm_policy[MLXDEVM_ATTR_IDX_MAX + 1] = {
+	[MLXDEVM_ATTR_IDX_DEV_BUS_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_IDX_DEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_IDX_PORT_INDEX] = MNL_TYPE_U32,
+	[MLXDEVM_ATTR_IDX_PORT_TYPE] = MNL_TYPE_U16,
+	[MLXDEVM_ATTR_IDX_PORT_NETDEV_IFINDEX] = MNL_TYPE_U32,
+	[MLXDEVM_ATTR_IDX_PORT_NETDEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_IDX_PORT_IBDEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_IDX_PARAM_NAME] = MNL_TYPE_STRING,
+	[MLXDEVM_ATTR_IDX_PARAM_TYPE] = MNL_TYPE_U8,
+	[MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST] = MNL_TYPE_NESTED,
+	[MLXDEVM_ATTR_IDX_PARAM_VALUE] = MNL_TYPE_NESTED,
+	[MLXDEVM_ATTR_IDX_PARAM_VALUE_CMODE] = MNL_TYPE_U8,
+};
+
+static unsigned int attr_idx(uint16_t type)
+{
+	if (type < ARRAY_SIZE(mlxdevm_attr_idx))
+		return mlxdevm_attr_idx[type];
+	if (type > MLXDEVM_ATTR_EXT_START && type <= MLXDEVM_ATTR_MAX)
+		return mlxdevm_ext_attr_idx[type - MLXDEVM_ATTR_EXT_START];
+	return MLXDEVM_ATTR_IDX_UNSPEC;
+}
+
+static int attr_parse_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	unsigned int idx;
+
+	idx = attr_idx(mnl_attr_get_type(attr));
+	if (idx == MLXDEVM_ATTR_IDX_UNSPEC)
+		return MNL_CB_OK;
+
+	if (mnl_attr_validate(attr, mlxdevm_policy[idx]) < 0)
+		return MNL_CB_ERROR;
+
+	tb[idx] = attr;
+	return MNL_CB_OK;
+}
+
+int mlxdevm_attr_parse(const struct nlmsghdr *nlh, struct nlattr **tb)
+{
+	return mnl_attr_parse(nlh, sizeof(struct genlmsghdr), attr_parse_cb, tb);
+}
+
+int mlxdevm_attr_parse_nested(const struct nlattr *nest, struct nlattr **tb)
+{
+	return mnl_attr_parse_nested(nest, attr_parse_cb, tb);
+}
+
+static const uint8_t
+mlxdevm_fn_attr_idx[MLXDEVM_PORT_FUNCTION_ATTR_EXT_START] = {
+	[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR] = MLXDEVM_FN_ATTR_IDX_HW_ADDR,
+	[MLXDEVM_PORT_FN_ATTR_STATE] = MLXDEVM_FN_ATTR_IDX_STATE,
+	[MLXDEVM_PORT_FN_ATTR_OPSTATE] = MLXDEVM_FN_ATTR_IDX_OPSTATE,
+};
+
+static const uint8_t
+mlxdevm_fn_ext_attr_idx[MLXDEVM_PORT_FUNCTION_ATTR_MAX -
+			MLXDEVM_PORT_FUNCTION_ATTR_EXT_START + 1] = {
+	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE - MLXDEVM_PORT_FUNCTION_ATTR_EXT_START] =
+		MLXDEVM_FN_ATTR_IDX_EXT_CAP_ROCE,
+	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST - MLXDEVM_PORT_FUNCTION_ATTR_EXT_START] =
+		MLXDEVM_FN_ATTR_IDX_EXT_CAP_UC_LIST,
+};
+
+static const enum mnl_attr_data_type
+mlxdevm_function_policy[MLXDEVM_FN_ATTR_IDX_MAX + 1] = {
+	[MLXDEVM_FN_ATTR_IDX_HW_ADDR] = MNL_TYPE_BINARY,
+	[MLXDEVM_FN_ATTR_IDX_STATE] = MNL_TYPE_U8,
+	[MLXDEVM_FN_ATTR_IDX_OPSTATE] = MNL_TYPE_U8,
+	[MLXDEVM_FN_ATTR_IDX_EXT_CAP_ROCE] = MNL_TYPE_U8,
+	[MLXDEVM_FN_ATTR_IDX_EXT_CAP_UC_LIST] = MNL_TYPE_U32,
+};
+
+static unsigned int fn_attr_idx(uint16_t type)
+{
+	if (type < ARRAY_SIZE(mlxdevm_fn_attr_idx))
+		return mlxdevm_fn_attr_idx[type];
+	if (type > MLXDEVM_PORT_FUNCTION_ATTR_EXT_START &&
+	    type <= MLXDEVM_PORT_FUNCTION_ATTR_MAX)
+		return mlxdevm_fn_ext_attr_idx[type -
+					       MLXDEVM_PORT_FUNCTION_ATTR_EXT_START];
+	return MLXDEVM_FN_ATTR_IDX_UNSPEC;
+}
+
+static int function_attr_parse_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	unsigned int idx;
+
+	idx = fn_attr_idx(mnl_attr_get_type(attr));
+	if (idx == MLXDEVM_FN_ATTR_IDX_UNSPEC)
+		return MNL_CB_OK;
+
+	if (mnl_attr_validate(attr, mlxdevm_function_policy[idx]) < 0)
+		return MNL_CB_ERROR;
+
+	tb[idx] = attr;
+	return MNL_CB_OK;
+}
+
+int mlxdevm_fn_attr_parse_nested(const struct nlattr *nest, struct nlattr **tb)
+{
+	return mnl_attr_parse_nested(nest, function_attr_parse_cb, tb);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#ifndef _MLXDEVM_ATTR_H_
+#define _MLXDEVM_ATTR_H_
+
+#include <libmnl/libmnl.h>
+
+/*
+ * Dense index of the mlxdevm attributes used by the library. Attribute
+ * types are sparse (devm specific ones start at MLXDEVM_ATTR_EXT_START), so
+ * parsing into a table indexed by attribute type would need one pointer
+ * per possible type. Parsed attributes are stored at their compact index
+ * instead.
+ */
+enum mlxdevm_attr_idx {
+	MLXDEVM_ATTR_IDX_UNSPEC,
+
+	MLXDEVM_ATTR_IDX_DEV_BUS_NAME,
+	MLXDEVM_ATTR_IDX_DEV_NAME,
+	MLXDEVM_ATTR_IDX_PORT_INDEX,
+	MLXDEVM_ATTR_IDX_PORT_TYPE,
+	MLXDEVM_ATTR_IDX_PORT_NETDEV_IFINDEX,
+	MLXDEVM_ATTR_IDX_PORT_NETDEV_NAME,
+	MLXDEVM_ATTR_IDX_PORT_IBDEV_NAME,
+	MLXDEVM_ATTR_IDX_PORT_FLAVOUR,
+	MLXDEVM_ATTR_IDX_PORT_NUMBER,
+	MLXDEVM_ATTR_IDX_PORT_FUNCTION,
+	MLXDEVM_ATTR_IDX_PORT_EXTERNAL,
+	MLXDEVM_ATTR_IDX_PORT_CONTROLLER_NUMBER,
+	MLXDEVM_ATTR_IDX_PORT_PCI_PF_NUMBER,
+	MLXDEVM_ATTR_IDX_PORT_PCI_SF_NUMBER,
+
+	MLXDEVM_ATTR_IDX_PARAM,
+	MLXDEVM_ATTR_IDX_PARAM_NAME,
+	MLXDEVM_ATTR_IDX_PARAM_GENERIC,
+	MLXDEVM_ATTR_IDX_PARAM_TYPE,
+	MLXDEVM_ATTR_IDX_PARAM_VALUES_LIST,
+	MLXDEVM_ATTR_IDX_PARAM_VALUE,
+	MLXDEVM_ATTR_IDX_PARAM_VALUE_DATA,
+	MLXDEVM_ATTR_IDX_PARAM_VALUE_CMODE,
+
+	MLXDEVM_ATTR_IDX_EXT_PORT_FN_CAP,
+
+	__MLXDEVM_ATTR_IDX_MAX,
+	MLXDEVM_ATTR_IDX_MAX = __MLXDEVM_ATTR_IDX_MAX - 1
+};
+
+/* Dense index of the port function attributes nested in PORT_FUNCTION */
+enum mlxdevm_fn_attr_idx {
+	MLXDEVM_FN_ATTR_IDX_UNSPEC,
+
+	MLXDEVM_FN_ATTR_IDX_HW_ADDR,
+	MLXDEVM_FN_ATTR_IDX_STATE,
+	MLXDEVM_FN_ATTR_IDX_OPSTATE,
+	MLXDEVM_FN_ATTR_IDX_EXT_CAP_ROCE,
+	MLXDEVM_FN_ATTR_IDX_EXT_CAP_UC_LIST,
+
+	__MLXDEVM_FN_ATTR_IDX_MAX,
+	MLXDEVM_FN_ATTR_IDX_MAX = __MLXDEVM_FN_ATTR_IDX_MAX - 1
+};
+
+/**
+ * mlxdevm_attr_parse - Parse the attributes of a mlxdevm genl message into
+ * @tb indexed by enum mlxdevm_attr_idx. @tb must have
+ * MLXDEVM_ATTR_IDX_MAX + 1 zeroed entries. Unknown attributes are skipped.
+ */
+int mlxdevm_attr_parse(const struct nlmsghdr *nlh, struct nlattr **tb);
+
+/**
+ * mlxdevm_attr_parse_nested - Same as mlxdevm_attr_parse() for the
+ * attributes nested in @nest.
+ */
+int mlxdevm_attr_parse_nested(const struct nlattr *nest, struct nlattr **tb);
+
+/**
+ * mlxdevm_fn_attr_parse_nested - Parse port function attributes nested in
+ * @nest into @tb indexed by enum mlxdevm_fn_attr_idx. @tb must have
+ * MLXDEVM_FN_ATTR_IDX_MAX + 1 zeroed entries.
+ */
+int mlxdevm_fn_attr_parse_nested(const struct nlattr *nest, struct nlattr **tb);
+
+#endif
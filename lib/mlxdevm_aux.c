@@ -0,0 +1,871 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+
+#include "mlxdevm.h"
+#include "mlxdevm_priv.h"
+#include "mlxdevm_trace.h"
+
+#define AUX_DEVICES_PATH	"/sys/bus/auxiliary/devices"
+#define AUX_DRIVERS_PATH	"/sys/bus/auxiliary/drivers"
+/* Kernel uevents are at most UEVENT_BUFFER_SIZE (2048) bytes */
+#define AUX_UEVENT_BUF_SIZE	4096
+#define AUX_UEVENT_RCVBUF	(8 * 1024 * 1024)
+#define AUX_SFNUM_CACHE_BITS	8
+#define AUX_WAITER_MIN_BITS	6
+/* sysfs poll interval when uevents can't be received */
+#define AUX_WAITER_POLL_NS	1000000
+/* Devices bound before anyone waited for them, oldest dropped first */
+#define AUX_WAITER_UNCLAIMED_MAX	4096
+
+/* sfnum attribute of a device, read from sysfs once per device name */
+struct aux_sfnum_ent {
+	char dev[MLXDEVM_SF_AUX_DEV_LEN];
+	uint32_t sfnum;
+	bool sfnum_valid;
+};
+
+struct mlxdevm_aux_watch {
+	int fd;
+	char buf[AUX_UEVENT_BUF_SIZE + 1];
+	struct aux_sfnum_ent cache[1 << AUX_SFNUM_CACHE_BITS];
+};
+
+struct mlxdevm_aux_watch *mlxdevm_aux_watch_open(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,
+	};
+	struct mlxdevm_aux_watch *w;
+	int size = AUX_UEVENT_RCVBUF;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		       NETLINK_KOBJECT_UEVENT);
+	if (w->fd < 0)
+		goto sock_err;
+
+	/* Event storms are what the watcher is for, so ask for a buffer
+	 * larger than the default, beyond rmem_max when permitted.
+	 */
+	if (setsockopt(w->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+		setsockopt(w->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (bind(w->fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto bind_err;
+	return w;
+
+bind_err:
+	close(w->fd);
+sock_err:
+	free(w);
+	return NULL;
+}
+
+void mlxdevm_aux_watch_close(struct mlxdevm_aux_watch *w)
+{
+	close(w->fd);
+	free(w);
+}
+
+int mlxdevm_aux_watch_get_fd(const struct mlxdevm_aux_watch *w)
+{
+	return w->fd;
+}
+
+static struct aux_sfnum_ent *aux_sfnum_slot(struct mlxdevm_aux_watch *w,
+					    const char *dev)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *dev; dev++)
+		hash = (hash ^ (uint8_t)*dev) * 16777619u;
+	return &w->cache[hash >> (32 - AUX_SFNUM_CACHE_BITS)];
+}
+
+static int aux_sfnum_read(const char *dev, uint32_t *sfnum)
+{
+	char path[PATH_MAX];
+	char buf[16];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), AUX_DEVICES_PATH "/%s/sfnum", dev);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -EINVAL;
+	buf[len] = '\0';
+	*sfnum = strtoul(buf, NULL, 10);
+	return 0;
+}
+
+static void aux_sfnum_lookup(struct mlxdevm_aux_watch *w,
+			     struct mlxdevm_aux_event *ev)
+{
+	struct aux_sfnum_ent *ent = aux_sfnum_slot(w, ev->dev);
+
+	if (strcmp(ent->dev, ev->dev)) {
+		/* Nothing to read once the device is gone */
+		if (ev->action == MLXDEVM_AUX_REMOVE)
+			return;
+		if (strlen(ev->dev) >= sizeof(ent->dev))
+			return;
+		strcpy(ent->dev, ev->dev);
+		ent->sfnum_valid = !aux_sfnum_read(ev->dev, &ent->sfnum);
+	}
+
+	ev->sfnum = ent->sfnum;
+	ev->sfnum_valid = ent->sfnum_valid;
+	/* Device names are reused by new devices once removed */
+	if (ev->action == MLXDEVM_AUX_REMOVE)
+		ent->dev[0] = '\0';
+}
+
+static enum mlxdevm_aux_action aux_action_parse(const char *action)
+{
+	if (!strcmp(action, "bind"))
+		return MLXDEVM_AUX_BIND;
+	if (!strcmp(action, "add"))
+		return MLXDEVM_AUX_ADD;
+	if (!strcmp(action, "unbind"))
+		return MLXDEVM_AUX_UNBIND;
+	if (!strcmp(action, "remove"))
+		return MLXDEVM_AUX_REMOVE;
+	return MLXDEVM_AUX_OTHER;
+}
+
+/* Parse the uevent of @len bytes in place.
+ * Return: true for an event of an auxiliary device.
+ */
+static bool aux_uevent_parse(char *buf, size_t len,
+			     struct mlxdevm_aux_event *ev)
+{
+	const char *subsystem = NULL;
+	char *end = buf + len;
+	char *devpath;
+	char *key;
+	char *sep;
+
+	/* action@devpath, then KEY=value strings */
+	devpath = strchr(buf, '@');
+	if (!devpath || devpath >= end)
+		return false;
+	*devpath++ = '\0';
+
+	ev->driver = NULL;
+	for (key = devpath + strlen(devpath) + 1; key < end;
+	     key += strlen(key) + 1) {
+		if (!strncmp(key, "SUBSYSTEM=", 10))
+			subsystem = key + 10;
+		else if (!strncmp(key, "DRIVER=", 7))
+			ev->driver = key + 7;
+	}
+	if (!subsystem || strcmp(subsystem, "auxiliary"))
+		return false;
+
+	/* .../<parent>/<dev> */
+	sep = strrchr(devpath, '/');
+	if (!sep)
+		return false;
+	ev->dev = sep + 1;
+	*sep = '\0';
+	sep = strrchr(devpath, '/');
+	ev->parent = sep ? sep + 1 : devpath;
+
+	ev->action = aux_action_parse(buf);
+	ev->sfnum_valid = false;
+	return true;
+}
+
+int mlxdevm_aux_watch_recv(struct mlxdevm_aux_watch *w,
+			   struct mlxdevm_aux_event *ev)
+{
+	struct sockaddr_nl addr;
+	struct iovec iov = {
+		.iov_base = w->buf,
+		.iov_len = AUX_UEVENT_BUF_SIZE,
+	};
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	ssize_t len;
+
+	for (;;) {
+		len = recvmsg(w->fd, &msg, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			/* Remove events may be lost with the others, after
+			 * which a reused device name would get the sfnum of
+			 * the device it was given to before.
+			 */
+			if (errno == ENOBUFS)
+				memset(w->cache, 0, sizeof(w->cache));
+			return -errno;
+		}
+		/* Only the kernel sends on the kernel uevent group */
+		if (addr.nl_pid || !len)
+			continue;
+
+		w->buf[len] = '\0';
+		if (!aux_uevent_parse(w->buf, len, ev))
+			continue;
+		aux_sfnum_lookup(w, ev);
+		return 1;
+	}
+}
+
+/* Waiter of a SF, or record of a device bound before anyone waited */
+enum aux_waiter_state {
+	AUX_WAITER_BOUND,
+	AUX_WAITER_WAITING,
+	AUX_WAITER_READY,
+};
+
+struct aux_waiter_ent {
+	struct aux_waiter_ent *hnext;
+	uint32_t sfnum;
+	enum aux_waiter_state state;
+	char dev[MLXDEVM_SF_AUX_DEV_LEN];
+	int err;
+	uint64_t deadline_ns;
+	mlxdevm_aux_wait_cb_t cb;
+	void *priv;
+	/* In the unclaimed list while bound, in the deadline list while
+	 * waiting and in the ready list once ready
+	 */
+	TAILQ_ENTRY(aux_waiter_ent) entry;
+};
+
+TAILQ_HEAD(aux_waiter_list, aux_waiter_ent);
+
+struct mlxdevm_aux_waiter {
+	struct mlxdevm_aux_watch *watch;
+	char *parent;
+	int epfd;
+	int tfd;
+	int efd;
+	uint64_t armed_ns;
+	/* Entries by sfnum */
+	struct aux_waiter_ent **buckets;
+	unsigned int bits;
+	unsigned int count;
+	unsigned int waiting;
+	/* Waiters with a deadline, earliest first */
+	struct aux_waiter_list deadlines;
+	struct aux_waiter_list ready;
+	/* Bound devices without waiter, oldest first */
+	struct aux_waiter_list unclaimed;
+	unsigned int num_unclaimed;
+	/* Unclaimed devices were dropped, waiters look them up in sysfs */
+	bool dropped;
+};
+
+static uint64_t aux_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct aux_waiter_ent **aux_waiter_bucket(struct mlxdevm_aux_waiter *wt,
+						 uint32_t sfnum)
+{
+	return &wt->buckets[(sfnum * 0x9e3779b9u) >> (32 - wt->bits)];
+}
+
+static struct aux_waiter_ent *aux_waiter_find(struct mlxdevm_aux_waiter *wt,
+					      uint32_t sfnum)
+{
+	struct aux_waiter_ent *ent;
+
+	for (ent = *aux_waiter_bucket(wt, sfnum); ent; ent = ent->hnext) {
+		if (ent->sfnum == sfnum)
+			return ent;
+	}
+	return NULL;
+}
+
+static int aux_waiter_grow(struct mlxdevm_aux_waiter *wt)
+{
+	struct aux_waiter_ent **old = wt->buckets;
+	unsigned int size = 1u << wt->bits;
+	struct aux_waiter_ent *ent, **b;
+	unsigned int i;
+
+	wt->buckets = calloc(size * 2, sizeof(*wt->buckets));
+	if (!wt->buckets) {
+		wt->buckets = old;
+		return -ENOMEM;
+	}
+	wt->bits++;
+
+	for (i = 0; i < size; i++) {
+		while ((ent = old[i])) {
+			old[i] = ent->hnext;
+			b = aux_waiter_bucket(wt, ent->sfnum);
+			ent->hnext = *b;
+			*b = ent;
+		}
+	}
+	free(old);
+	return 0;
+}
+
+static struct aux_waiter_ent *aux_waiter_get(struct mlxdevm_aux_waiter *wt,
+					     uint32_t sfnum)
+{
+	struct aux_waiter_ent *ent, **b;
+
+	ent = aux_waiter_find(wt, sfnum);
+	if (ent)
+		return ent;
+
+	if (wt->count >= 1u << wt->bits && aux_waiter_grow(wt))
+		return NULL;
+
+	ent = calloc(1, sizeof(*ent));
+	if (!ent)
+		return NULL;
+	ent->sfnum = sfnum;
+	ent->state = AUX_WAITER_BOUND;
+	b = aux_waiter_bucket(wt, sfnum);
+	ent->hnext = *b;
+	*b = ent;
+	wt->count++;
+	return ent;
+}
+
+static void aux_waiter_put(struct mlxdevm_aux_waiter *wt,
+			   struct aux_waiter_ent *ent)
+{
+	struct aux_waiter_ent **b;
+
+	for (b = aux_waiter_bucket(wt, ent->sfnum); *b != ent; b = &(*b)->hnext)
+		;
+	*b = ent->hnext;
+	wt->count--;
+	free(ent);
+}
+
+/* Arm the timer for the earliest deadline, or for the next sysfs poll */
+static void aux_waiter_timer_arm(struct mlxdevm_aux_waiter *wt)
+{
+	struct itimerspec its = {};
+	struct aux_waiter_ent *ent;
+	uint64_t ns = 0;
+
+	ent = TAILQ_FIRST(&wt->deadlines);
+	if (ent)
+		ns = ent->deadline_ns;
+	if (!wt->watch && wt->waiting) {
+		uint64_t poll_ns = aux_now_ns() + AUX_WAITER_POLL_NS;
+
+		/* Don't push back a poll which is already due soon */
+		if (wt->armed_ns && wt->armed_ns < poll_ns)
+			poll_ns = wt->armed_ns;
+		if (!ns || poll_ns < ns)
+			ns = poll_ns;
+	}
+	if (ns == wt->armed_ns)
+		return;
+
+	its.it_value.tv_sec = ns / 1000000000ull;
+	its.it_value.tv_nsec = ns % 1000000000ull;
+	timerfd_settime(wt->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+	wt->armed_ns = ns;
+}
+
+static void aux_waiter_ready(struct mlxdevm_aux_waiter *wt,
+			     struct aux_waiter_ent *ent, int err)
+{
+	if (ent->deadline_ns)
+		TAILQ_REMOVE(&wt->deadlines, ent, entry);
+	wt->waiting--;
+	ent->state = AUX_WAITER_READY;
+	ent->err = err;
+	TAILQ_INSERT_TAIL(&wt->ready, ent, entry);
+}
+
+static void aux_waiter_unclaimed_del(struct mlxdevm_aux_waiter *wt,
+				     struct aux_waiter_ent *ent)
+{
+	TAILQ_REMOVE(&wt->unclaimed, ent, entry);
+	wt->num_unclaimed--;
+}
+
+static void aux_waiter_bound(struct mlxdevm_aux_waiter *wt, uint32_t sfnum,
+			     const char *dev)
+{
+	struct aux_waiter_ent *ent;
+
+	if (strlen(dev) >= sizeof(ent->dev))
+		return;
+	ent = aux_waiter_get(wt, sfnum);
+	if (!ent || ent->state == AUX_WAITER_READY)
+		return;
+
+	if (ent->state == AUX_WAITER_BOUND && !ent->dev[0]) {
+		TAILQ_INSERT_TAIL(&wt->unclaimed, ent, entry);
+		wt->num_unclaimed++;
+	}
+	strcpy(ent->dev, dev);
+	if (ent->state == AUX_WAITER_WAITING)
+		aux_waiter_ready(wt, ent, 0);
+
+	/* SFs of the parent which nobody waits for must not pile up */
+	while (wt->num_unclaimed > AUX_WAITER_UNCLAIMED_MAX) {
+		ent = TAILQ_FIRST(&wt->unclaimed);
+		aux_waiter_unclaimed_del(wt, ent);
+		aux_waiter_put(wt, ent);
+		wt->dropped = true;
+	}
+}
+
+static void aux_waiter_unbound(struct mlxdevm_aux_waiter *wt, uint32_t sfnum)
+{
+	struct aux_waiter_ent *ent = aux_waiter_find(wt, sfnum);
+
+	if (ent && ent->state == AUX_WAITER_BOUND) {
+		aux_waiter_unclaimed_del(wt, ent);
+		aux_waiter_put(wt, ent);
+	}
+}
+
+/* Last component of the @dev symlink target of @dir is @name */
+static bool aux_link_name(const char *dir, const char *dev, const char *link,
+			  const char *name)
+{
+	char path[PATH_MAX];
+	char target[PATH_MAX];
+	const char *base;
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "%s/%s%s", dir, dev, link);
+	len = readlink(path, target, sizeof(target) - 1);
+	if (len <= 0)
+		return false;
+	target[len] = '\0';
+
+	if (!link[0]) {
+		/* .../<parent>/<dev>: drop the device itself */
+		base = strrchr(target, '/');
+		if (!base)
+			return false;
+		target[base - target] = '\0';
+	}
+	if (!name)
+		return true;
+	base = strrchr(target, '/');
+	return !strcmp(base ? base + 1 : target, name);
+}
+
+/* Find the bound devices of the waiting SFs in sysfs, or of all the SFs
+ * of the parent when @all is set.
+ */
+static void aux_waiter_rescan(struct mlxdevm_aux_waiter *wt, bool all)
+{
+	struct aux_waiter_ent *ent;
+	struct dirent *d;
+	uint32_t sfnum;
+	DIR *dir;
+
+	if (!all && !wt->waiting)
+		return;
+
+	dir = opendir(AUX_DEVICES_PATH);
+	if (!dir)
+		return;
+
+	while ((all || wt->waiting) && (d = readdir(dir))) {
+		if (d->d_name[0] == '.' || aux_sfnum_read(d->d_name, &sfnum))
+			continue;
+		ent = aux_waiter_find(wt, sfnum);
+		if (!all && (!ent || ent->state != AUX_WAITER_WAITING))
+			continue;
+		if (aux_link_name(AUX_DEVICES_PATH, d->d_name, "", wt->parent) &&
+		    aux_link_name(AUX_DEVICES_PATH, d->d_name, "/driver", NULL))
+			aux_waiter_bound(wt, sfnum, d->d_name);
+	}
+	closedir(dir);
+}
+
+static void aux_waiter_events(struct mlxdevm_aux_waiter *wt)
+{
+	struct aux_waiter_ent *ent;
+	struct mlxdevm_aux_event ev;
+	int ret;
+
+	while ((ret = mlxdevm_aux_watch_recv(wt->watch, &ev)) > 0) {
+		if (!ev.sfnum_valid || strcmp(ev.parent, wt->parent))
+			continue;
+		if (ev.action == MLXDEVM_AUX_BIND)
+			aux_waiter_bound(wt, ev.sfnum, ev.dev);
+		else if (ev.action == MLXDEVM_AUX_UNBIND ||
+			 ev.action == MLXDEVM_AUX_REMOVE)
+			aux_waiter_unbound(wt, ev.sfnum);
+	}
+	/* Bind and unbind events may have been lost, including those of
+	 * SFs which are not waited for yet: read all the SFs from sysfs.
+	 */
+	if (ret == -ENOBUFS) {
+		while ((ent = TAILQ_FIRST(&wt->unclaimed))) {
+			aux_waiter_unclaimed_del(wt, ent);
+			aux_waiter_put(wt, ent);
+		}
+		aux_waiter_rescan(wt, true);
+	}
+}
+
+static void aux_waiter_expire(struct mlxdevm_aux_waiter *wt)
+{
+	uint64_t now = aux_now_ns();
+	struct aux_waiter_ent *ent;
+
+	while ((ent = TAILQ_FIRST(&wt->deadlines)) && ent->deadline_ns <= now)
+		aux_waiter_ready(wt, ent, -ETIMEDOUT);
+}
+
+static int aux_waiter_epoll_add(struct mlxdevm_aux_waiter *wt, int fd)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.fd = fd,
+	};
+
+	return epoll_ctl(wt->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+struct mlxdevm_aux_waiter *mlxdevm_aux_waiter_create(const char *parent)
+{
+	struct mlxdevm_aux_waiter *wt;
+
+	wt = calloc(1, sizeof(*wt));
+	if (!wt)
+		return NULL;
+	TAILQ_INIT(&wt->deadlines);
+	TAILQ_INIT(&wt->ready);
+	TAILQ_INIT(&wt->unclaimed);
+	wt->epfd = -1;
+	wt->tfd = -1;
+	wt->efd = -1;
+
+	wt->bits = AUX_WAITER_MIN_BITS;
+	wt->buckets = calloc(1u << wt->bits, sizeof(*wt->buckets));
+	wt->parent = strdup(parent);
+	if (!wt->buckets || !wt->parent)
+		goto err;
+
+	wt->epfd = epoll_create1(EPOLL_CLOEXEC);
+	wt->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	wt->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wt->epfd < 0 || wt->tfd < 0 || wt->efd < 0)
+		goto err;
+	if (aux_waiter_epoll_add(wt, wt->tfd) ||
+	    aux_waiter_epoll_add(wt, wt->efd))
+		goto err;
+
+	/* Without uevents, sysfs is polled while SFs are waited for */
+	wt->watch = mlxdevm_aux_watch_open();
+	if (wt->watch &&
+	    aux_waiter_epoll_add(wt, mlxdevm_aux_watch_get_fd(wt->watch))) {
+		mlxdevm_aux_watch_close(wt->watch);
+		wt->watch = NULL;
+	}
+	return wt;
+
+err:
+	mlxdevm_aux_waiter_destroy(wt);
+	return NULL;
+}
+
+void mlxdevm_aux_waiter_destroy(struct mlxdevm_aux_waiter *wt)
+{
+	struct aux_waiter_ent *ent;
+	unsigned int i;
+
+	if (wt->buckets) {
+		for (i = 0; i < 1u << wt->bits; i++) {
+			while ((ent = wt->buckets[i])) {
+				wt->buckets[i] = ent->hnext;
+				free(ent);
+			}
+		}
+	}
+	if (wt->watch)
+		mlxdevm_aux_watch_close(wt->watch);
+	if (wt->efd >= 0)
+		close(wt->efd);
+	if (wt->tfd >= 0)
+		close(wt->tfd);
+	if (wt->epfd >= 0)
+		close(wt->epfd);
+	free(wt->buckets);
+	free(wt->parent);
+	free(wt);
+}
+
+int mlxdevm_aux_waiter_get_fd(const struct mlxdevm_aux_waiter *wt)
+{
+	return wt->epfd;
+}
+
+int mlxdevm_aux_waiter_add(struct mlxdevm_aux_waiter *wt, uint32_t sfnum,
+			   const struct timespec *deadline,
+			   mlxdevm_aux_wait_cb_t cb, void *priv)
+{
+	struct aux_waiter_ent *ent, *prev;
+
+	ent = aux_waiter_get(wt, sfnum);
+	if (!ent)
+		return -ENOMEM;
+	if (ent->state != AUX_WAITER_BOUND)
+		return -EEXIST;
+
+	ent->cb = cb;
+	ent->priv = priv;
+	ent->deadline_ns = 0;
+	wt->waiting++;
+
+	/* A device bound before the waiter was added */
+	if (ent->dev[0]) {
+		aux_waiter_unclaimed_del(wt, ent);
+		aux_waiter_ready(wt, ent, 0);
+		return 0;
+	}
+
+	ent->state = AUX_WAITER_WAITING;
+	if (deadline) {
+		ent->deadline_ns = deadline->tv_sec * 1000000000ull +
+				   deadline->tv_nsec;
+		/* Deadlines are mostly added in order */
+		TAILQ_FOREACH_REVERSE(prev, &wt->deadlines, aux_waiter_list,
+				      entry) {
+			if (prev->deadline_ns <= ent->deadline_ns)
+				break;
+		}
+		if (prev)
+			TAILQ_INSERT_AFTER(&wt->deadlines, prev, ent, entry);
+		else
+			TAILQ_INSERT_HEAD(&wt->deadlines, ent, entry);
+	}
+	/* The record of its device may have been dropped */
+	if (wt->dropped)
+		aux_waiter_rescan(wt, false);
+	aux_waiter_timer_arm(wt);
+	return 0;
+}
+
+void mlxdevm_aux_waiter_wake(struct mlxdevm_aux_waiter *wt)
+{
+	uint64_t one = 1;
+
+	if (write(wt->efd, &one, sizeof(one)) < 0)
+		return;
+}
+
+int mlxdevm_aux_waiter_dispatch(struct mlxdevm_aux_waiter *wt, int timeout_ms)
+{
+	struct epoll_event evs[3];
+	struct aux_waiter_ent *ent;
+	uint64_t val;
+	int done = 0;
+	int nfds;
+	int i;
+
+	nfds = epoll_wait(wt->epfd, evs, 3,
+			  TAILQ_EMPTY(&wt->ready) ? timeout_ms : 0);
+	if (nfds < 0 && errno != EINTR)
+		return -errno;
+
+	for (i = 0; i < nfds; i++) {
+		if (evs[i].data.fd == wt->tfd) {
+			if (read(wt->tfd, &val, sizeof(val)) > 0)
+				wt->armed_ns = 0;
+			if (!wt->watch)
+				aux_waiter_rescan(wt, false);
+			aux_waiter_expire(wt);
+		} else if (evs[i].data.fd == wt->efd) {
+			if (read(wt->efd, &val, sizeof(val)) < 0)
+				continue;
+		} else {
+			aux_waiter_events(wt);
+		}
+	}
+	aux_waiter_timer_arm(wt);
+
+	while ((ent = TAILQ_FIRST(&wt->ready))) {
+		TAILQ_REMOVE(&wt->ready, ent, entry);
+		MLXDEVM_TRACE(aux_wait_done, ent->sfnum, ent->err);
+		ent->cb(ent->sfnum, ent->dev, ent->err, ent->priv);
+		aux_waiter_put(wt, ent);
+		done++;
+	}
+	return done;
+}
+
+/* Driver files of a handle, kept open across rebinds */
+struct mlxdevm_sf_drv {
+	char *cfg_driver;
+	char *driver;
+	/* -1 when the config driver is not loaded */
+	int unbind_fd;
+	int bind_fd;
+};
+
+void mlxdevm_sf_drv_destroy(struct mlxdevm_sf_drv *drv)
+{
+	if (drv->unbind_fd >= 0)
+		close(drv->unbind_fd);
+	if (drv->bind_fd >= 0)
+		close(drv->bind_fd);
+	free(drv->cfg_driver);
+	free(drv->driver);
+	free(drv);
+}
+
+static int aux_driver_file_open(const char *driver, const char *file)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), AUX_DRIVERS_PATH "/%s/%s", driver, file);
+	return open(path, O_WRONLY | O_CLOEXEC);
+}
+
+static struct mlxdevm_sf_drv *sf_drv_get(struct mlxdevm *dl,
+					 const char *cfg_driver,
+					 const char *driver)
+{
+	struct mlxdevm_sf_drv *drv = dl->sf_drv;
+
+	if (drv && !strcmp(drv->cfg_driver, cfg_driver) &&
+	    !strcmp(drv->driver, driver))
+		return drv;
+	if (drv) {
+		mlxdevm_sf_drv_destroy(drv);
+		dl->sf_drv = NULL;
+	}
+
+	drv = calloc(1, sizeof(*drv));
+	if (!drv)
+		return NULL;
+	drv->unbind_fd = -1;
+	drv->bind_fd = -1;
+	drv->cfg_driver = strdup(cfg_driver);
+	drv->driver = strdup(driver);
+	if (!drv->cfg_driver || !drv->driver) {
+		errno = ENOMEM;
+		goto err;
+	}
+
+	drv->bind_fd = aux_driver_file_open(driver, "bind");
+	if (drv->bind_fd < 0)
+		goto err;
+	drv->unbind_fd = aux_driver_file_open(cfg_driver, "unbind");
+
+	dl->sf_drv = drv;
+	return drv;
+
+err:
+	mlxdevm_sf_drv_destroy(drv);
+	return NULL;
+}
+
+static int sf_drv_write(int fd, const char *dev)
+{
+	/* sysfs attributes ignore the offset, the file is never reopened */
+	if (pwrite(fd, dev, strlen(dev), 0) < 0)
+		return -errno;
+	return 0;
+}
+
+int mlxdevm_sf_drivers_rebind(struct mlxdevm *dl, const char *cfg_driver,
+			      const char *driver, const char * const *names,
+			      unsigned int n, int *errs)
+{
+	struct mlxdevm_sf_drv *drv;
+	unsigned int bound = 0;
+	unsigned int i;
+	int err;
+
+	drv = sf_drv_get(dl, cfg_driver, driver);
+	if (!drv)
+		return -errno;
+
+	/* All unbinds first, then all binds, with no open or close in
+	 * between.
+	 */
+	for (i = 0; i < n; i++) {
+		errs[i] = 0;
+		if (drv->unbind_fd < 0)
+			continue;
+		err = sf_drv_write(drv->unbind_fd, names[i]);
+		/* -ENODEV when not bound to the config driver */
+		if (err && err != -ENODEV)
+			errs[i] = err;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (errs[i])
+			continue;
+		err = sf_drv_write(drv->bind_fd, names[i]);
+		/* The driver may have probed the device on its own */
+		if (err && aux_link_name(AUX_DEVICES_PATH, names[i], "/driver",
+					 driver))
+			err = 0;
+		errs[i] = err;
+		if (!err)
+			bound++;
+	}
+	return bound;
+}
+
+int mlxdevm_sf_driver_rebind(struct mlxdevm *dl, const char * const *names,
+			     unsigned int n, int *errs)
+{
+	int ret;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	ret = mlxdevm_sf_drivers_rebind(dl, MLXDEVM_SF_CFG_DRIVER,
+					MLXDEVM_SF_DRIVER, names, n, errs);
+	MLXDEVM_TRACE_EXIT(0, 0, ret);
+	return ret;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "mlxdevm.h"
+#include "mlxdevm_priv.h"
+
+struct mlxdevm_mt_ent {
+	struct mlxdevm *dl;
+	struct mlxdevm_mt *mt;
+	TAILQ_ENTRY(mlxdevm_mt_ent) entry;
+};
+
+struct mlxdevm_mt {
+	/* Family, bus and dev of the per thread handles come from it */
+	struct mlxdevm *base;
+	pthread_key_t key;
+	pthread_mutex_t lock;
+	TAILQ_HEAD(, mlxdevm_mt_ent) ents;
+};
+
+static void mlxdevm_mt_ent_free(struct mlxdevm_mt_ent *ent)
+{
+	mlxdevm_close(ent->dl);
+	free(ent);
+}
+
+/* Close the handle of a thread when it exits */
+static void mlxdevm_mt_thread_exit(void *data)
+{
+	struct mlxdevm_mt_ent *ent = data;
+	struct mlxdevm_mt *mt = ent->mt;
+
+	pthread_mutex_lock(&mt->lock);
+	TAILQ_REMOVE(&mt->ents, ent, entry);
+	pthread_mutex_unlock(&mt->lock);
+	mlxdevm_mt_ent_free(ent);
+}
+
+struct mlxdevm_mt *mlxdevm_mt_open(const char *dl_sock_name,
+				   const char *dl_bus, const char *dl_dev)
+{
+	struct mlxdevm_mt *mt;
+
+	mt = calloc(1, sizeof(*mt));
+	if (!mt)
+		return NULL;
+
+	mt->base = mlxdevm_open(dl_sock_name, dl_bus, dl_dev);
+	if (!mt->base)
+		goto open_err;
+
+	if (pthread_key_create(&mt->key, mlxdevm_mt_thread_exit))
+		goto key_err;
+
+	pthread_mutex_init(&mt->lock, NULL);
+	TAILQ_INIT(&mt->ents);
+	return mt;
+
+key_err:
+	mlxdevm_close(mt->base);
+open_err:
+	free(mt);
+	return NULL;
+}
+
+struct mlxdevm *mlxdevm_handle_dup(struct mlxdevm *base)
+{
+	struct mlxdevm *dl;
+	int err;
+
+	dl = calloc(1, sizeof(*dl));
+	if (!dl)
+		return NULL;
+
+	/* A socket of its own, without looking the family up again */
+	dl->nls = &dl->own_nls;
+	err = netlink_socket_dup(dl->nls, base->nls);
+	if (err) {
+		free(dl);
+		errno = -err;
+		return NULL;
+	}
+	dl->bus = base->bus;
+	dl->dev = base->dev;
+	dl->names_shared = true;
+	return dl;
+}
+
+static struct mlxdevm *mlxdevm_mt_handle_create(struct mlxdevm_mt *mt)
+{
+	struct mlxdevm_mt_ent *ent;
+	struct mlxdevm *dl;
+
+	ent = calloc(1, sizeof(*ent));
+	if (!ent)
+		return NULL;
+
+	dl = mlxdevm_handle_dup(mt->base);
+	if (!dl)
+		goto dl_err;
+
+	ent->dl = dl;
+	ent->mt = mt;
+	if (pthread_setspecific(mt->key, ent))
+		goto key_err;
+
+	pthread_mutex_lock(&mt->lock);
+	TAILQ_INSERT_TAIL(&mt->ents, ent, entry);
+	pthread_mutex_unlock(&mt->lock);
+	return dl;
+
+key_err:
+	mlxdevm_close(dl);
+dl_err:
+	free(ent);
+	return NULL;
+}
+
+struct mlxdevm *mlxdevm_mt_handle(struct mlxdevm_mt *mt)
+{
+	struct mlxdevm_mt_ent *ent;
+
+	ent = pthread_getspecific(mt->key);
+	if (ent)
+		return ent->dl;
+
+	return mlxdevm_mt_handle_create(mt);
+}
+
+void mlxdevm_mt_close(struct mlxdevm_mt *mt)
+{
+	struct mlxdevm_mt_ent *ent;
+
+	/* Deleting the key first keeps thread exit from touching the list */
+	pthread_key_delete(mt->key);
+
+	while ((ent = TAILQ_FIRST(&mt->ents))) {
+		TAILQ_REMOVE(&mt->ents, ent, entry);
+		mlxdevm_mt_ent_free(ent);
+	}
+	pthread_mutex_destroy(&mt->lock);
+	mlxdevm_close(mt->base);
+	free(mt);
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "mlxdevm_netlink.h"
+#include "mlxdevm.h"
+#include "mlxdevm_priv.h"
+#include "mlxdevm_trace.h"
+
+/* Parameter schema of a driver: name, type and supported cmodes of each
+ * parameter. Devices bound to the same driver share the schema, so it is
+ * dumped once per driver for the whole process. Schemas are hashed by
+ * driver key.
+ */
+#define PARAM_SCHEMA_HASH_BITS	6
+
+struct param_desc {
+	char name[MLXDEVM_PARAM_NAME_LEN];
+	uint8_t nla_type;
+	uint8_t cmodes;
+};
+
+struct param_schema {
+	struct param_schema *next;
+	char *driver;
+	unsigned int count;
+	struct param_desc descs[];
+};
+
+static struct param_schema *param_schemas[1 << PARAM_SCHEMA_HASH_BITS];
+static pthread_mutex_t param_schemas_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char *mlxdevm_dev_driver_key(const char *bus, const char *dev)
+{
+	char link[PATH_MAX];
+	char path[PATH_MAX];
+	const char *name;
+	ssize_t len;
+	size_t size;
+	char *key;
+
+	snprintf(path, sizeof(path), "/sys/bus/%s/devices/%s/driver", bus, dev);
+	len = readlink(path, link, sizeof(link) - 1);
+	if (len <= 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+	link[len] = '\0';
+	name = strrchr(link, '/');
+	name = name ? name + 1 : link;
+
+	size = strlen(bus) + strlen(name) + 2;
+	key = malloc(size);
+	if (!key) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	snprintf(key, size, "%s/%s", bus, name);
+	return key;
+}
+
+static struct param_schema **param_schema_bucket(const char *driver)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *driver; driver++)
+		hash = (hash ^ (uint8_t)*driver) * 16777619u;
+	return &param_schemas[hash >> (32 - PARAM_SCHEMA_HASH_BITS)];
+}
+
+static struct param_schema *param_schema_find(const char *driver)
+{
+	struct param_schema *schema;
+
+	for (schema = *param_schema_bucket(driver); schema;
+	     schema = schema->next) {
+		if (!strcmp(schema->driver, driver))
+			return schema;
+	}
+	return NULL;
+}
+
+static const struct param_desc *
+param_desc_find(const struct param_schema *schema, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < schema->count; i++) {
+		if (!strcmp(schema->descs[i].name, name))
+			return &schema->descs[i];
+	}
+	return NULL;
+}
+
+static struct param_schema *param_schema_build(struct mlxdevm *dl,
+					       const char *bus, const char *dev,
+					       const char *driver)
+{
+	struct mlxdevm_params params = {};
+	const struct mlxdevm_param_entry *entry;
+	struct param_schema *schema = NULL;
+	struct param_desc *desc;
+	unsigned int i;
+	int err;
+
+	err = mlxdevm_params_dump_dev(dl, bus, dev, &params);
+	if (err) {
+		errno = -err;
+		return NULL;
+	}
+
+	/* Entries are per cmode, so there are at most as many parameters */
+	schema = calloc(1, sizeof(*schema) +
+			params.count * sizeof(struct param_desc));
+	if (!schema)
+		goto out;
+	schema->driver = strdup(driver);
+	if (!schema->driver) {
+		free(schema);
+		schema = NULL;
+		goto out;
+	}
+
+	for (i = 0; i < params.count; i++) {
+		entry = &params.entries[i];
+		desc = (struct param_desc *)param_desc_find(schema, entry->name);
+		if (!desc) {
+			desc = &schema->descs[schema->count++];
+			strcpy(desc->name, entry->name);
+			desc->nla_type = entry->param.nla_type;
+		}
+		desc->cmodes |= 1 << entry->param.cmode;
+	}
+out:
+	mlxdevm_params_free(&params);
+	return schema;
+}
+
+static void param_schema_free(struct param_schema *schema)
+{
+	free(schema->driver);
+	free(schema);
+}
+
+/* Descriptor of a parameter of a device bound to no driver, read from the
+ * device alone as there is no schema to share.
+ */
+static int param_desc_fetch(struct mlxdevm *dl, const char *bus,
+			    const char *dev, const char *name,
+			    struct param_desc *out)
+{
+	struct mlxdevm_params params = {};
+	unsigned int i;
+	int err;
+
+	err = mlxdevm_param_get_dev(dl, bus, dev, name, &params);
+	if (err)
+		return err;
+
+	memset(out, 0, sizeof(*out));
+	for (i = 0; i < params.count; i++) {
+		if (strcmp(params.entries[i].name, name))
+			continue;
+		out->nla_type = params.entries[i].param.nla_type;
+		out->cmodes |= 1 << params.entries[i].param.cmode;
+	}
+	mlxdevm_params_free(&params);
+	return out->cmodes ? 0 : -ENOENT;
+}
+
+/* Copy the descriptor out under the lock, as the schema may be freed by
+ * mlxdevm_param_cache_clear() once it is released.
+ * Return: 0, -ENOENT for an unknown parameter or 1 when the driver has
+ * no schema yet.
+ */
+static int param_desc_lookup(const char *driver, const char *name,
+			     struct param_desc *out)
+{
+	const struct param_desc *desc;
+	struct param_schema *schema;
+	int ret = 1;
+
+	pthread_mutex_lock(&param_schemas_lock);
+	schema = param_schema_find(driver);
+	if (schema) {
+		desc = param_desc_find(schema, name);
+		if (desc)
+			*out = *desc;
+		ret = desc ? 0 : -ENOENT;
+	}
+	pthread_mutex_unlock(&param_schemas_lock);
+	return ret;
+}
+
+static int param_desc_get(struct mlxdevm *dl, const char *bus,
+			  const char *dev, const char *driver,
+			  const char *name, struct param_desc *out)
+{
+	struct param_schema **bucket;
+	struct param_schema *built;
+	int ret;
+
+	if (!driver)
+		return param_desc_fetch(dl, bus, dev, name, out);
+
+	ret = param_desc_lookup(driver, name, out);
+	if (ret <= 0)
+		return ret;
+
+	/* Dump without holding the lock; if another thread added the same
+	 * schema meanwhile, its copy is kept.
+	 */
+	built = param_schema_build(dl, bus, dev, driver);
+	if (!built)
+		return errno ? -errno : -ENOMEM;
+
+	pthread_mutex_lock(&param_schemas_lock);
+	if (!param_schema_find(driver)) {
+		bucket = param_schema_bucket(driver);
+		built->next = *bucket;
+		*bucket = built;
+		built = NULL;
+	}
+	pthread_mutex_unlock(&param_schemas_lock);
+	if (built)
+		param_schema_free(built);
+
+	ret = param_desc_lookup(driver, name, out);
+	return ret > 0 ? -ENOENT : ret;
+}
+
+int mlxdevm_param_type_get(struct mlxdevm *dl, const char *bus,
+			   const char *dev, const char *driver,
+			   const char *name, uint8_t cmode, uint8_t *nla_type)
+{
+	struct param_desc desc;
+	int err;
+
+	if (cmode > MLXDEVM_PARAM_CMODE_MAX)
+		return -EINVAL;
+
+	err = param_desc_get(dl, bus, dev, driver, name, &desc);
+	if (err)
+		return err;
+	if (!(desc.cmodes & (1 << cmode)))
+		return -EOPNOTSUPP;
+
+	*nla_type = desc.nla_type;
+	return 0;
+}
+
+int mlxdevm_dev_driver_param_set_by_name(struct mlxdevm *dl, const char *name,
+					 uint8_t cmode,
+					 const union mlxdevm_param_value *value)
+{
+	struct mlxdevm_param param = {};
+	char *driver;
+	int err;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+	/* Resolved on every call, as SFs move from one driver to another */
+	driver = mlxdevm_dev_driver_key(dl->bus, dl->dev);
+	if (!driver && errno != ENOENT) {
+		err = -errno;
+		goto out;
+	}
+
+	err = mlxdevm_param_type_get(dl, dl->bus, dl->dev, driver, name,
+				     cmode, &param.nla_type);
+	free(driver);
+	if (!err) {
+		param.cmode = cmode;
+		param.u = *value;
+		err = mlxdevm_dev_driver_param_set(dl, name, &param);
+	}
+out:
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
+
+void mlxdevm_param_cache_clear(void)
+{
+	struct param_schema *schema;
+	unsigned int i;
+
+	pthread_mutex_lock(&param_schemas_lock);
+	for (i = 0; i < 1 << PARAM_SCHEMA_HASH_BITS; i++) {
+		while (param_schemas[i]) {
+			schema = param_schemas[i];
+			param_schemas[i] = schema->next;
+			param_schema_free(schema);
+		}
+	}
+	pthread_mutex_unlock(&param_schemas_lock);
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "mlxdevm.h"
+
+/* Open addressing with linear probing, kept at most half full */
+#define PORT_TABLE_MIN_BITS 6
+
+struct port_slot {
+	uint64_t key;
+	struct mlxdevm_port *port;
+	/* ifindex the port was indexed with, in the port_index hash only */
+	uint32_t ifindex;
+};
+
+struct port_hash {
+	struct port_slot *slots;
+};
+
+struct mlxdevm_port_table {
+	struct port_hash by_index;
+	struct port_hash by_sfnum;
+	struct port_hash by_ifindex;
+	unsigned int bits;
+	unsigned int count;
+};
+
+static uint64_t sfnum_key(uint32_t pfnum, uint32_t sfnum)
+{
+	return (uint64_t)pfnum << 32 | sfnum;
+}
+
+static unsigned int port_hash_home(const struct mlxdevm_port_table *t,
+				   uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - t->bits);
+}
+
+static struct port_slot *
+port_hash_find(const struct mlxdevm_port_table *t, const struct port_hash *h,
+	       uint64_t key, const struct mlxdevm_port *port)
+{
+	unsigned int mask = (1u << t->bits) - 1;
+	unsigned int i = port_hash_home(t, key);
+
+	for (; h->slots[i].port; i = (i + 1) & mask) {
+		if (h->slots[i].key == key &&
+		    (!port || h->slots[i].port == port))
+			return &h->slots[i];
+	}
+	return NULL;
+}
+
+static struct port_slot *
+port_hash_insert(const struct mlxdevm_port_table *t, struct port_hash *h,
+		 uint64_t key, struct mlxdevm_port *port)
+{
+	unsigned int mask = (1u << t->bits) - 1;
+	unsigned int i = port_hash_home(t, key);
+
+	while (h->slots[i].port)
+		i = (i + 1) & mask;
+
+	h->slots[i].key = key;
+	h->slots[i].port = port;
+	return &h->slots[i];
+}
+
+static void port_hash_remove(const struct mlxdevm_port_table *t,
+			     struct port_hash *h, struct port_slot *slot)
+{
+	unsigned int mask = (1u << t->bits) - 1;
+	unsigned int i = slot - h->slots;
+	unsigned int j = i;
+	unsigned int k;
+
+	/* Backward shift deletion: move up entries whose probe sequence
+	 * crosses the freed slot, so lookups never need tombstones.
+	 */
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!h->slots[j].port)
+			break;
+		k = port_hash_home(t, h->slots[j].key);
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && k <= i && k > j)) {
+			h->slots[i] = h->slots[j];
+			i = j;
+		}
+	}
+	h->slots[i].port = NULL;
+}
+
+static int port_table_alloc(struct mlxdevm_port_table *t, unsigned int bits)
+{
+	size_t size = (size_t)1 << bits;
+
+	t->by_index.slots = calloc(size, sizeof(struct port_slot));
+	t->by_sfnum.slots = calloc(size, sizeof(struct port_slot));
+	t->by_ifindex.slots = calloc(size, sizeof(struct port_slot));
+	if (!t->by_index.slots || !t->by_sfnum.slots || !t->by_ifindex.slots) {
+		free(t->by_index.slots);
+		free(t->by_sfnum.slots);
+		free(t->by_ifindex.slots);
+		return -ENOMEM;
+	}
+	t->bits = bits;
+	return 0;
+}
+
+static void port_table_index(struct mlxdevm_port_table *t,
+			     struct mlxdevm_port *port, uint32_t ifindex)
+{
+	struct port_slot *slot;
+
+	slot = port_hash_insert(t, &t->by_index, port->port_index, port);
+	slot->ifindex = ifindex;
+	port_hash_insert(t, &t->by_sfnum,
+			 sfnum_key(port->pfnum, port->sfnum), port);
+	if (ifindex)
+		port_hash_insert(t, &t->by_ifindex, ifindex, port);
+}
+
+/* Rehash into a new table, so @t is left intact when allocation fails */
+static int port_table_grow(struct mlxdevm_port_table *t)
+{
+	struct mlxdevm_port_table grown = { .count = t->count };
+	unsigned int size = 1u << t->bits;
+	unsigned int i;
+	int err;
+
+	err = port_table_alloc(&grown, t->bits + 1);
+	if (err)
+		return err;
+
+	for (i = 0; i < size; i++) {
+		struct port_slot *slot = &t->by_index.slots[i];
+
+		if (slot->port)
+			port_table_index(&grown, slot->port, slot->ifindex);
+	}
+
+	free(t->by_index.slots);
+	free(t->by_sfnum.slots);
+	free(t->by_ifindex.slots);
+	*t = grown;
+	return 0;
+}
+
+struct mlxdevm_port_table *mlxdevm_port_table_create(unsigned int size_hint)
+{
+	struct mlxdevm_port_table *t;
+	unsigned int bits = PORT_TABLE_MIN_BITS;
+
+	while (bits < 31 && (1u << (bits - 1)) < size_hint)
+		bits++;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	if (port_table_alloc(t, bits)) {
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+void mlxdevm_port_table_destroy(struct mlxdevm_port_table *t)
+{
+	free(t->by_index.slots);
+	free(t->by_sfnum.slots);
+	free(t->by_ifindex.slots);
+	free(t);
+}
+
+int mlxdevm_port_table_insert(struct mlxdevm_port_table *t,
+			      struct mlxdevm_port *port)
+{
+	int err;
+
+	if (port_hash_find(t, &t->by_index, port->port_index, NULL))
+		return -EEXIST;
+
+	if ((t->count + 1) * 2 > 1u << t->bits) {
+		err = port_table_grow(t);
+		if (err)
+			return err;
+	}
+
+	port_table_index(t, port, port->ndev_ifindex);
+	t->count++;
+	return 0;
+}
+
+int mlxdevm_port_table_remove(struct mlxdevm_port_table *t,
+			      struct mlxdevm_port *port)
+{
+	struct port_slot *slot;
+	uint32_t ifindex;
+
+	slot = port_hash_find(t, &t->by_index, port->port_index, port);
+	if (!slot)
+		return -ENOENT;
+
+	ifindex = slot->ifindex;
+	port_hash_remove(t, &t->by_index, slot);
+
+	slot = port_hash_find(t, &t->by_sfnum,
+			      sfnum_key(port->pfnum, port->sfnum), port);
+	if (slot)
+		port_hash_remove(t, &t->by_sfnum, slot);
+
+	if (ifindex) {
+		slot = port_hash_find(t, &t->by_ifindex, ifindex, port);
+		if (slot)
+			port_hash_remove(t, &t->by_ifindex, slot);
+	}
+	t->count--;
+	return 0;
+}
+
+int mlxdevm_port_table_update(struct mlxdevm_port_table *t,
+			      struct mlxdevm_port *port)
+{
+	struct port_slot *slot;
+
+	slot = port_hash_find(t, &t->by_index, port->port_index, port);
+	if (!slot)
+		return -ENOENT;
+	if (slot->ifindex == port->ndev_ifindex)
+		return 0;
+
+	if (slot->ifindex) {
+		struct port_slot *old;
+
+		old = port_hash_find(t, &t->by_ifindex, slot->ifindex, port);
+		if (old)
+			port_hash_remove(t, &t->by_ifindex, old);
+	}
+	slot->ifindex = port->ndev_ifindex;
+	if (slot->ifindex)
+		port_hash_insert(t, &t->by_ifindex, slot->ifindex, port);
+	return 0;
+}
+
+int mlxdevm_port_table_add_list(struct mlxdevm_port_table *t,
+				struct mlxdevm_port_list_head *head)
+{
+	struct mlxdevm_port_list *entry;
+	int err;
+
+	TAILQ_FOREACH(entry, head, entry) {
+		err = mlxdevm_port_table_insert(t, &entry->port);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+unsigned int mlxdevm_port_table_count(const struct mlxdevm_port_table *t)
+{
+	return t->count;
+}
+
+struct mlxdevm_port *
+mlxdevm_port_table_find_index(const struct mlxdevm_port_table *t,
+			      uint32_t port_index)
+{
+	struct port_slot *slot;
+
+	slot = port_hash_find(t, &t->by_index, port_index, NULL);
+	return slot ? slot->port : NULL;
+}
+
+struct mlxdevm_port *
+mlxdevm_port_table_find_sfnum(const struct mlxdevm_port_table *t,
+			      uint32_t pfnum, uint32_t sfnum)
+{
+	struct port_slot *slot;
+
+	slot = port_hash_find(t, &t->by_sfnum, sfnum_key(pfnum, sfnum), NULL);
+	return slot ? slot->port : NULL;
+}
+
+struct mlxdevm_port *
+mlxdevm_port_table_find_ifindex(const struct mlxdevm_port_table *t,
+				uint32_t ifindex)
+{
+	struct port_slot *slot;
+
+	if (!ifindex)
+		return NULL;
+
+	slot = port_hash_find(t, &t->by_ifindex, ifindex, NULL);
+	return slot ? slot->port : NULL;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#ifndef _MLXDEVM_PRIV_H_
+#define _MLXDEVM_PRIV_H_
+
+#include "mlxdevm.h"
+
+/* Library internal interfaces shared between source files */
+
+/**
+ * mlxdevm_params_dump_dev - Dump the parameters of any device through the
+ * socket of @dl
+ */
+int mlxdevm_params_dump_dev(struct mlxdevm *dl, const char *bus,
+			    const char *dev, struct mlxdevm_params *params);
+
+/**
+ * mlxdevm_param_get_dev - mlxdevm_params_dump_dev() of parameter @name only
+ */
+int mlxdevm_param_get_dev(struct mlxdevm *dl, const char *bus,
+			  const char *dev, const char *name,
+			  struct mlxdevm_params *params);
+
+/**
+ * mlxdevm_dev_driver_key - Key of the parameter schema of a device
+ * Return: allocated string, or NULL with errno set to ENOENT when the
+ * device is bound to no driver or to ENOMEM.
+ */
+char *mlxdevm_dev_driver_key(const char *bus, const char *dev);
+
+/**
+ * mlxdevm_param_type_get - Type of a parameter from the schema cache
+ *
+ * The schema of @driver is dumped from device @bus/@dev when not cached.
+ * When @driver is NULL, the parameter is read from the device instead and
+ * nothing is cached.
+ * Return: 0, -ENOENT, -EOPNOTSUPP if @cmode is not supported or another
+ * negative error code.
+ */
+int mlxdevm_param_type_get(struct mlxdevm *dl, const char *bus,
+			   const char *dev, const char *driver,
+			   const char *name, uint8_t cmode, uint8_t *nla_type);
+
+/**
+ * mlxdevm_handle_dup - Handle of the device of @base with a socket of its own
+ *
+ * The new handle borrows the bus and dev names of @base, so it must be
+ * closed before @base.
+ * Return: handle or NULL on error.
+ */
+struct mlxdevm *mlxdevm_handle_dup(struct mlxdevm *base);
+
+#define MLXDEVM_SF_CFG_DRIVER	"mlx5_core.sf_cfg"
+#define MLXDEVM_SF_DRIVER	"mlx5_core.sf"
+
+/**
+ * mlxdevm_sf_drivers_rebind - mlxdevm_sf_driver_rebind() between any
+ * two drivers
+ */
+int mlxdevm_sf_drivers_rebind(struct mlxdevm *dl, const char *cfg_driver,
+			      const char *driver, const char * const *names,
+			      unsigned int n, int *errs);
+
+void mlxdevm_sf_drv_destroy(struct mlxdevm_sf_drv *drv);
+
+/**
+ * mlxdevm_cmd_sndrcv - netlink_socket_sndrcv() on the socket of @dl,
+ * counted in the command statistics
+ */
+int mlxdevm_cmd_sndrcv(struct mlxdevm *dl, const struct nlmsghdr *nlh,
+		       mnl_cb_t data_cb, void *data);
+
+void mlxdevm_stats_destroy(struct mlxdevm *dl);
+
+#endif /* _MLXDEVM_PRIV_H_ */
@@ -0,0 +1,524 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include "mlxdevm_netlink.h"
+#include "mlxdevm.h"
+#include "mlxdevm_priv.h"
+#include "mlxdevm_trace.h"
+
+#define SF_AUX_DEV_TIMEOUT_MS	10000
+
+struct sf_worker;
+
+struct sf_job {
+	struct mlxdevm_sf_result res;
+	/* Time the auxiliary device thread took the job */
+	uint64_t start_ns;
+	/* Auxiliary device thread waiting for the device of the job */
+	struct sf_worker *aux_worker;
+	TAILQ_ENTRY(sf_job) entry;
+};
+
+TAILQ_HEAD(sf_job_list, sf_job);
+
+/* Jobs waiting for a stage */
+struct sf_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct sf_job_list jobs;
+	/* Woken up instead of waiting on the condition */
+	struct mlxdevm_aux_waiter *waiter;
+	bool stop;
+};
+
+struct sf_provision;
+
+struct sf_worker {
+	struct sf_provision *p;
+	enum mlxdevm_sf_stage stage;
+	struct mlxdevm *dl;
+	pthread_t tid;
+	bool started;
+	/* Stats of this worker only, merged once the pipeline is done */
+	struct mlxdevm_sf_stage_stats stats;
+};
+
+struct sf_provision {
+	struct sf_queue queues[MLXDEVM_SF_STAGE_MAX];
+	const char *dev;
+	const char *cfg_driver;
+	const char *driver;
+	uint64_t aux_dev_timeout_ns;
+	bool wait_attached;
+	const struct mlxdevm_sf_provision_cbs *cbs;
+	struct mlxdevm_aux_waiter *waiter;
+	pthread_mutex_t done_lock;
+	pthread_cond_t done_cond;
+	unsigned int done;
+	unsigned int provisioned;
+};
+
+static uint64_t sf_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sf_stats_update(struct mlxdevm_sf_stage_stats *stats, uint64_t ns)
+{
+	if (!stats->count || ns < stats->min_ns)
+		stats->min_ns = ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+	stats->total_ns += ns;
+	stats->count++;
+}
+
+static void sf_stats_merge(struct mlxdevm_sf_stage_stats *to,
+			   const struct mlxdevm_sf_stage_stats *from)
+{
+	if (!from->count)
+		return;
+	if (!to->count || from->min_ns < to->min_ns)
+		to->min_ns = from->min_ns;
+	if (from->max_ns > to->max_ns)
+		to->max_ns = from->max_ns;
+	to->total_ns += from->total_ns;
+	to->count += from->count;
+}
+
+static void sf_queue_init(struct sf_queue *q)
+{
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	TAILQ_INIT(&q->jobs);
+	q->stop = false;
+}
+
+static void sf_queue_fini(struct sf_queue *q)
+{
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+}
+
+static void sf_queue_push(struct sf_queue *q, struct sf_job *job)
+{
+	pthread_mutex_lock(&q->lock);
+	TAILQ_INSERT_TAIL(&q->jobs, job, entry);
+	pthread_mutex_unlock(&q->lock);
+	pthread_cond_signal(&q->cond);
+	if (q->waiter)
+		mlxdevm_aux_waiter_wake(q->waiter);
+}
+
+/* Return: next job, or NULL once the queue is stopped */
+static struct sf_job *sf_queue_pop(struct sf_queue *q)
+{
+	struct sf_job *job;
+
+	pthread_mutex_lock(&q->lock);
+	while (TAILQ_EMPTY(&q->jobs) && !q->stop)
+		pthread_cond_wait(&q->cond, &q->lock);
+	job = TAILQ_FIRST(&q->jobs);
+	if (job)
+		TAILQ_REMOVE(&q->jobs, job, entry);
+	pthread_mutex_unlock(&q->lock);
+	return job;
+}
+
+/* Move all queued jobs to @to without waiting.
+ * Return: false once the queue is stopped.
+ */
+static bool sf_queue_take_all(struct sf_queue *q, struct sf_job_list *to)
+{
+	bool stop;
+
+	pthread_mutex_lock(&q->lock);
+	TAILQ_CONCAT(to, &q->jobs, entry);
+	stop = q->stop;
+	pthread_mutex_unlock(&q->lock);
+	return !stop;
+}
+
+static void sf_queue_stop(struct sf_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->stop = true;
+	pthread_mutex_unlock(&q->lock);
+	pthread_cond_broadcast(&q->cond);
+	if (q->waiter)
+		mlxdevm_aux_waiter_wake(q->waiter);
+}
+
+static void sf_job_done(struct sf_provision *p, struct mlxdevm *dl,
+			struct sf_job *job, enum mlxdevm_sf_stage stage, int err)
+{
+	struct mlxdevm_sf_result *res = &job->res;
+
+	res->stage = err ? stage : MLXDEVM_SF_STAGE_MAX;
+	res->err = err;
+	if (err && res->port) {
+		mlxdevm_sf_port_del(dl, res->port);
+		res->port = NULL;
+	}
+
+	pthread_mutex_lock(&p->done_lock);
+	if (p->cbs && p->cbs->done)
+		p->cbs->done(res, p->cbs->priv);
+	if (!err)
+		p->provisioned++;
+	p->done++;
+	pthread_mutex_unlock(&p->done_lock);
+	pthread_cond_signal(&p->done_cond);
+}
+
+static void sf_job_next(struct sf_worker *w, struct sf_job *job,
+			uint64_t start_ns, int err)
+{
+	struct sf_provision *p = w->p;
+	uint64_t ns = sf_now_ns() - start_ns;
+
+	job->res.stage_ns[w->stage] = ns;
+	sf_stats_update(&w->stats, ns);
+	MLXDEVM_TRACE(sf_stage, w->stage, job->res.spec->sfnum, ns, err);
+
+	if (err || w->stage + 1 == MLXDEVM_SF_STAGE_MAX)
+		sf_job_done(p, w->dl, job, w->stage, err);
+	else
+		sf_queue_push(&p->queues[w->stage + 1], job);
+}
+
+/* Return: end time of the step, start time of the next one */
+static uint64_t sf_step_done(struct sf_job *job, enum mlxdevm_sf_step step,
+			     uint64_t start_ns)
+{
+	uint64_t now = sf_now_ns();
+
+	job->res.step_ns[step] = now - start_ns;
+	return now;
+}
+
+static int sf_port_stage(struct sf_worker *w, struct sf_job *job)
+{
+	const struct mlxdevm_sf_spec *spec = job->res.spec;
+	struct mlxdevm_port_fn_config cfg = spec->fn;
+	struct mlxdevm_port *port;
+	uint64_t ns = sf_now_ns();
+	int err;
+
+	port = mlxdevm_sf_port_add(w->dl, spec->pfnum, spec->sfnum);
+	if (!port)
+		return errno ? -errno : -EINVAL;
+	ns = sf_step_done(job, MLXDEVM_SF_STEP_PORT_ADD, ns);
+	job->res.port = port;
+
+	/* Applied on their own to be timed apart from the activation */
+	cfg.ext_cap.roce_valid &= port->ext_cap.roce_valid;
+	cfg.ext_cap.max_uc_macs_valid &= port->ext_cap.max_uc_macs_valid;
+	if (cfg.ext_cap.roce_valid || cfg.ext_cap.max_uc_macs_valid) {
+		err = mlxdevm_port_fn_cap_set(w->dl, port, &cfg.ext_cap);
+		ns = sf_step_done(job, MLXDEVM_SF_STEP_PORT_CAP, ns);
+		if (err)
+			return err;
+		cfg.ext_cap.roce_valid = false;
+		cfg.ext_cap.max_uc_macs_valid = false;
+	}
+
+	cfg.state = MLXDEVM_PORT_FN_STATE_ACTIVE;
+	cfg.state_valid = true;
+	err = mlxdevm_port_fn_apply(w->dl, port, &cfg);
+	sf_step_done(job, MLXDEVM_SF_STEP_PORT_ACTIVATE, ns);
+	return err;
+}
+
+static int sf_params_stage(struct sf_worker *w, struct sf_job *job)
+{
+	const struct mlxdevm_sf_spec *spec = job->res.spec;
+	struct mlxdevm_dev_id id = {
+		.bus = "auxiliary",
+		.dev = job->res.aux_dev,
+	};
+	uint64_t ns = sf_now_ns();
+	int err = 0;
+	int ret;
+
+	if (!spec->nparams)
+		return 0;
+
+	ret = mlxdevm_devs_params_apply(w->dl, &id, 1, spec->params,
+					spec->nparams, &err);
+	sf_step_done(job, MLXDEVM_SF_STEP_PARAMS, ns);
+	return ret < 0 ? ret : err;
+}
+
+static int sf_bind_stage(struct sf_worker *w, struct sf_job *job)
+{
+	struct sf_provision *p = w->p;
+	const char *dev = job->res.aux_dev;
+	uint64_t ns = sf_now_ns();
+	int err;
+	int ret;
+
+	/* The driver files stay open on the handle of the worker */
+	ret = mlxdevm_sf_drivers_rebind(w->dl, p->cfg_driver, p->driver,
+					&dev, 1, &err);
+	ns = sf_step_done(job, MLXDEVM_SF_STEP_DRV_BIND, ns);
+	if (ret < 0)
+		return ret;
+	if (err)
+		return err;
+
+	if (!p->wait_attached)
+		return 0;
+	err = mlxdevm_port_fn_opstate_wait_attached(w->dl, job->res.port);
+	sf_step_done(job, MLXDEVM_SF_STEP_PORT_ATTACHED, ns);
+	return err;
+}
+
+static void *sf_stage_worker(void *arg)
+{
+	struct sf_worker *w = arg;
+	struct sf_provision *p = w->p;
+	struct sf_job *job;
+	uint64_t start_ns;
+	int err;
+
+	while ((job = sf_queue_pop(&p->queues[w->stage]))) {
+		start_ns = sf_now_ns();
+		switch (w->stage) {
+		case MLXDEVM_SF_STAGE_PORT:
+			err = sf_port_stage(w, job);
+			break;
+		case MLXDEVM_SF_STAGE_PARAMS:
+			err = sf_params_stage(w, job);
+			break;
+		default:
+			err = sf_bind_stage(w, job);
+			break;
+		}
+		sf_job_next(w, job, start_ns, err);
+	}
+	return NULL;
+}
+
+static void sf_aux_dev_bound(uint32_t sfnum, const char *dev, int err,
+			     void *priv)
+{
+	struct sf_job *job = priv;
+
+	if (!err)
+		strcpy(job->res.aux_dev, dev);
+	sf_step_done(job, MLXDEVM_SF_STEP_AUX_DEV, job->start_ns);
+	sf_job_next(job->aux_worker, job, job->start_ns, err);
+}
+
+static void *sf_aux_dev_worker(void *arg)
+{
+	struct sf_worker *w = arg;
+	struct sf_provision *p = w->p;
+	struct sf_queue *q = &p->queues[MLXDEVM_SF_STAGE_AUX_DEV];
+	struct sf_job_list incoming;
+	struct timespec deadline;
+	struct sf_job *job;
+	bool running;
+	uint64_t ns;
+	int err;
+
+	TAILQ_INIT(&incoming);
+	do {
+		running = sf_queue_take_all(q, &incoming);
+		while ((job = TAILQ_FIRST(&incoming))) {
+			TAILQ_REMOVE(&incoming, job, entry);
+			job->aux_worker = w;
+			job->start_ns = sf_now_ns();
+			ns = job->start_ns + p->aux_dev_timeout_ns;
+			deadline.tv_sec = ns / 1000000000ull;
+			deadline.tv_nsec = ns % 1000000000ull;
+			err = mlxdevm_aux_waiter_add(p->waiter,
+						     job->res.spec->sfnum,
+						     &deadline,
+						     sf_aux_dev_bound, job);
+			if (err)
+				sf_job_next(w, job, job->start_ns, err);
+		}
+		/* Sleeps until a device is bound, a deadline expires or
+		 * jobs are queued.
+		 */
+		if (running)
+			mlxdevm_aux_waiter_dispatch(p->waiter, -1);
+	} while (running);
+	return NULL;
+}
+
+static void sf_provision_init(struct sf_provision *p, struct mlxdevm *dl,
+			      const struct mlxdevm_sf_provision_opts *opts,
+			      const struct mlxdevm_sf_provision_cbs *cbs)
+{
+	unsigned int timeout_ms = SF_AUX_DEV_TIMEOUT_MS;
+	int i;
+
+	for (i = 0; i < MLXDEVM_SF_STAGE_MAX; i++)
+		sf_queue_init(&p->queues[i]);
+	pthread_mutex_init(&p->done_lock, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+
+	p->dev = dl->dev;
+	p->cfg_driver = MLXDEVM_SF_CFG_DRIVER;
+	p->driver = MLXDEVM_SF_DRIVER;
+	if (opts) {
+		if (opts->cfg_driver)
+			p->cfg_driver = opts->cfg_driver;
+		if (opts->driver)
+			p->driver = opts->driver;
+		if (opts->aux_dev_timeout_ms)
+			timeout_ms = opts->aux_dev_timeout_ms;
+		p->wait_attached = opts->wait_attached;
+	}
+	p->aux_dev_timeout_ns = timeout_ms * 1000000ull;
+	p->cbs = cbs;
+}
+
+static void sf_provision_fini(struct sf_provision *p)
+{
+	int i;
+
+	if (p->waiter)
+		mlxdevm_aux_waiter_destroy(p->waiter);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_mutex_destroy(&p->done_lock);
+	for (i = 0; i < MLXDEVM_SF_STAGE_MAX; i++)
+		sf_queue_fini(&p->queues[i]);
+}
+
+static unsigned int
+sf_stage_workers(const struct mlxdevm_sf_provision_opts *opts,
+		 enum mlxdevm_sf_stage stage)
+{
+	if (!opts || stage == MLXDEVM_SF_STAGE_AUX_DEV || !opts->workers[stage])
+		return 1;
+	return opts->workers[stage];
+}
+
+int mlxdevm_sf_provision(struct mlxdevm *dl,
+			 const struct mlxdevm_sf_spec *specs, unsigned int n,
+			 const struct mlxdevm_sf_provision_opts *opts,
+			 const struct mlxdevm_sf_provision_cbs *cbs)
+{
+	unsigned int nworkers = 0;
+	struct sf_worker *workers;
+	struct sf_provision p = {};
+	struct sf_worker *w;
+	struct sf_job *jobs;
+	unsigned int i;
+	int stage;
+	int err;
+
+	if (!n)
+		return 0;
+
+	MLXDEVM_TRACE_ENTRY(0, 0);
+
+	for (stage = 0; stage < MLXDEVM_SF_STAGE_MAX; stage++)
+		nworkers += sf_stage_workers(opts, stage);
+
+	jobs = calloc(n, sizeof(*jobs));
+	if (!jobs) {
+		err = -ENOMEM;
+		goto jobs_err;
+	}
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!workers) {
+		err = -ENOMEM;
+		goto workers_err;
+	}
+
+	sf_provision_init(&p, dl, opts, cbs);
+
+	for (i = 0; i < n; i++)
+		jobs[i].res.spec = &specs[i];
+	/* Wait before any port is added so that no bind event is missed */
+	p.waiter = mlxdevm_aux_waiter_create(dl->dev);
+	if (!p.waiter) {
+		err = errno ? -errno : -ENOMEM;
+		goto start_err;
+	}
+	p.queues[MLXDEVM_SF_STAGE_AUX_DEV].waiter = p.waiter;
+
+	/* Create every socket before any SF is touched, so that the pipeline
+	 * either fails upfront or runs with all of its threads.
+	 */
+	w = workers;
+	for (stage = 0; stage < MLXDEVM_SF_STAGE_MAX; stage++) {
+		for (i = 0; i < sf_stage_workers(opts, stage); i++, w++) {
+			w->p = &p;
+			w->stage = stage;
+			w->dl = mlxdevm_handle_dup(dl);
+			if (!w->dl) {
+				err = errno ? -errno : -ENOMEM;
+				goto start_err;
+			}
+		}
+	}
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		err = -pthread_create(&w->tid, NULL,
+				      w->stage == MLXDEVM_SF_STAGE_AUX_DEV ?
+				      sf_aux_dev_worker : sf_stage_worker, w);
+		if (err)
+			goto start_err;
+		w->started = true;
+	}
+
+	for (i = 0; i < n; i++)
+		sf_queue_push(&p.queues[MLXDEVM_SF_STAGE_PORT], &jobs[i]);
+
+	pthread_mutex_lock(&p.done_lock);
+	while (p.done < n)
+		pthread_cond_wait(&p.done_cond, &p.done_lock);
+	pthread_mutex_unlock(&p.done_lock);
+	err = p.provisioned;
+
+start_err:
+	for (stage = 0; stage < MLXDEVM_SF_STAGE_MAX; stage++)
+		sf_queue_stop(&p.queues[stage]);
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		if (w->started)
+			pthread_join(w->tid, NULL);
+		if (w->dl)
+			mlxdevm_close(w->dl);
+	}
+
+	if (opts && opts->stats && err >= 0) {
+		memset(opts->stats, 0,
+		       MLXDEVM_SF_STAGE_MAX * sizeof(*opts->stats));
+		for (i = 0; i < nworkers; i++)
+			sf_stats_merge(&opts->stats[workers[i].stage],
+				       &workers[i].stats);
+	}
+	sf_provision_fini(&p);
+	free(workers);
+workers_err:
+	free(jobs);
+jobs_err:
+	MLXDEVM_TRACE_EXIT(0, 0, err);
+	return err;
+}
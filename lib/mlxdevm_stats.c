@@ -0,0 +1,310 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "mlxdevm.h"
+#include "mlxdevm_priv.h"
+
+/* Command counters of one thread or one handle.
+ *
+ * A block is only written by the thread owning it, so counters are
+ * updated with plain loads and stores; readers on other threads use
+ * relaxed atomic loads. A reset only bumps a generation number: the
+ * owner clears its block on its next command and readers skip blocks
+ * of an older generation meanwhile.
+ */
+struct mlxdevm_stats_block {
+	unsigned long gen;
+	struct mlxdevm_cmd_stats *cmds[MLXDEVM_STATS_CMD_MAX + 1];
+};
+
+struct stats_thread {
+	struct mlxdevm_stats_block b;
+	TAILQ_ENTRY(stats_thread) entry;
+};
+
+#define STATS_LOAD(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STATS_STORE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define STATS_ADD(x, v)		STATS_STORE(x, STATS_LOAD(x) + (v))
+
+static unsigned long stats_gen;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static TAILQ_HEAD(, stats_thread) stats_threads =
+	TAILQ_HEAD_INITIALIZER(stats_threads);
+/* Counters of the threads which exited, under stats_lock */
+static struct mlxdevm_stats_block stats_retired;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static bool stats_key_valid;
+static __thread struct stats_thread *stats_self;
+
+static unsigned int stats_hist_bucket(uint64_t ns)
+{
+	unsigned int bucket;
+
+	if (ns < (1ull << MLXDEVM_STATS_HIST_SHIFT))
+		return 0;
+	bucket = 64 - __builtin_clzll(ns) - MLXDEVM_STATS_HIST_SHIFT;
+	return bucket < MLXDEVM_STATS_HIST_BUCKETS ?
+	       bucket : MLXDEVM_STATS_HIST_BUCKETS - 1;
+}
+
+static void cmd_stats_record(struct mlxdevm_cmd_stats *c, int err,
+			     uint64_t ns, uint64_t tx_bytes, uint64_t rx_bytes)
+{
+	STATS_ADD(c->count, 1);
+	if (err)
+		STATS_ADD(c->errors, 1);
+	STATS_ADD(c->tx_bytes, tx_bytes);
+	STATS_ADD(c->rx_bytes, rx_bytes);
+	STATS_ADD(c->total_ns, ns);
+	if (STATS_LOAD(c->count) == 1 || ns < STATS_LOAD(c->min_ns))
+		STATS_STORE(c->min_ns, ns);
+	if (ns > STATS_LOAD(c->max_ns))
+		STATS_STORE(c->max_ns, ns);
+	STATS_ADD(c->hist[stats_hist_bucket(ns)], 1);
+}
+
+static void stats_block_clear(struct mlxdevm_stats_block *b, unsigned long gen)
+{
+	unsigned int i;
+
+	for (i = 0; i <= MLXDEVM_STATS_CMD_MAX; i++) {
+		if (b->cmds[i])
+			memset(b->cmds[i], 0, sizeof(*b->cmds[i]));
+	}
+	__atomic_store_n(&b->gen, gen, __ATOMIC_RELEASE);
+}
+
+static struct mlxdevm_cmd_stats *stats_block_cmd(struct mlxdevm_stats_block *b,
+						 uint8_t cmd)
+{
+	struct mlxdevm_cmd_stats *c = b->cmds[cmd];
+
+	if (c)
+		return c;
+	c = calloc(1, sizeof(*c));
+	if (c)
+		__atomic_store_n(&b->cmds[cmd], c, __ATOMIC_RELEASE);
+	return c;
+}
+
+static void stats_block_record(struct mlxdevm_stats_block *b, unsigned long gen,
+			       uint8_t cmd, int err, uint64_t ns,
+			       uint64_t tx_bytes, uint64_t rx_bytes)
+{
+	struct mlxdevm_cmd_stats *c;
+
+	if (b->gen != gen)
+		stats_block_clear(b, gen);
+	c = stats_block_cmd(b, cmd);
+	if (c)
+		cmd_stats_record(c, err, ns, tx_bytes, rx_bytes);
+}
+
+static void cmd_stats_add(struct mlxdevm_cmd_stats *to,
+			  const struct mlxdevm_cmd_stats *from)
+{
+	uint64_t count = STATS_LOAD(from->count);
+	uint64_t min_ns = STATS_LOAD(from->min_ns);
+	uint64_t max_ns = STATS_LOAD(from->max_ns);
+	unsigned int i;
+
+	if (!count)
+		return;
+	if (!to->count || min_ns < to->min_ns)
+		to->min_ns = min_ns;
+	if (max_ns > to->max_ns)
+		to->max_ns = max_ns;
+	to->count += count;
+	to->errors += STATS_LOAD(from->errors);
+	to->tx_bytes += STATS_LOAD(from->tx_bytes);
+	to->rx_bytes += STATS_LOAD(from->rx_bytes);
+	to->total_ns += STATS_LOAD(from->total_ns);
+	for (i = 0; i < MLXDEVM_STATS_HIST_BUCKETS; i++)
+		to->hist[i] += STATS_LOAD(from->hist[i]);
+}
+
+/* Counters of a block being cleared by its owner are left out */
+static void stats_block_add(struct mlxdevm_stats *stats,
+			    const struct mlxdevm_stats_block *b,
+			    unsigned long gen)
+{
+	struct mlxdevm_cmd_stats *c;
+	unsigned int i;
+
+	if (__atomic_load_n(&b->gen, __ATOMIC_ACQUIRE) != gen)
+		return;
+	for (i = 0; i <= MLXDEVM_STATS_CMD_MAX; i++) {
+		c = __atomic_load_n(&b->cmds[i], __ATOMIC_ACQUIRE);
+		if (c)
+			cmd_stats_add(&stats->cmds[i], c);
+	}
+}
+
+static void stats_block_free(struct mlxdevm_stats_block *b)
+{
+	unsigned int i;
+
+	for (i = 0; i <= MLXDEVM_STATS_CMD_MAX; i++)
+		free(b->cmds[i]);
+}
+
+/* Fold the counters of an exiting thread into stats_retired */
+static void stats_thread_exit(void *data)
+{
+	struct stats_thread *t = data;
+	unsigned long gen;
+	unsigned int i;
+
+	pthread_mutex_lock(&stats_lock);
+	TAILQ_REMOVE(&stats_threads, t, entry);
+	gen = __atomic_load_n(&stats_gen, __ATOMIC_ACQUIRE);
+	if (stats_retired.gen != gen)
+		stats_block_clear(&stats_retired, gen);
+	if (t->b.gen == gen) {
+		for (i = 0; i <= MLXDEVM_STATS_CMD_MAX; i++) {
+			if (t->b.cmds[i] && stats_block_cmd(&stats_retired, i))
+				cmd_stats_add(stats_retired.cmds[i],
+					      t->b.cmds[i]);
+		}
+	}
+	pthread_mutex_unlock(&stats_lock);
+
+	stats_self = NULL;
+	stats_block_free(&t->b);
+	free(t);
+}
+
+static void stats_key_init(void)
+{
+	stats_key_valid = !pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+static struct stats_thread *stats_thread_get(void)
+{
+	struct stats_thread *t;
+
+	if (stats_self)
+		return stats_self;
+
+	pthread_once(&stats_once, stats_key_init);
+	if (!stats_key_valid)
+		return NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->b.gen = __atomic_load_n(&stats_gen, __ATOMIC_ACQUIRE);
+	if (pthread_setspecific(stats_key, t)) {
+		free(t);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	TAILQ_INSERT_TAIL(&stats_threads, t, entry);
+	pthread_mutex_unlock(&stats_lock);
+	stats_self = t;
+	return t;
+}
+
+static uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int mlxdevm_cmd_sndrcv(struct mlxdevm *dl, const struct nlmsghdr *nlh,
+		       mnl_cb_t data_cb, void *data)
+{
+	const struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	uint64_t rx_bytes = dl->nls->rx_bytes;
+	/* The reply is received in the buffer of the request */
+	uint64_t tx_bytes = nlh->nlmsg_len;
+	uint8_t cmd = genl->cmd;
+	struct stats_thread *t;
+	struct mlxdevm_stats_block *b;
+	uint64_t start_ns;
+	uint64_t ns;
+	int err;
+
+	start_ns = stats_now_ns();
+	err = netlink_socket_sndrcv(dl->nls, nlh, data_cb, data);
+	ns = stats_now_ns() - start_ns;
+	rx_bytes = dl->nls->rx_bytes - rx_bytes;
+
+	if (!dl->stats) {
+		b = calloc(1, sizeof(*b));
+		if (b) {
+			b->gen = __atomic_load_n(&dl->stats_gen,
+						 __ATOMIC_ACQUIRE);
+			__atomic_store_n(&dl->stats, b, __ATOMIC_RELEASE);
+		}
+	}
+	if (dl->stats)
+		stats_block_record(dl->stats,
+				   __atomic_load_n(&dl->stats_gen,
+						   __ATOMIC_ACQUIRE),
+				   cmd, err, ns, tx_bytes, rx_bytes);
+
+	t = stats_thread_get();
+	if (t)
+		stats_block_record(&t->b,
+				   __atomic_load_n(&stats_gen, __ATOMIC_ACQUIRE),
+				   cmd, err, ns, tx_bytes, rx_bytes);
+	return err;
+}
+
+void mlxdevm_stats_get(struct mlxdevm *dl, struct mlxdevm_stats *stats)
+{
+	struct mlxdevm_stats_block *b;
+	struct stats_thread *t;
+	unsigned long gen;
+
+	memset(stats, 0, sizeof(*stats));
+	if (dl) {
+		b = __atomic_load_n(&dl->stats, __ATOMIC_ACQUIRE);
+		if (b)
+			stats_block_add(stats, b,
+					__atomic_load_n(&dl->stats_gen,
+							__ATOMIC_ACQUIRE));
+		return;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	gen = __atomic_load_n(&stats_gen, __ATOMIC_ACQUIRE);
+	stats_block_add(stats, &stats_retired, gen);
+	TAILQ_FOREACH(t, &stats_threads, entry)
+		stats_block_add(stats, &t->b, gen);
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void mlxdevm_stats_reset(struct mlxdevm *dl)
+{
+	if (dl)
+		__atomic_add_fetch(&dl->stats_gen, 1, __ATOMIC_RELEASE);
+	else
+		__atomic_add_fetch(&stats_gen, 1, __ATOMIC_RELEASE);
+}
+
+void mlxdevm_stats_destroy(struct mlxdevm *dl)
+{
+	if (!dl->stats)
+		return;
+	stats_block_free(dl->stats);
+	free(dl->stats);
+}
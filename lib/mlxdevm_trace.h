@@ -0,0 +1,65 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#ifndef _MLXDEVM_TRACE_H_
+#define _MLXDEVM_TRACE_H_
+
+/* Static probes of provider mlxdevm, usable from perf, bpftrace or
+ * SystemTap, for example:
+ *
+ *   bpftrace -e 'usdt:libmlxdevm.so:mlxdevm:nl_send { @[arg0] = count(); }'
+ *
+ * nl_send(cmd, seq, len)		request sent by netlink_socket_sndrcv()
+ * nl_reply(seq, len)			first reply datagram of a request
+ * nl_ack(seq, err)			ACK, error or end of dump
+ * parse_port(cmd, port_index, sfnum)	port message decoded
+ * parse_param(cmd, name)		parameter message decoded
+ * opstate_wait(port_index, sfnum, iteration, opstate)
+ *					port state polled while waiting
+ * ports_opstate_wait(iteration, pending)
+ *					ports dumped while waiting
+ * aux_wait_done(sfnum, err)		auxiliary device wait completed
+ * sf_stage(stage, sfnum, ns, err)	provisioning stage of a SF done
+ * api_entry(func, port_index, sfnum)	public call entered
+ * api_exit(func, port_index, sfnum, err)
+ *					public call returns @err
+ *
+ * A probe is a single nop until a tracer attaches to it. Without
+ * <sys/sdt.h>, or when built with -DMLXDEVM_NO_SDT, probes compile to
+ * nothing and their arguments are not evaluated.
+ */
+
+#if !defined(MLXDEVM_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MLXDEVM_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef MLXDEVM_HAVE_SDT
+#define MLXDEVM_TRACE(name, ...)	STAP_PROBEV(mlxdevm, name, ##__VA_ARGS__)
+#else
+static inline void mlxdevm_trace_nop(int unused, ...)
+{
+}
+
+/* Arguments are only referenced, not evaluated */
+#define MLXDEVM_TRACE(name, ...) \
+	do { if (0) mlxdevm_trace_nop(0, ##__VA_ARGS__); } while (0)
+#endif
+
+#define MLXDEVM_TRACE_ENTRY(port_index, sfnum) \
+	MLXDEVM_TRACE(api_entry, (const char *)__func__, port_index, sfnum)
+#define MLXDEVM_TRACE_EXIT(port_index, sfnum, err) \
+	MLXDEVM_TRACE(api_exit, (const char *)__func__, port_index, sfnum, err)
+
+#endif /* _MLXDEVM_TRACE_H_ */
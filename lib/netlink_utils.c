@@ -14,10 +14,12 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <libmnl/libmnl.h>
 #include <linux/genetlink.h>
 
 #include "netlink_utils.h"
+#include "mlxdevm_trace.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -143,8 +145,60 @@ err_bind:
 	return NULL;
 }
 
+static void *kernel_transport_open(void *priv)
+{
+	return _netlink_socket_open();
+}
+
+static void kernel_transport_close(void *sk)
+{
+	mnl_socket_close(sk);
+}
+
+static ssize_t kernel_transport_sendto(void *sk, const void *buf, size_t len)
+{
+	return mnl_socket_sendto(sk, buf, len);
+}
+
+static ssize_t kernel_transport_recvfrom(void *sk, void *buf, size_t len,
+					 int flags)
+{
+	if (!flags)
+		return mnl_socket_recvfrom(sk, buf, len);
+	return recv(mnl_socket_get_fd(sk), buf, len, flags);
+}
+
+static unsigned int kernel_transport_portid(void *sk)
+{
+	return mnl_socket_get_portid(sk);
+}
+
+static int kernel_transport_fd(void *sk)
+{
+	return mnl_socket_get_fd(sk);
+}
+
+static const struct netlink_transport netlink_kernel_transport = {
+	.open = kernel_transport_open,
+	.close = kernel_transport_close,
+	.sendto = kernel_transport_sendto,
+	.recvfrom = kernel_transport_recvfrom,
+	.portid = kernel_transport_portid,
+	.fd = kernel_transport_fd,
+};
+
+static const struct netlink_transport *netlink_transport =
+	&netlink_kernel_transport;
+
+void netlink_transport_set(const struct netlink_transport *tp)
+{
+	__atomic_store_n(&netlink_transport, tp ? tp : &netlink_kernel_transport,
+			 __ATOMIC_RELEASE);
+}
+
 struct nlmsghdr *netlink_msg_prepare(void *buf, uint32_t nlmsg_type, uint16_t flags,
-				  void *extra_header, size_t extra_header_size)
+				     unsigned int seq,
+				     void *extra_header, size_t extra_header_size)
 {
 	struct nlmsghdr *nlh;
 	void *eh;
@@ -152,13 +206,20 @@ struct nlmsghdr *netlink_msg_prepare(void *buf, uint32_t nlmsg_type, uint16_t fl
 	nlh = mnl_nlmsg_put_header(buf);
 	nlh->nlmsg_type = nlmsg_type;
 	nlh->nlmsg_flags = flags;
-	nlh->nlmsg_seq = time(NULL);
+	nlh->nlmsg_seq = seq;
 
 	eh = mnl_nlmsg_put_extra_header(nlh, extra_header_size);
 	memcpy(eh, extra_header, extra_header_size);
 	return nlh;
 }
 
+static inline uint8_t netlink_msg_cmd(const struct nlmsghdr *nlh)
+{
+	const struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+
+	return genl->cmd;
+}
+
 static int noop_cb(const struct nlmsghdr *nlh, void *data)
 {
 	return MNL_CB_OK;
@@ -168,6 +229,8 @@ static int error_cb(const struct nlmsghdr *nlh, void *data)
 {
 	const struct nlmsgerr *err = mnl_nlmsg_get_payload(nlh);
 
+	MLXDEVM_TRACE(nl_ack, nlh->nlmsg_seq, err->error);
+
 	/* Netlink may return the errno value with different signess */
 	if (err->error < 0)
 		errno = -err->error;
@@ -184,6 +247,7 @@ static int stop_cb(const struct nlmsghdr *nlh, void *data)
 {
 	int len = *(int *)NLMSG_DATA(nlh);
 
+	MLXDEVM_TRACE(nl_ack, nlh->nlmsg_seq, len);
 	if (len < 0) {
 		errno = -len;
 		netlink_ext_ack_dump_done(nlh, len);
@@ -199,17 +263,24 @@ static mnl_cb_t mnlu_cb_array[NLMSG_MIN_TYPE] = {
 	[NLMSG_OVERRUN]	= noop_cb,
 };
 
-int netlink_socket_recv_run(struct mnl_socket *nl, unsigned int seq, void *buf,
-			    size_t buf_size,
-			    mnl_cb_t cb, void *data)
+static int netlink_recv_run(const struct netlink_transport *tp, void *sk,
+			    unsigned int seq, void *buf, size_t buf_size,
+			    mnl_cb_t cb, void *data, uint64_t *rx_bytes)
 {
-	unsigned int portid = mnl_socket_get_portid(nl);
+	unsigned int portid = tp->portid(sk);
+	bool first = true;
 	int err;
 
 	do {
-		err = mnl_socket_recvfrom(nl, buf, buf_size);
+		err = tp->recvfrom(sk, buf, buf_size, 0);
 		if (err <= 0)
 			break;
+		if (first) {
+			MLXDEVM_TRACE(nl_reply, seq, err);
+			first = false;
+		}
+		if (rx_bytes)
+			*rx_bytes += err;
 		err = mnl_cb_run2(buf, err, seq, portid,
 				  cb, data, mnlu_cb_array,
 				  ARRAY_SIZE(mnlu_cb_array));
@@ -218,6 +289,14 @@ int netlink_socket_recv_run(struct mnl_socket *nl, unsigned int seq, void *buf,
 	return err;
 }
 
+int netlink_socket_recv_run(struct mnl_socket *nl, unsigned int seq, void *buf,
+			    size_t buf_size,
+			    mnl_cb_t cb, void *data)
+{
+	return netlink_recv_run(&netlink_kernel_transport, nl, seq, buf,
+				buf_size, cb, data, NULL);
+}
+
 static int get_family_id_attr_cb(const struct nlattr *attr, void *data)
 {
 	int type = mnl_attr_get_type(attr);
@@ -229,20 +308,68 @@ static int get_family_id_attr_cb(const struct nlattr *attr, void *data)
 	if (type == CTRL_ATTR_FAMILY_ID &&
 	    mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
 		return MNL_CB_ERROR;
+	if (type == CTRL_ATTR_MCAST_GROUPS &&
+	    mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+		return MNL_CB_ERROR;
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+static int get_mcgrp_attr_cb(const struct nlattr *attr, void *data)
+{
+	int type = mnl_attr_get_type(attr);
+	const struct nlattr **tb = data;
+
+	if (mnl_attr_type_valid(attr, CTRL_ATTR_MCAST_GRP_MAX) < 0)
+		return MNL_CB_OK;
+
+	if (type == CTRL_ATTR_MCAST_GRP_NAME &&
+	    mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
+		return MNL_CB_ERROR;
+	if (type == CTRL_ATTR_MCAST_GRP_ID &&
+	    mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+		return MNL_CB_ERROR;
 	tb[type] = attr;
 	return MNL_CB_OK;
 }
 
+static void get_family_mcgrps(struct netlink_socket *nls,
+			      const struct nlattr *groups)
+{
+	const struct nlattr *pos;
+
+	nls->num_mcgrps = 0;
+	mnl_attr_for_each_nested(pos, groups) {
+		struct nlattr *tb[CTRL_ATTR_MCAST_GRP_MAX + 1] = {};
+		struct netlink_mcgrp *grp;
+
+		if (nls->num_mcgrps == NETLINK_MCGRP_MAX)
+			break;
+		if (mnl_attr_parse_nested(pos, get_mcgrp_attr_cb, tb) != MNL_CB_OK)
+			continue;
+		if (!tb[CTRL_ATTR_MCAST_GRP_NAME] || !tb[CTRL_ATTR_MCAST_GRP_ID])
+			continue;
+
+		grp = &nls->mcgrps[nls->num_mcgrps++];
+		strncpy(grp->name, mnl_attr_get_str(tb[CTRL_ATTR_MCAST_GRP_NAME]),
+			sizeof(grp->name) - 1);
+		grp->name[sizeof(grp->name) - 1] = '\0';
+		grp->id = mnl_attr_get_u32(tb[CTRL_ATTR_MCAST_GRP_ID]);
+	}
+}
+
 static int get_family_id_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct nlattr *tb[CTRL_ATTR_MAX + 1] = {};
-	uint32_t *p_id = data;
+	struct netlink_socket *nls = data;
 
 	mnl_attr_parse(nlh, sizeof(*genl), get_family_id_attr_cb, tb);
 	if (!tb[CTRL_ATTR_FAMILY_ID])
 		return MNL_CB_ERROR;
-	*p_id = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	nls->family = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	if (tb[CTRL_ATTR_MCAST_GROUPS])
+		get_family_mcgrps(nls, tb[CTRL_ATTR_MCAST_GROUPS]);
 	return MNL_CB_OK;
 }
 
@@ -256,80 +383,322 @@ static int family_get(struct netlink_socket *nls, const char *family_name)
 	hdr.version = 0x1;
 
 	nlh = netlink_msg_prepare(nls->buf, GENL_ID_CTRL,
-				  NLM_F_REQUEST | NLM_F_ACK,
+				  NLM_F_REQUEST | NLM_F_ACK, ++nls->seq,
 				  &hdr, sizeof(hdr));
 
 	mnl_attr_put_strz(nlh, CTRL_ATTR_FAMILY_NAME, family_name);
 
-	err = mnl_socket_sendto(nls->nl, nlh, nlh->nlmsg_len);
+	err = nls->tp->sendto(nls->sk, nlh, nlh->nlmsg_len);
 	if (err < 0)
 		return err;
 
-	err = netlink_socket_recv_run(nls->nl, nlh->nlmsg_seq, nls->buf,
-				   MNL_SOCKET_BUFFER_SIZE,
-				   get_family_id_cb, &nls->family);
+	err = netlink_recv_run(nls->tp, nls->sk, nlh->nlmsg_seq, nls->buf,
+			       MNL_SOCKET_BUFFER_SIZE,
+			       get_family_id_cb, nls, NULL);
 	return err;
 }
 
+/* The controller sends family notifications to its own id as group */
+#define NETLINK_CTRL_NOTIFY_GRP	GENL_ID_CTRL
+#define NETLINK_FAMILY_CACHE_MAX	8
+
+struct netlink_family_ent {
+	char name[GENL_NAMSIZ];
+	uint32_t id;
+	struct netlink_mcgrp mcgrps[NETLINK_MCGRP_MAX];
+	unsigned int num_mcgrps;
+};
+
+/* Family ids resolved by this process. An entry is dropped when the
+ * controller notifies that its family was unregistered or registered
+ * again; nothing is cached when notifications can't be received.
+ */
+static struct {
+	pthread_mutex_t lock;
+	struct mnl_socket *ntf;
+	char *buf;
+	bool unsupported;
+	struct netlink_family_ent ents[NETLINK_FAMILY_CACHE_MAX];
+	unsigned int num;
+	/* Bumped by every family notification and by lost notifications */
+	unsigned long gen;
+} family_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct netlink_family_ent *family_cache_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < family_cache.num; i++) {
+		if (!strcmp(family_cache.ents[i].name, name))
+			return &family_cache.ents[i];
+	}
+	return NULL;
+}
+
+static int family_ntf_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[CTRL_ATTR_MAX + 1] = {};
+	struct netlink_family_ent *ent;
+
+	if (genl->cmd != CTRL_CMD_NEWFAMILY && genl->cmd != CTRL_CMD_DELFAMILY)
+		return MNL_CB_OK;
+
+	mnl_attr_parse(nlh, sizeof(*genl), get_family_id_attr_cb, tb);
+	if (!tb[CTRL_ATTR_FAMILY_NAME])
+		return MNL_CB_OK;
+
+	family_cache.gen++;
+	ent = family_cache_find(mnl_attr_get_str(tb[CTRL_ATTR_FAMILY_NAME]));
+	if (ent)
+		*ent = family_cache.ents[--family_cache.num];
+	return MNL_CB_OK;
+}
+
+/* Apply pending controller notifications; called with the lock held */
+static void family_cache_sync(void)
+{
+	int len;
+
+	while (1) {
+		len = recv(mnl_socket_get_fd(family_cache.ntf), family_cache.buf,
+			   MNL_SOCKET_BUFFER_SIZE, MSG_DONTWAIT);
+		if (len < 0) {
+			/* Notifications were lost, nothing can be trusted */
+			if (errno == ENOBUFS) {
+				family_cache.num = 0;
+				family_cache.gen++;
+			}
+			if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR)
+				return;
+			break;
+		}
+		mnl_cb_run(family_cache.buf, len, 0, 0, family_ntf_cb, NULL);
+	}
+
+	/* The notification socket is broken, stop caching */
+	mnl_socket_close(family_cache.ntf);
+	family_cache.ntf = NULL;
+	family_cache.unsupported = true;
+	family_cache.num = 0;
+}
+
+static bool family_cache_get(struct netlink_socket *nls, const char *name)
+{
+	struct netlink_family_ent *ent;
+
+	pthread_mutex_lock(&family_cache.lock);
+	if (family_cache.ntf)
+		family_cache_sync();
+	ent = family_cache_find(name);
+	if (ent) {
+		nls->family = ent->id;
+		memcpy(nls->mcgrps, ent->mcgrps, sizeof(nls->mcgrps));
+		nls->num_mcgrps = ent->num_mcgrps;
+	}
+	pthread_mutex_unlock(&family_cache.lock);
+	return ent;
+}
+
+/* Subscribe to the controller notifications before resolving a family, so
+ * that a re-registration racing with the lookup is not missed; @gen is the
+ * notification generation the lookup starts from.
+ */
+static bool family_cache_prepare(unsigned long *gen)
+{
+	bool ready;
+
+	pthread_mutex_lock(&family_cache.lock);
+	if (!family_cache.ntf && !family_cache.unsupported) {
+		family_cache.buf = malloc(MNL_SOCKET_BUFFER_SIZE);
+		if (family_cache.buf)
+			family_cache.ntf =
+				netlink_mcgrp_socket_open(NETLINK_CTRL_NOTIFY_GRP);
+		if (!family_cache.ntf) {
+			free(family_cache.buf);
+			family_cache.buf = NULL;
+			family_cache.unsupported = true;
+		}
+	}
+	if (family_cache.ntf)
+		family_cache_sync();
+	*gen = family_cache.gen;
+	ready = family_cache.ntf;
+	pthread_mutex_unlock(&family_cache.lock);
+	return ready;
+}
+
+static void family_cache_put(const struct netlink_socket *nls,
+			     const char *name, unsigned long gen)
+{
+	struct netlink_family_ent *ent;
+
+	if (strlen(name) >= GENL_NAMSIZ)
+		return;
+
+	pthread_mutex_lock(&family_cache.lock);
+	if (!family_cache.ntf)
+		goto out;
+	/* Don't cache the lookup if a notification arrived since it started */
+	family_cache_sync();
+	if (!family_cache.ntf || family_cache.gen != gen ||
+	    family_cache_find(name) ||
+	    family_cache.num == NETLINK_FAMILY_CACHE_MAX)
+		goto out;
+
+	ent = &family_cache.ents[family_cache.num++];
+	strcpy(ent->name, name);
+	ent->id = nls->family;
+	memcpy(ent->mcgrps, nls->mcgrps, sizeof(ent->mcgrps));
+	ent->num_mcgrps = nls->num_mcgrps;
+out:
+	pthread_mutex_unlock(&family_cache.lock);
+}
+
+/* Sequence space is per socket; start it at an arbitrary point so replies
+ * to a previous user of the same port id are not matched.
+ */
+static unsigned int netlink_seq_seed(void)
+{
+	return time(NULL);
+}
+
 int netlink_socket_open(struct netlink_socket *nls, const char *family_name,
 			uint8_t version)
 {
+	unsigned long gen;
+	bool cacheable;
+	bool kernel;
 	int err;
 
 	nls->buf = malloc(MNL_SOCKET_BUFFER_SIZE);
 	if (!nls->buf)
 		goto err_buf_alloc;
 
-	nls->nl = _netlink_socket_open();
-	if (!nls->nl)
+	nls->tp = __atomic_load_n(&netlink_transport, __ATOMIC_ACQUIRE);
+	nls->sk = nls->tp->open(nls->tp->priv);
+	if (!nls->sk)
 		goto err_socket_open;
 
+	nls->seq = netlink_seq_seed();
+	nls->rx_bytes = 0;
+
+	/* Only families of the kernel are cached */
+	kernel = nls->tp == &netlink_kernel_transport;
+	if (kernel && family_cache_get(nls, family_name))
+		return 0;
+
+	cacheable = kernel && family_cache_prepare(&gen);
 	err = family_get(nls, family_name);
 	if (err)
 		goto err_socket;
+	if (cacheable)
+		family_cache_put(nls, family_name, gen);
 
 	return 0;
 
 err_socket:
-	mnl_socket_close(nls->nl);
+	nls->tp->close(nls->sk);
 err_socket_open:
 	free(nls->buf);
 err_buf_alloc:
 	return -1;
 }
 
+int netlink_socket_mcgrp_get(const struct netlink_socket *nls,
+			     const char *name, uint32_t *id)
+{
+	unsigned int i;
+
+	for (i = 0; i < nls->num_mcgrps; i++) {
+		if (!strcmp(nls->mcgrps[i].name, name)) {
+			*id = nls->mcgrps[i].id;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+struct mnl_socket *netlink_mcgrp_socket_open(uint32_t group)
+{
+	struct mnl_socket *nl;
+
+	nl = mnl_socket_open(NETLINK_GENERIC);
+	if (nl == NULL)
+		return NULL;
+
+	if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0)
+		goto err;
+
+	if (mnl_socket_setsockopt(nl, NETLINK_ADD_MEMBERSHIP, &group,
+				  sizeof(group)) < 0)
+		goto err;
+
+	return nl;
+
+err:
+	mnl_socket_close(nl);
+	return NULL;
+}
+
+int netlink_socket_dup(struct netlink_socket *nls,
+		       const struct netlink_socket *src)
+{
+	nls->buf = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (!nls->buf)
+		return -ENOMEM;
+
+	nls->tp = src->tp;
+	nls->sk = nls->tp->open(nls->tp->priv);
+	if (!nls->sk) {
+		free(nls->buf);
+		return -errno;
+	}
+
+	nls->family = src->family;
+	nls->version = src->version;
+	nls->seq = netlink_seq_seed();
+	nls->rx_bytes = 0;
+	memcpy(nls->mcgrps, src->mcgrps, sizeof(nls->mcgrps));
+	nls->num_mcgrps = src->num_mcgrps;
+	return 0;
+}
+
 void netlink_socket_close(struct netlink_socket *nls)
 {
-	mnl_socket_close(nls->nl);
+	nls->tp->close(nls->sk);
 	free(nls->buf);
 }
 
+int netlink_socket_get_fd(const struct netlink_socket *nls)
+{
+	return nls->tp->fd(nls->sk);
+}
+
 struct nlmsghdr *
 _netlink_socket_cmd_prepare(struct netlink_socket *nls,
 			    uint8_t cmd, uint16_t flags,
 			    uint32_t id, uint8_t version)
 {
 	struct genlmsghdr hdr = {};
-	struct nlmsghdr *nlh;
 
 	hdr.cmd = cmd;
 	hdr.version = version;
-	nlh = netlink_msg_prepare(nls->buf, id, flags, &hdr, sizeof(hdr));
-	nls->seq = nlh->nlmsg_seq;
-	return nlh;
+	return netlink_msg_prepare(nls->buf, id, flags, ++nls->seq,
+				   &hdr, sizeof(hdr));
 }
 
 struct nlmsghdr *netlink_socket_cmd_prepare(struct netlink_socket *nls,
 					    uint8_t cmd, uint16_t flags)
 {
 	struct genlmsghdr hdr = {};
-	struct nlmsghdr *nlh;
 
 	hdr.cmd = cmd;
 	hdr.version = nls->version;
-	nlh = netlink_msg_prepare(nls->buf, nls->family, flags, &hdr, sizeof(hdr));
-	nls->seq = nlh->nlmsg_seq;
-	return nlh;
+	return netlink_msg_prepare(nls->buf, nls->family, flags, ++nls->seq,
+				   &hdr, sizeof(hdr));
 }
 
 int netlink_socket_sndrcv(struct netlink_socket *nls, const struct nlmsghdr *nlh,
@@ -337,18 +706,360 @@ int netlink_socket_sndrcv(struct netlink_socket *nls, const struct nlmsghdr *nlh
 {
 	int err;
 
-	err = mnl_socket_sendto(nls->nl, nlh, nlh->nlmsg_len);
+	MLXDEVM_TRACE(nl_send, netlink_msg_cmd(nlh), nlh->nlmsg_seq,
+		      nlh->nlmsg_len);
+	err = nls->tp->sendto(nls->sk, nlh, nlh->nlmsg_len);
 	if (err < 0) {
 		perror("Failed to send data");
 		return -errno;
 	}
 
-	err = netlink_socket_recv_run(nls->nl, nlh->nlmsg_seq, nls->buf,
-				      MNL_SOCKET_BUFFER_SIZE,
-				      data_cb, data);
+	err = netlink_recv_run(nls->tp, nls->sk, nlh->nlmsg_seq, nls->buf,
+			       MNL_SOCKET_BUFFER_SIZE,
+			       data_cb, data, &nls->rx_bytes);
 	if (err < 0) {
 		fprintf(stderr, "kernel answers: %s\n", strerror(errno));
 		return -errno;
 	}
 	return 0;
 }
+
+int netlink_batch_init(struct netlink_batch *nb, struct netlink_socket *nls,
+		       unsigned int depth)
+{
+	if (!depth)
+		depth = NETLINK_BATCH_DEPTH;
+
+	nb->buf = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (!nb->buf)
+		return -ENOMEM;
+
+	nb->reqs = calloc(depth, sizeof(*nb->reqs));
+	if (!nb->reqs) {
+		free(nb->buf);
+		return -ENOMEM;
+	}
+
+	nb->nls = nls;
+	nb->depth = depth;
+	nb->queued = 0;
+	nb->len = 0;
+	nb->dump_queued = false;
+	return 0;
+}
+
+void netlink_batch_fini(struct netlink_batch *nb)
+{
+	netlink_batch_flush(nb);
+	free(nb->reqs);
+	free(nb->buf);
+}
+
+struct nlmsghdr *netlink_batch_cmd_prepare(struct netlink_batch *nb,
+					   uint8_t cmd, uint16_t flags)
+{
+	struct netlink_socket *nls = nb->nls;
+	struct genlmsghdr hdr = {};
+	int err;
+
+	/* The kernel would fail the second dump with EBUSY once the batch is
+	 * sent; refuse it before anything is queued.
+	 */
+	if ((flags & NLM_F_DUMP) == NLM_F_DUMP && nb->dump_queued) {
+		errno = EBUSY;
+		return NULL;
+	}
+
+	/* Make room for one more request; errors of the flushed requests
+	 * are reported through their own completion callbacks.
+	 */
+	if (nb->queued == nb->depth ||
+	    MNL_SOCKET_BUFFER_SIZE - nb->len < NETLINK_BATCH_MSG_MAX) {
+		err = netlink_batch_flush(nb);
+		if (err) {
+			errno = -err;
+			return NULL;
+		}
+	}
+
+	hdr.cmd = cmd;
+	hdr.version = nls->version;
+	return netlink_msg_prepare(nb->buf + nb->len, nls->family,
+				   flags | NLM_F_ACK, ++nls->seq,
+				   &hdr, sizeof(hdr));
+}
+
+int netlink_batch_queue(struct netlink_batch *nb, const struct nlmsghdr *nlh,
+			mnl_cb_t data_cb, netlink_done_cb_t done_cb, void *data)
+{
+	struct netlink_req *req = &nb->reqs[nb->queued++];
+
+	req->data_cb = data_cb;
+	req->done_cb = done_cb;
+	req->data = data;
+	req->seq = nlh->nlmsg_seq;
+	req->err = 0;
+	req->done = false;
+	nb->len += MNL_ALIGN(nlh->nlmsg_len);
+	if ((nlh->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP)
+		nb->dump_queued = true;
+
+	if (nb->queued == nb->depth)
+		return netlink_batch_flush(nb);
+	return 0;
+}
+
+static struct netlink_req *netlink_batch_req_find(struct netlink_batch *nb,
+						  unsigned int seq)
+{
+	unsigned int i = seq - nb->reqs[0].seq;
+
+	/* Requests of a batch normally occupy consecutive sequence numbers */
+	if (i < nb->queued && nb->reqs[i].seq == seq)
+		return &nb->reqs[i];
+
+	for (i = 0; i < nb->queued; i++) {
+		if (nb->reqs[i].seq == seq)
+			return &nb->reqs[i];
+	}
+	return NULL;
+}
+
+/* Run one reply message through its request. Returns true when the
+ * message completed the request.
+ */
+static bool netlink_req_rcv(struct netlink_req *req, const struct nlmsghdr *nlh,
+			    unsigned int portid)
+{
+	int ret;
+
+	ret = mnl_cb_run2(nlh, nlh->nlmsg_len, req->seq, portid,
+			  req->data_cb, req->data, mnlu_cb_array,
+			  ARRAY_SIZE(mnlu_cb_array));
+	if (ret > 0)
+		return false;
+
+	if (nlh->nlmsg_type >= NLMSG_MIN_TYPE) {
+		/* Data callback gave up; keep the error and drain the rest
+		 * of the reply up to its ACK or DONE.
+		 */
+		if (ret < 0 && !req->err)
+			req->err = -errno;
+		req->data_cb = NULL;
+		return false;
+	}
+
+	if (ret < 0 && !req->err)
+		req->err = -errno;
+	req->done = true;
+	return true;
+}
+
+/* Dispatch every message of a received buffer to the request owning its
+ * sequence number. Returns the number of requests which completed.
+ */
+static unsigned int netlink_batch_rcv(struct netlink_batch *nb,
+				      const void *buf, int len)
+{
+	unsigned int portid = nb->nls->tp->portid(nb->nls->sk);
+	const struct nlmsghdr *nlh = buf;
+	unsigned int completed = 0;
+	struct netlink_req *req;
+
+	for (; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+		req = netlink_batch_req_find(nb, nlh->nlmsg_seq);
+		if (!req || req->done)
+			continue;
+
+		if (netlink_req_rcv(req, nlh, portid))
+			completed++;
+	}
+	return completed;
+}
+
+int netlink_batch_flush(struct netlink_batch *nb)
+{
+	struct netlink_socket *nls = nb->nls;
+	unsigned int pending = nb->queued;
+	struct netlink_req *req;
+	unsigned int i;
+	int err = 0;
+	int len;
+
+	if (!nb->queued)
+		return 0;
+
+	len = nls->tp->sendto(nls->sk, nb->buf, nb->len);
+	if (len < 0) {
+		perror("Failed to send data");
+		err = -errno;
+		goto complete;
+	}
+
+	while (pending) {
+		len = nls->tp->recvfrom(nls->sk, nls->buf,
+					MNL_SOCKET_BUFFER_SIZE, 0);
+		if (len <= 0) {
+			err = len < 0 ? -errno : -EIO;
+			break;
+		}
+		pending -= netlink_batch_rcv(nb, nls->buf, len);
+	}
+
+complete:
+	for (i = 0; i < nb->queued; i++) {
+		req = &nb->reqs[i];
+		if (!req->done)
+			req->err = err;
+		if (req->done_cb)
+			req->done_cb(req->err, req->data);
+	}
+	nb->queued = 0;
+	nb->len = 0;
+	nb->dump_queued = false;
+	return err;
+}
+
+int netlink_async_init(struct netlink_async *na,
+		       const struct netlink_socket *src, unsigned int depth)
+{
+	int err;
+
+	if (!depth)
+		depth = NETLINK_ASYNC_DEPTH;
+
+	na->sndbuf = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (!na->sndbuf)
+		return -ENOMEM;
+
+	na->reqs = calloc(depth, sizeof(*na->reqs));
+	if (!na->reqs) {
+		err = -ENOMEM;
+		goto reqs_err;
+	}
+
+	err = netlink_socket_dup(&na->nls, src);
+	if (err)
+		goto sock_err;
+
+	na->depth = depth;
+	na->inflight = 0;
+	return 0;
+
+sock_err:
+	free(na->reqs);
+reqs_err:
+	free(na->sndbuf);
+	return err;
+}
+
+/* Complete every request in flight with @err. Replies which may still
+ * arrive for them no longer match a busy slot and are dropped.
+ */
+static int netlink_async_fail(struct netlink_async *na, int err)
+{
+	struct netlink_req *req;
+	unsigned int i;
+	int failed = 0;
+
+	for (i = 0; i < na->depth; i++) {
+		req = &na->reqs[i];
+		if (!req->busy)
+			continue;
+		/* Release the slot first, the callback may submit */
+		req->busy = false;
+		na->inflight--;
+		failed++;
+		if (req->done_cb)
+			req->done_cb(err, req->data);
+	}
+	return failed;
+}
+
+void netlink_async_fini(struct netlink_async *na)
+{
+	netlink_async_fail(na, -ECANCELED);
+	netlink_socket_close(&na->nls);
+	free(na->reqs);
+	free(na->sndbuf);
+}
+
+struct nlmsghdr *netlink_async_cmd_prepare(struct netlink_async *na,
+					   uint8_t cmd, uint16_t flags)
+{
+	struct netlink_socket *nls = &na->nls;
+	struct genlmsghdr hdr = {};
+
+	/* The slot of a request is its sequence number modulo the depth */
+	if (na->reqs[(nls->seq + 1) % na->depth].busy) {
+		errno = EBUSY;
+		return NULL;
+	}
+
+	hdr.cmd = cmd;
+	hdr.version = nls->version;
+	return netlink_msg_prepare(na->sndbuf, nls->family, flags | NLM_F_ACK,
+				   ++nls->seq, &hdr, sizeof(hdr));
+}
+
+int netlink_async_submit(struct netlink_async *na, const struct nlmsghdr *nlh,
+			 mnl_cb_t data_cb, netlink_done_cb_t done_cb, void *data)
+{
+	struct netlink_req *req = &na->reqs[nlh->nlmsg_seq % na->depth];
+
+	if (na->nls.tp->sendto(na->nls.sk, nlh, nlh->nlmsg_len) < 0)
+		return -errno;
+
+	req->data_cb = data_cb;
+	req->done_cb = done_cb;
+	req->data = data;
+	req->seq = nlh->nlmsg_seq;
+	req->err = 0;
+	req->done = false;
+	req->busy = true;
+	na->inflight++;
+	return 0;
+}
+
+int netlink_async_process(struct netlink_async *na)
+{
+	struct netlink_socket *nls = &na->nls;
+	unsigned int portid = nls->tp->portid(nls->sk);
+	const struct nlmsghdr *nlh;
+	struct netlink_req *req;
+	int completed = 0;
+	int err;
+	int len;
+
+	while (na->inflight) {
+		len = nls->tp->recvfrom(nls->sk, nls->buf,
+					MNL_SOCKET_BUFFER_SIZE, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			/* Replies may have been lost, as with ENOBUFS, so the
+			 * requests in flight would never complete.
+			 */
+			err = -errno;
+			netlink_async_fail(na, err);
+			return err;
+		}
+
+		nlh = (const struct nlmsghdr *)nls->buf;
+		for (; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+			req = &na->reqs[nlh->nlmsg_seq % na->depth];
+			if (!req->busy || req->seq != nlh->nlmsg_seq)
+				continue;
+			if (!netlink_req_rcv(req, nlh, portid))
+				continue;
+
+			/* Release the slot first, the callback may submit */
+			req->busy = false;
+			na->inflight--;
+			completed++;
+			if (req->done_cb)
+				req->done_cb(req->err, req->data);
+		}
+	}
+	return completed;
+}
@@ -13,6 +13,9 @@
 #ifndef __NETLINK_UTILS_H__
 #define __NETLINK_UTILS_H__ 1
 
+#include <sys/types.h>
+#include <linux/genetlink.h>
+
 enum nlmsg_err_attrs {
 	NLMSG_ERR_ATTR_UNUSED,
 	NLMSG_ERR_ATTR_MSG,
@@ -34,17 +37,74 @@ enum nlmsg_err_attrs {
 #define NLM_F_ACK_REQ_CAPPED	0x100	/* request was capped */
 #define NLM_F_ACK_TLVS		0x200	/* extended ACK TLVs are included */
 
+#define NETLINK_MCGRP_MAX	4
+
+struct netlink_mcgrp {
+	char name[GENL_NAMSIZ];
+	uint32_t id;
+};
+
+/**
+ * netlink_transport - I/O of the sockets carrying requests and replies
+ * @open: open a socket bound to its port id, or NULL with errno set
+ * @close: close a socket returned by @open
+ * @sendto: send @len bytes of requests; returns @len or -1 with errno set
+ * @recvfrom: receive one datagram of replies, blocking unless @flags has
+ *	MSG_DONTWAIT; returns its length or -1 with errno set
+ * @portid: port id the replies to the socket are addressed to
+ * @fd: file descriptor polling readable while replies are pending
+ * @priv: argument of @open
+ *
+ * Sockets use the kernel generic netlink transport unless another one is
+ * installed, e.g. a userspace model of the family to test against.
+ * Multicast notification sockets always use the kernel.
+ */
+struct netlink_transport {
+	void *(*open)(void *priv);
+	void (*close)(void *sk);
+	ssize_t (*sendto)(void *sk, const void *buf, size_t len);
+	ssize_t (*recvfrom)(void *sk, void *buf, size_t len, int flags);
+	unsigned int (*portid)(void *sk);
+	int (*fd)(void *sk);
+	void *priv;
+};
+
+/**
+ * netlink_transport_set - Use transport @tp for the sockets opened from now
+ * on, or the kernel again when @tp is NULL. @tp must outlive these sockets.
+ */
+void netlink_transport_set(const struct netlink_transport *tp);
+
 struct netlink_socket {
 	char *buf;
-	struct mnl_socket *nl;
+	const struct netlink_transport *tp;
+	void *sk;
 	uint32_t family;
 	unsigned int seq;
 	uint8_t version;
+	struct netlink_mcgrp mcgrps[NETLINK_MCGRP_MAX];
+	unsigned int num_mcgrps;
+	/* Bytes of the replies received by netlink_socket_sndrcv() */
+	uint64_t rx_bytes;
 };
 
 int netlink_socket_open(struct netlink_socket *nlg, const char *family_name,
 			 uint8_t version);
 void netlink_socket_close(struct netlink_socket *nlg);
+int netlink_socket_get_fd(const struct netlink_socket *nls);
+
+/**
+ * netlink_socket_mcgrp_get - Look up a multicast group of the family by name.
+ * Return: 0 with @id filled or -ENOENT when the family has no such group.
+ */
+int netlink_socket_mcgrp_get(const struct netlink_socket *nls,
+			     const char *name, uint32_t *id);
+
+/**
+ * netlink_mcgrp_socket_open - Open a generic netlink socket subscribed to
+ * multicast @group. Return: socket or NULL on error.
+ */
+struct mnl_socket *netlink_mcgrp_socket_open(uint32_t group);
 
 struct nlmsghdr *
 _netlink_socket_cmd_prepare(struct netlink_socket *nlg,
@@ -56,6 +116,103 @@ struct nlmsghdr *netlink_socket_cmd_prepare(struct netlink_socket *nlg,
 int netlink_socket_sndrcv(struct netlink_socket *nlg, const struct nlmsghdr *nlh,
 			   mnl_cb_t data_cb, void *data);
 
+typedef void (*netlink_done_cb_t)(int err, void *data);
+
+/**
+ * netlink_req - one request queued or in flight on a netlink_batch
+ * @data_cb: called for every data message of the reply, may be NULL
+ * @done_cb: called once with 0 or negative errno when the request completes
+ */
+struct netlink_req {
+	mnl_cb_t data_cb;
+	netlink_done_cb_t done_cb;
+	void *data;
+	unsigned int seq;
+	int err;
+	bool done;
+	bool busy;
+};
+
+#define NETLINK_BATCH_DEPTH	32
+#define NETLINK_BATCH_MSG_MAX	512
+
+/**
+ * netlink_batch - pipelined requests on a netlink socket
+ *
+ * Requests are built back-to-back in a private send buffer and transmitted
+ * with a single send once the batch is flushed or full. Replies and ACKs are
+ * matched to their request by sequence number. Every request must fit in
+ * NETLINK_BATCH_MSG_MAX bytes. A socket runs one dump at a time, so a batch
+ * holds at most one dump request.
+ */
+struct netlink_batch {
+	struct netlink_socket *nls;
+	struct netlink_req *reqs;
+	char *buf;
+	size_t len;
+	unsigned int depth;
+	unsigned int queued;
+	bool dump_queued;
+};
+
+int netlink_batch_init(struct netlink_batch *nb, struct netlink_socket *nls,
+		       unsigned int depth);
+void netlink_batch_fini(struct netlink_batch *nb);
+
+/**
+ * netlink_batch_cmd_prepare - Start the next request of the batch, flushing
+ * the batch first when it is full.
+ * Return: message to fill and pass to netlink_batch_queue(), or NULL with
+ * errno set to the socket error of the flush, or to EBUSY for a second dump
+ * request in the batch.
+ */
+struct nlmsghdr *netlink_batch_cmd_prepare(struct netlink_batch *nb,
+					   uint8_t cmd, uint16_t flags);
+int netlink_batch_queue(struct netlink_batch *nb, const struct nlmsghdr *nlh,
+			mnl_cb_t data_cb, netlink_done_cb_t done_cb, void *data);
+int netlink_batch_flush(struct netlink_batch *nb);
+
+/**
+ * netlink_socket_dup - Open a new socket for the family of @src without
+ * looking the family up again.
+ */
+int netlink_socket_dup(struct netlink_socket *nls,
+		       const struct netlink_socket *src);
+
+#define NETLINK_ASYNC_DEPTH	64
+
+/**
+ * netlink_async - non-blocking requests on a dedicated netlink socket
+ *
+ * Requests are sent as soon as they are submitted. netlink_async_process()
+ * receives whatever replies are available without blocking and completes
+ * the matching requests. A request occupies slot seq % depth until it
+ * completes, so at most depth requests are in flight.
+ *
+ * When receiving fails with anything but EAGAIN or EINTR, replies may have
+ * been lost: every request in flight completes with that error and
+ * netlink_async_process() returns it. netlink_async_fini() completes the
+ * requests still in flight with -ECANCELED.
+ */
+struct netlink_async {
+	struct netlink_socket nls;
+	struct netlink_req *reqs;
+	char *sndbuf;
+	unsigned int depth;
+	unsigned int inflight;
+};
+
+int netlink_async_init(struct netlink_async *na,
+		       const struct netlink_socket *src, unsigned int depth);
+void netlink_async_fini(struct netlink_async *na);
+
+/* Returns NULL with errno set to EBUSY when the next slot is in flight */
+struct nlmsghdr *netlink_async_cmd_prepare(struct netlink_async *na,
+					   uint8_t cmd, uint16_t flags);
+int netlink_async_submit(struct netlink_async *na, const struct nlmsghdr *nlh,
+			 mnl_cb_t data_cb, netlink_done_cb_t done_cb, void *data);
+int netlink_async_process(struct netlink_async *na);
+
 int mnlu_socket_recv_run(struct mnl_socket *nl, unsigned int seq, void *buf, size_t buf_size,
 			 mnl_cb_t cb, void *data);
 
@@ -0,0 +1,240 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+/*
+ * Compare the per message cost of decoding a port dump as the library used
+ * to, with attributes validated and stored in tables indexed by attribute
+ * type, with the decoding of the library. Both run over the same reply
+ * datagrams, copied to a receive buffer first, the library getting them
+ * through mlxdevm_sf_port_foreach() on a replay transport.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdlib.h>
+
+#include "ts.h"
+#include "nl_fixture.h"
+
+#define BENCH_BUS	"pci"
+#define BENCH_DEV	"0000:03:00.0"
+#define BENCH_PORTS	10000
+#define BENCH_ROUNDS	10
+
+static const enum mnl_attr_data_type type_policy[MLXDEVM_ATTR_MAX + 1] = {
+	[MLXDEVM_ATTR_DEV_BUS_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_DEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_PORT_INDEX] = MNL_TYPE_U32,
+	[MLXDEVM_ATTR_PORT_TYPE] = MNL_TYPE_U16,
+	[MLXDEVM_ATTR_PORT_NETDEV_IFINDEX] = MNL_TYPE_U32,
+	[MLXDEVM_ATTR_PORT_NETDEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_PORT_IBDEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_PARAM_NAME] = MNL_TYPE_STRING,
+	[MLXDEVM_ATTR_PARAM_TYPE] = MNL_TYPE_U8,
+	[MLXDEVM_ATTR_PARAM_VALUES_LIST] = MNL_TYPE_NESTED,
+	[MLXDEVM_ATTR_PARAM_VALUE] = MNL_TYPE_NESTED,
+	[MLXDEVM_ATTR_PARAM_VALUE_CMODE] = MNL_TYPE_U8,
+};
+
+static const enum mnl_attr_data_type
+type_fn_policy[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {
+	[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR] = MNL_TYPE_BINARY,
+	[MLXDEVM_PORT_FN_ATTR_STATE] = MNL_TYPE_U8,
+	[MLXDEVM_PORT_FN_ATTR_OPSTATE] = MNL_TYPE_U8,
+	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE] = MNL_TYPE_U8,
+	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST] = MNL_TYPE_U32,
+};
+
+/* Parser indexed by attribute type, as used before the compact index */
+static int type_attr_parse_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	int type;
+
+	if (mnl_attr_type_valid(attr, MLXDEVM_ATTR_MAX) < 0)
+		return MNL_CB_OK;
+
+	type = mnl_attr_get_type(attr);
+	if (mnl_attr_validate(attr, type_policy[type]) < 0)
+		return MNL_CB_ERROR;
+
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+static int type_fn_attr_parse_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	int type;
+
+	if (mnl_attr_type_valid(attr, MLXDEVM_PORT_FUNCTION_ATTR_MAX) < 0)
+		return MNL_CB_OK;
+
+	type = mnl_attr_get_type(attr);
+	if (mnl_attr_validate(attr, type_fn_policy[type]) < 0)
+		return MNL_CB_ERROR;
+
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+static void type_port_fn_get(struct nlattr **tb_port, struct mlxdevm_port *port)
+{
+	struct nlattr *tb[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {};
+
+	if (mnl_attr_parse_nested(tb_port[MLXDEVM_ATTR_PORT_FUNCTION],
+				  type_fn_attr_parse_cb, tb) != MNL_CB_OK)
+		return;
+
+	port->state = mnl_attr_get_u8(tb[MLXDEVM_PORT_FN_ATTR_STATE]);
+	port->opstate = mnl_attr_get_u8(tb[MLXDEVM_PORT_FN_ATTR_OPSTATE]);
+	if (tb[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR] &&
+	    mnl_attr_get_payload_len(tb[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR]) ==
+	    sizeof(port->mac_addr))
+		memcpy(port->mac_addr,
+		       mnl_attr_get_payload(tb[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR]),
+		       sizeof(port->mac_addr));
+	if (tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE]) {
+		port->ext_cap.roce =
+			mnl_attr_get_u8(tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE]);
+		port->ext_cap.roce_valid = true;
+	}
+	if (tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST]) {
+		port->ext_cap.max_uc_macs =
+			mnl_attr_get_u32(tb[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST]);
+		port->ext_cap.max_uc_macs_valid = true;
+	}
+}
+
+static int type_port_dump_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *tb[MLXDEVM_ATTR_MAX + 1] = {};
+	unsigned long long *sum = data;
+	struct mlxdevm_port port;
+
+	mnl_attr_parse(nlh, sizeof(struct genlmsghdr), type_attr_parse_cb, tb);
+	if (!tb[MLXDEVM_ATTR_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_DEV_NAME] ||
+	    !tb[MLXDEVM_ATTR_PORT_INDEX] || !tb[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER] ||
+	    !tb[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER] ||
+	    !tb[MLXDEVM_ATTR_PORT_FLAVOUR])
+		return MNL_CB_OK;
+	if (mnl_attr_get_u16(tb[MLXDEVM_ATTR_PORT_FLAVOUR]) !=
+	    MLXDEVM_PORT_FLAVOUR_PCI_SF)
+		return MNL_CB_OK;
+
+	memset(&port, 0, sizeof(port));
+	port.port_index = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_INDEX]);
+	port.ndev_ifindex = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_NETDEV_IFINDEX]);
+	port.pfnum = mnl_attr_get_u16(tb[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER]);
+	port.sfnum = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER]);
+	type_port_fn_get(tb, &port);
+
+	*sum += port.sfnum;
+	return MNL_CB_OK;
+}
+
+/* Receive the replay as the library does, into one buffer */
+static int type_port_dump(const struct nlf_replay *r, char *buf,
+			  unsigned long long *sum)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < r->count; i++) {
+		memcpy(buf, r->dgrams[i], r->lens[i]);
+		ret = mnl_cb_run2(buf, r->lens[i], 0, 0, type_port_dump_cb, sum,
+				  NULL, 0);
+		if (ret <= MNL_CB_STOP)
+			return ret < 0 ? -errno : 0;
+	}
+	return 0;
+}
+
+static int lib_port_cb(struct mlxdevm *dl, const struct mlxdevm_port *port,
+		       void *priv)
+{
+	unsigned long long *sum = priv;
+
+	*sum += port->sfnum;
+	return 0;
+}
+
+static void bench_print(const char *name, const struct ts_time *ts,
+			unsigned long long sum)
+{
+	printf("%s: %d msgs in ", name, BENCH_PORTS * BENCH_ROUNDS);
+	print_time(ts->latency);
+	printf("(%.1f nsec/msg) check=%llu\n",
+	       (double)ts->latency / (BENCH_PORTS * BENCH_ROUNDS), sum);
+}
+
+int main(int argc, char **argv)
+{
+	struct ts_time ts = { 0 };
+	unsigned long long sum;
+	struct nlf_replay r;
+	struct nlf_port p;
+	struct mlxdevm *dl;
+	int err = 0;
+	char *buf;
+	int i;
+
+	nlf_replay_init(&r);
+	for (i = 0; i < BENCH_PORTS && !err; i++) {
+		nlf_port_init(&p, BENCH_BUS, BENCH_DEV, i + 1);
+		err = nlf_port_put(&r.b, &p, NLM_F_MULTI);
+	}
+	if (!err)
+		err = nlf_done(&r.b);
+	buf = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (err || !buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	sum = 0;
+	ts_log_start_time(&ts);
+	for (i = 0; i < BENCH_ROUNDS && !err; i++)
+		err = type_port_dump(&r, buf, &sum);
+	ts_log_end_time(&ts);
+	if (err) {
+		fprintf(stderr, "attr type table failed %d\n", err);
+		goto out;
+	}
+	bench_print("attr type table", &ts, sum);
+
+	dl = nlf_replay_open(BENCH_BUS, BENCH_DEV);
+	if (!dl) {
+		err = errno;
+		fprintf(stderr, "%s fail to open handle %d\n", __func__, err);
+		goto out;
+	}
+	nlf_replay_set(&r);
+
+	sum = 0;
+	ts_log_start_time(&ts);
+	for (i = 0; i < BENCH_ROUNDS && !err; i++)
+		err = mlxdevm_sf_port_foreach(dl, lib_port_cb, &sum);
+	ts_log_end_time(&ts);
+	mlxdevm_close(dl);
+	if (err) {
+		fprintf(stderr, "library failed %d\n", err);
+		err = -err;
+		goto out;
+	}
+	bench_print("library", &ts, sum);
+
+out:
+	free(buf);
+	nlf_replay_free(&r);
+	return err;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdlib.h>
+
+#include "ts.h"
+
+int main(int argc, char **argv)
+{
+	struct mlxdevm_port_fn_ext_cap cap = {};
+	struct mlxdevm_sf_port_id *ids;
+	struct ts_time ts = { 0 };
+	struct mlxdevm_port **waits;
+	struct mlxdevm_port *ports;
+	struct mlxdevm_batch *b;
+	struct mlxdevm *dl;
+	int err = 0;
+	int added = 0;
+	int num_sfs;
+	int *cap_errs;
+	int *errs;
+	int ret;
+	int i, n;
+
+	if (argc < 5) {
+		printf("format is %s <dl> <bus> <dev> <num_sfs>\n", argv[0]);
+		printf("example %s mlxdevm pci 0000:03:00.0 256\n", argv[0]);
+		return EINVAL;
+	}
+
+	num_sfs = atol(argv[4]);
+	ids = calloc(num_sfs, sizeof(*ids));
+	ports = calloc(num_sfs, sizeof(*ports));
+	errs = calloc(num_sfs, sizeof(*errs));
+	cap_errs = calloc(num_sfs, sizeof(*cap_errs));
+	waits = calloc(num_sfs, sizeof(*waits));
+	if (!ids || !ports || !errs || !cap_errs || !waits)
+		return ENOMEM;
+
+	dl = mlxdevm_open(argv[1], argv[2], argv[3]);
+	if (!dl) {
+		fprintf(stderr, "%s fail to connect to mlxdevm %d\n", __func__, errno);
+		return errno;
+	}
+
+	for (i = 0; i < num_sfs; i++) {
+		ids[i].pfnum = 0;
+		ids[i].sfnum = i + 1;
+	}
+
+	ts_log_start_time(&ts);
+	added = mlxdevm_sf_port_add_batch(dl, ids, ports, errs, num_sfs);
+	ts_log_end_time(&ts);
+	printf("ports added = %d/%d in ", added, num_sfs);
+	print_time(ts.latency);
+	printf("\n");
+	if (added < 0) {
+		err = -added;
+		goto out;
+	}
+
+	/* Keep only the ports which were added */
+	added = 0;
+	for (i = 0; i < num_sfs; i++) {
+		if (!errs[i])
+			ports[added++] = ports[i];
+	}
+
+	b = mlxdevm_batch_create(dl, 0);
+	if (!b) {
+		err = ENOMEM;
+		goto del;
+	}
+
+	ts_log_start_time(&ts);
+	for (i = 0; i < added; i++) {
+		cap.roce = false;
+		cap.roce_valid = ports[i].ext_cap.roce_valid;
+		cap.max_uc_macs = 1;
+		cap.max_uc_macs_valid = ports[i].ext_cap.max_uc_macs_valid;
+		mlxdevm_batch_port_fn_cap_set(b, &ports[i], &cap,
+					      &cap_errs[i]);
+		mlxdevm_batch_port_fn_state_set(b, &ports[i],
+						MLXDEVM_PORT_FN_STATE_ACTIVE,
+						&errs[i]);
+	}
+	mlxdevm_batch_flush(b);
+	ts_log_end_time(&ts);
+	printf("ports activated in ");
+	print_time(ts.latency);
+	printf("\n");
+
+	/* -EOPNOTSUPP only tells that the port exposes no capability */
+	for (i = 0; i < added; i++) {
+		if (cap_errs[i] && cap_errs[i] != -EOPNOTSUPP) {
+			fprintf(stderr, "sfnum %u cap set failed %d\n",
+				ports[i].sfnum, cap_errs[i]);
+			err = EINVAL;
+		}
+	}
+
+	for (i = 0; i < added; i++) {
+		if (errs[i])
+			continue;
+		mlxdevm_batch_port_fn_state_set(b, &ports[i],
+						MLXDEVM_PORT_FN_STATE_INACTIVE,
+						&errs[i]);
+	}
+	mlxdevm_batch_flush(b);
+	mlxdevm_batch_destroy(b);
+
+	for (i = 0, n = 0; i < added; i++) {
+		if (!errs[i])
+			waits[n++] = &ports[i];
+	}
+	ts_log_start_time(&ts);
+	ret = mlxdevm_ports_opstate_wait(dl, waits, n,
+					 MLXDEVM_PORT_FN_OPSTATE_DETACHED,
+					 NULL, NULL);
+	ts_log_end_time(&ts);
+	printf("ports detached = %d/%d in ", ret < 0 ? 0 : n - ret, n);
+	print_time(ts.latency);
+	printf("\n");
+
+del:
+	ts_log_start_time(&ts);
+	ret = mlxdevm_sf_port_del_batch(dl, ports, errs, added);
+	ts_log_end_time(&ts);
+	printf("ports deleted = %d in ", ret);
+	print_time(ts.latency);
+	printf("\n");
+	if (!err && ret != added)
+		err = EINVAL;
+out:
+	mlxdevm_close(dl);
+	free(waits);
+	free(cap_errs);
+	free(errs);
+	free(ports);
+	free(ids);
+	return err;
+}
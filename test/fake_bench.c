@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+/*
+ * Run the SF life cycle of the stress test against the userspace model of
+ * mlxdevm, so that the library overhead is measured on any machine: every
+ * thread adds ports, configures and activates them, waits until they are
+ * attached, sets the parameters of their auxiliary devices, deactivates
+ * them, waits until they are detached and deletes them.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ts.h"
+#include "fake_mlxdevm.h"
+
+#define BENCH_BUS	"pci"
+#define BENCH_DEV	"0000:03:00.0"
+
+enum bench_stage {
+	BENCH_STAGE_ADD,
+	BENCH_STAGE_APPLY,
+	BENCH_STAGE_ATTACHED,
+	BENCH_STAGE_PARAMS,
+	BENCH_STAGE_DEACTIVATE,
+	BENCH_STAGE_DETACHED,
+	BENCH_STAGE_DEL,
+	BENCH_STAGE_MAX,
+};
+
+static const char * const stage_names[BENCH_STAGE_MAX] = {
+	[BENCH_STAGE_ADD] = "port add",
+	[BENCH_STAGE_APPLY] = "port apply",
+	[BENCH_STAGE_ATTACHED] = "wait attached (all ports)",
+	[BENCH_STAGE_PARAMS] = "cfg param (all devs)",
+	[BENCH_STAGE_DEACTIVATE] = "port deactivate",
+	[BENCH_STAGE_DETACHED] = "wait detached (all ports)",
+	[BENCH_STAGE_DEL] = "port del",
+};
+
+struct thread_params {
+	struct mlxdevm_mt *mt;
+	int num_sfs;
+	int rounds;
+	uint32_t start_sfnum;
+	struct mlxdevm_port **ports;
+	struct mlxdevm_dev_id *devs;
+	char (*dev_names)[32];
+	int *errs;
+	int err;
+	/* BENCH_STAGE_MAX stages in the stats of all threads */
+	struct time_stats *stats;
+};
+
+static int ports_add(struct mlxdevm *dl, struct thread_params *params)
+{
+	struct mlxdevm_port_fn_config cfg = {
+		.mac_addr = { 0x0, 0x11, 0x22, 0x33, 0x44, 0x0 },
+		.mac_addr_valid = true,
+		.state = MLXDEVM_PORT_FN_STATE_ACTIVE,
+		.state_valid = true,
+		.ext_cap = {
+			.roce = false,
+			.roce_valid = true,
+			.max_uc_macs = 1,
+			.max_uc_macs_valid = true,
+		},
+	};
+	struct ts_time ts = { 0 };
+	uint32_t sfnum;
+	int err;
+	int i;
+
+	for (i = 0; i < params->num_sfs; i++) {
+		sfnum = params->start_sfnum + i;
+		ts_log_start_time(&ts);
+		params->ports[i] = mlxdevm_sf_port_add(dl, 0, sfnum);
+		ts_log_end_time(&ts);
+		if (!params->ports[i]) {
+			fprintf(stderr, "sf %u port add fail %d\n", sfnum, errno);
+			return -errno;
+		}
+		ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_ADD]);
+
+		cfg.mac_addr[5] = sfnum;
+		ts_log_start_time(&ts);
+		err = mlxdevm_port_fn_apply(dl, params->ports[i], &cfg);
+		ts_log_end_time(&ts);
+		if (err) {
+			fprintf(stderr, "sf %u apply fail %d\n", sfnum, err);
+			return err;
+		}
+		ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_APPLY]);
+	}
+	return 0;
+}
+
+static int ports_del(struct mlxdevm *dl, struct thread_params *params)
+{
+	struct ts_time ts = { 0 };
+	int err;
+	int i;
+
+	for (i = 0; i < params->num_sfs; i++) {
+		ts_log_start_time(&ts);
+		err = mlxdevm_port_fn_state_set(dl, params->ports[i],
+						MLXDEVM_PORT_FN_STATE_INACTIVE);
+		ts_log_end_time(&ts);
+		if (err) {
+			fprintf(stderr, "sf %u deactivate fail %d\n",
+				params->ports[i]->sfnum, err);
+			return err;
+		}
+		ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_DEACTIVATE]);
+	}
+
+	ts_log_start_time(&ts);
+	err = mlxdevm_ports_opstate_wait(dl, params->ports, params->num_sfs,
+					 MLXDEVM_PORT_FN_OPSTATE_DETACHED,
+					 NULL, NULL);
+	ts_log_end_time(&ts);
+	if (err) {
+		fprintf(stderr, "detach wait fail %d\n", err);
+		return err;
+	}
+	ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_DETACHED]);
+
+	for (i = 0; i < params->num_sfs; i++) {
+		ts_log_start_time(&ts);
+		mlxdevm_sf_port_del(dl, params->ports[i]);
+		ts_log_end_time(&ts);
+		ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_DEL]);
+		params->ports[i] = NULL;
+	}
+	return 0;
+}
+
+static int round_run(struct mlxdevm *dl, struct thread_params *params)
+{
+	struct ts_time ts = { 0 };
+	int err;
+
+	err = ports_add(dl, params);
+	if (err)
+		return err;
+
+	ts_log_start_time(&ts);
+	err = mlxdevm_ports_opstate_wait(dl, params->ports, params->num_sfs,
+					 MLXDEVM_PORT_FN_OPSTATE_ATTACHED,
+					 NULL, NULL);
+	ts_log_end_time(&ts);
+	if (err) {
+		fprintf(stderr, "attach wait fail %d\n", err);
+		return err;
+	}
+	ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_ATTACHED]);
+
+	ts_log_start_time(&ts);
+	err = mlxdevm_devs_params_apply(dl, params->devs, params->num_sfs,
+					sf_params, ARRAY_SIZE(sf_params),
+					params->errs);
+	ts_log_end_time(&ts);
+	if (err != params->num_sfs) {
+		fprintf(stderr, "cfg param fail %d\n", err);
+		return err < 0 ? err : -EIO;
+	}
+	ts_update_time_stats(&ts, &params->stats[BENCH_STAGE_PARAMS]);
+
+	return ports_del(dl, params);
+}
+
+static void *worker(void *arg)
+{
+	struct thread_params *params = arg;
+	struct mlxdevm *dl;
+	int r;
+
+	dl = mlxdevm_mt_handle(params->mt);
+	if (!dl) {
+		params->err = -errno;
+		return NULL;
+	}
+
+	for (r = 0; r < params->rounds; r++) {
+		params->err = round_run(dl, params);
+		if (params->err)
+			break;
+	}
+	return NULL;
+}
+
+static int thread_params_init(struct thread_params *params, int num_sfs)
+{
+	int i;
+
+	params->ports = calloc(num_sfs, sizeof(*params->ports));
+	params->devs = calloc(num_sfs, sizeof(*params->devs));
+	params->dev_names = calloc(num_sfs, sizeof(*params->dev_names));
+	params->errs = calloc(num_sfs, sizeof(*params->errs));
+	if (!params->ports || !params->devs || !params->dev_names ||
+	    !params->errs)
+		return -ENOMEM;
+
+	for (i = 0; i < num_sfs; i++) {
+		snprintf(params->dev_names[i], sizeof(params->dev_names[i]),
+			 "mlx5_core.sf.%u", params->start_sfnum + i);
+		params->devs[i].bus = "auxiliary";
+		params->devs[i].dev = params->dev_names[i];
+	}
+	params->num_sfs = num_sfs;
+	return 0;
+}
+
+static void thread_params_fini(struct thread_params *params)
+{
+	free(params->ports);
+	free(params->devs);
+	free(params->dev_names);
+	free(params->errs);
+}
+
+int main(int argc, char **argv)
+{
+	struct fake_mlxdevm_config cfg = {
+		.bus = BENCH_BUS,
+		.dev = BENCH_DEV,
+	};
+	struct thread_params *params;
+	struct time_stats *total_stats;
+	struct time_stats *stats;
+	struct ts_time ts = { 0 };
+	struct mlxdevm_mt *mt;
+	int sfs_per_thread;
+	int thread_count;
+	pthread_t *tids;
+	int rounds = 1;
+	int ret = 0;
+	int err;
+	int i;
+
+	if (argc < 3) {
+		printf("format is %s <thread_count> <per_thread_sfs> [rounds] [attach_usec]\n",
+		       argv[0]);
+		printf("example %s 4 256 10 100\n", argv[0]);
+		return EINVAL;
+	}
+
+	thread_count = atoi(argv[1]);
+	sfs_per_thread = atoi(argv[2]);
+	if (argc > 3)
+		rounds = atoi(argv[3]);
+	if (argc > 4)
+		cfg.attach_usec = atoi(argv[4]);
+	cfg.max_ports = thread_count * sfs_per_thread;
+
+	params = calloc(thread_count, sizeof(*params));
+	tids = calloc(thread_count, sizeof(*tids));
+	total_stats = malloc(sizeof(*total_stats));
+	stats = ts_stats_alloc(thread_count * BENCH_STAGE_MAX);
+	if (!params || !tids || !total_stats || !stats)
+		return ENOMEM;
+
+	err = fake_mlxdevm_start(&cfg);
+	if (err) {
+		fprintf(stderr, "fail to start mlxdevm model %d\n", err);
+		return -err;
+	}
+
+	mt = mlxdevm_mt_open(MLXDEVM_GENL_NAME, BENCH_BUS, BENCH_DEV);
+	if (!mt) {
+		fprintf(stderr, "%s fail to connect to mlxdevm %d\n", __func__, errno);
+		return errno;
+	}
+
+	for (i = 0; i < thread_count; i++) {
+		params[i].mt = mt;
+		params[i].rounds = rounds;
+		params[i].start_sfnum = (i * sfs_per_thread) + 1;
+		params[i].stats = &stats[i * BENCH_STAGE_MAX];
+		if (thread_params_init(&params[i], sfs_per_thread))
+			return ENOMEM;
+	}
+
+	ts_init(total_stats);
+	ts_log_start_time(&ts);
+	for (i = 0; i < thread_count; i++) {
+		err = pthread_create(&tids[i], NULL, worker, &params[i]);
+		if (err) {
+			fprintf(stderr, "thread create err = %d\n", err);
+			return err;
+		}
+	}
+	for (i = 0; i < thread_count; i++)
+		pthread_join(tids[i], NULL);
+	ts_log_end_time(&ts);
+	mlxdevm_mt_close(mt);
+
+	ts_update_time_stats(&ts, total_stats);
+	ts_print_lat_stats(total_stats, "total time");
+	ts_print_stages(stats, thread_count, stage_names, BENCH_STAGE_MAX);
+	ts_print_cmd_stats();
+
+	for (i = 0; i < thread_count; i++) {
+		if (params[i].err) {
+			printf("thread %d failed: %d\n", i, params[i].err);
+			ret = EINVAL;
+		}
+		thread_params_fini(&params[i]);
+	}
+	if (fake_mlxdevm_port_count()) {
+		printf("%u ports left\n", fake_mlxdevm_port_count());
+		ret = EINVAL;
+	}
+
+	fake_mlxdevm_stop();
+	free(stats);
+	free(total_stats);
+	free(tids);
+	free(params);
+	return ret;
+}
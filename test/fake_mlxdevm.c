@@ -0,0 +1,851 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+
+#include "fake_mlxdevm.h"
+#include "nl_fixture.h"
+#include "options.h"
+
+#define FAKE_PORT_INDEX_BASE	0x8000
+#define FAKE_IFINDEX_BASE	1000
+#define FAKE_MAX_PORTS		4096
+#define FAKE_NAME_LEN		64
+#define FAKE_SFNUM_HASH		1024
+/* Reply of a dump request, acknowledged by NLMSG_DONE instead of an ACK */
+#define FAKE_DUMPED		1
+
+struct fake_dgram {
+	TAILQ_ENTRY(fake_dgram) entry;
+	size_t len;
+	char buf[];
+};
+
+TAILQ_HEAD(fake_dgram_head, fake_dgram);
+
+/* Replies are queued on the socket by the thread sending the requests, the
+ * only one using the socket, so the queue needs no lock.
+ */
+struct fake_sock {
+	unsigned int portid;
+	/* Created once polled, readable while replies are queued */
+	int efd;
+	struct fake_dgram_head rxq;
+	struct fake_dgram_head free;
+	/* Attributes of the request being handled, by type */
+	struct nlattr **tb;
+};
+
+struct fake_port {
+	LIST_ENTRY(fake_port) sfnum_entry;
+	uint32_t slot;
+	uint32_t sfnum;
+	uint16_t pfnum;
+	uint8_t hw_addr[6];
+	uint8_t state;
+	/* Operational state until the last state change completes */
+	uint8_t opstate;
+	long long changed_ns;
+	uint8_t roce;
+	uint32_t max_uc_macs;
+};
+
+struct fake_param_def {
+	const char *name;
+	uint8_t type;
+	uint32_t value;
+};
+
+static const struct fake_param_def fake_param_defs[] = {
+	{ "cmpl_eq_depth", MNL_TYPE_U32, 1024 },
+	{ "async_eq_depth", MNL_TYPE_U32, 256 },
+	{ "disable_fc", MNL_TYPE_FLAG, 0 },
+	{ "disable_netdev", MNL_TYPE_FLAG, 0 },
+	{ "max_cmpl_eqs", MNL_TYPE_U16, 8 },
+};
+
+/* Device having parameters, created by the first request naming it */
+struct fake_dev {
+	LIST_ENTRY(fake_dev) entry;
+	char bus[FAKE_NAME_LEN];
+	char dev[FAKE_NAME_LEN];
+	uint32_t values[ARRAY_SIZE(fake_param_defs)];
+};
+
+struct fake_req {
+	struct fake_sock *sk;
+	const struct nlmsghdr *nlh;
+	/* Appends the reply messages to datagrams queued on the socket */
+	struct nlf_builder b;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	char bus[FAKE_NAME_LEN];
+	char dev[FAKE_NAME_LEN];
+	long long attach_ns;
+	size_t dgram_size;
+	unsigned int portid;
+	struct fake_port **ports;
+	unsigned int max_ports;
+	/* Ports occupy slots below end; slots below next_free are used */
+	unsigned int end;
+	unsigned int next_free;
+	unsigned int count;
+	LIST_HEAD(, fake_port) sfnums[FAKE_SFNUM_HASH];
+	LIST_HEAD(, fake_dev) devs;
+} fake = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static long long fake_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static struct fake_dgram *fake_dgram_get(struct fake_sock *sk)
+{
+	struct fake_dgram *dg;
+
+	dg = TAILQ_FIRST(&sk->free);
+	if (dg) {
+		TAILQ_REMOVE(&sk->free, dg, entry);
+	} else {
+		dg = malloc(sizeof(*dg) + fake.dgram_size);
+		if (!dg)
+			return NULL;
+	}
+
+	dg->len = 0;
+	TAILQ_INSERT_TAIL(&sk->rxq, dg, entry);
+	if (sk->efd >= 0)
+		eventfd_write(sk->efd, 1);
+	return dg;
+}
+
+static int fake_dgram_new(struct nlf_builder *b)
+{
+	struct fake_dgram *dg;
+
+	dg = fake_dgram_get(b->priv);
+	if (!dg)
+		return -ENOMEM;
+
+	b->dgram = dg->buf;
+	b->len = &dg->len;
+	return 0;
+}
+
+static int fake_done(struct fake_req *r)
+{
+	int err;
+
+	err = nlf_done(&r->b);
+	return err ? err : FAKE_DUMPED;
+}
+
+static int ctrl_attr_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+
+	if (mnl_attr_type_valid(attr, CTRL_ATTR_MAX) < 0)
+		return MNL_CB_OK;
+	tb[mnl_attr_get_type(attr)] = attr;
+	return MNL_CB_OK;
+}
+
+static int fake_ctrl_rcv(struct fake_req *r)
+{
+	const struct genlmsghdr *genl = mnl_nlmsg_get_payload(r->nlh);
+	struct nlattr *tb[CTRL_ATTR_MAX + 1] = {};
+
+	if (genl->cmd != CTRL_CMD_GETFAMILY)
+		return -EOPNOTSUPP;
+
+	mnl_attr_parse(r->nlh, sizeof(*genl), ctrl_attr_cb, tb);
+	if (!tb[CTRL_ATTR_FAMILY_NAME] ||
+	    strcmp(mnl_attr_get_str(tb[CTRL_ATTR_FAMILY_NAME]),
+		   MLXDEVM_GENL_NAME))
+		return -ENOENT;
+
+	/* No multicast group, opstate waits poll the ports */
+	return nlf_family_put(&r->b);
+}
+
+/* Requests are decoded like by the kernel: attributes are validated
+ * against a policy and stored in tables indexed by attribute type, unknown
+ * ones being ignored.
+ */
+static const enum mnl_attr_data_type fake_policy[MLXDEVM_ATTR_MAX + 1] = {
+	[MLXDEVM_ATTR_DEV_BUS_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_DEV_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_PORT_INDEX] = MNL_TYPE_U32,
+	[MLXDEVM_ATTR_PORT_FLAVOUR] = MNL_TYPE_U16,
+	[MLXDEVM_ATTR_PORT_FUNCTION] = MNL_TYPE_NESTED,
+	[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER] = MNL_TYPE_U16,
+	[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER] = MNL_TYPE_U32,
+	[MLXDEVM_ATTR_PARAM_NAME] = MNL_TYPE_NUL_STRING,
+	[MLXDEVM_ATTR_PARAM_TYPE] = MNL_TYPE_U8,
+	[MLXDEVM_ATTR_PARAM_VALUE_CMODE] = MNL_TYPE_U8,
+	[MLXDEVM_ATTR_EXT_PORT_FN_CAP] = MNL_TYPE_NESTED,
+};
+
+static const enum mnl_attr_data_type
+fake_fn_policy[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {
+	[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR] = MNL_TYPE_BINARY,
+	[MLXDEVM_PORT_FN_ATTR_STATE] = MNL_TYPE_U8,
+	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE] = MNL_TYPE_U8,
+	[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST] = MNL_TYPE_U32,
+};
+
+static int fake_attr_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	int type = mnl_attr_get_type(attr);
+
+	if (mnl_attr_type_valid(attr, MLXDEVM_ATTR_MAX) < 0)
+		return MNL_CB_OK;
+	if (mnl_attr_validate(attr, fake_policy[type]) < 0)
+		return MNL_CB_ERROR;
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+static int fake_fn_attr_cb(const struct nlattr *attr, void *data)
+{
+	const struct nlattr **tb = data;
+	int type = mnl_attr_get_type(attr);
+
+	if (mnl_attr_type_valid(attr, MLXDEVM_PORT_FUNCTION_ATTR_MAX) < 0)
+		return MNL_CB_OK;
+	if (mnl_attr_validate(attr, fake_fn_policy[type]) < 0)
+		return MNL_CB_ERROR;
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+static bool fake_dev_match(struct nlattr **tb)
+{
+	return tb[MLXDEVM_ATTR_DEV_BUS_NAME] &&
+	       tb[MLXDEVM_ATTR_DEV_NAME] &&
+	       !strcmp(mnl_attr_get_str(tb[MLXDEVM_ATTR_DEV_BUS_NAME]),
+		       fake.bus) &&
+	       !strcmp(mnl_attr_get_str(tb[MLXDEVM_ATTR_DEV_NAME]), fake.dev);
+}
+
+static struct fake_port *fake_port_lookup(struct nlattr **tb)
+{
+	uint32_t slot;
+
+	if (!fake_dev_match(tb) || !tb[MLXDEVM_ATTR_PORT_INDEX])
+		return NULL;
+
+	slot = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_INDEX]) -
+	       FAKE_PORT_INDEX_BASE;
+	return slot < fake.end ? fake.ports[slot] : NULL;
+}
+
+static struct fake_port *fake_port_find_sfnum(uint32_t sfnum)
+{
+	struct fake_port *p;
+
+	LIST_FOREACH(p, &fake.sfnums[sfnum % FAKE_SFNUM_HASH], sfnum_entry) {
+		if (p->sfnum == sfnum)
+			return p;
+	}
+	return NULL;
+}
+
+static uint8_t fake_port_opstate(const struct fake_port *p)
+{
+	if (fake_now_ns() - p->changed_ns < fake.attach_ns)
+		return p->opstate;
+	return p->state == MLXDEVM_PORT_FN_STATE_ACTIVE ?
+	       MLXDEVM_PORT_FN_OPSTATE_ATTACHED :
+	       MLXDEVM_PORT_FN_OPSTATE_DETACHED;
+}
+
+static void fake_port_state_set(struct fake_port *p, uint8_t state)
+{
+	p->opstate = fake_port_opstate(p);
+	p->state = state;
+	p->changed_ns = fake_now_ns();
+}
+
+static int fake_port_put(struct fake_req *r, const struct fake_port *p,
+			 uint16_t flags)
+{
+	struct nlf_port np = {
+		.bus = fake.bus,
+		.dev = fake.dev,
+		.port_index = FAKE_PORT_INDEX_BASE + p->slot,
+		.ifindex = FAKE_IFINDEX_BASE + p->slot,
+		.pfnum = p->pfnum,
+		.sfnum = p->sfnum,
+		.state = p->state,
+		.opstate = fake_port_opstate(p),
+		.roce = p->roce,
+		.max_uc_macs = p->max_uc_macs,
+	};
+
+	snprintf(np.ifname, sizeof(np.ifname), "en0pf%usf%u", p->pfnum,
+		 p->sfnum);
+	memcpy(np.hw_addr, p->hw_addr, sizeof(np.hw_addr));
+	return nlf_port_put(&r->b, &np, flags);
+}
+
+static int fake_port_new(struct fake_req *r, struct nlattr **tb)
+{
+	struct fake_port *p;
+	uint32_t sfnum;
+	uint32_t slot;
+
+	if (!fake_dev_match(tb))
+		return -ENODEV;
+	if (!tb[MLXDEVM_ATTR_PORT_FLAVOUR] ||
+	    !tb[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER] ||
+	    !tb[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER])
+		return -EINVAL;
+	if (mnl_attr_get_u16(tb[MLXDEVM_ATTR_PORT_FLAVOUR]) !=
+	    MLXDEVM_PORT_FLAVOUR_PCI_SF)
+		return -EOPNOTSUPP;
+
+	sfnum = mnl_attr_get_u32(tb[MLXDEVM_ATTR_PORT_PCI_SF_NUMBER]);
+	if (fake_port_find_sfnum(sfnum))
+		return -EEXIST;
+
+	for (slot = fake.next_free; slot < fake.max_ports; slot++) {
+		if (!fake.ports[slot])
+			break;
+	}
+	if (slot == fake.max_ports)
+		return -ENOSPC;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	p->slot = slot;
+	p->sfnum = sfnum;
+	p->pfnum = mnl_attr_get_u16(tb[MLXDEVM_ATTR_PORT_PCI_PF_NUMBER]);
+	p->state = MLXDEVM_PORT_FN_STATE_INACTIVE;
+	p->opstate = MLXDEVM_PORT_FN_OPSTATE_DETACHED;
+	p->changed_ns = fake_now_ns();
+	p->roce = 1;
+	p->max_uc_macs = 128;
+
+	fake.ports[slot] = p;
+	fake.next_free = slot + 1;
+	if (slot >= fake.end)
+		fake.end = slot + 1;
+	fake.count++;
+	LIST_INSERT_HEAD(&fake.sfnums[sfnum % FAKE_SFNUM_HASH], p, sfnum_entry);
+
+	return fake_port_put(r, p, 0);
+}
+
+static int fake_port_dump(struct fake_req *r)
+{
+	unsigned int slot;
+	int err;
+
+	for (slot = 0; slot < fake.end; slot++) {
+		if (!fake.ports[slot])
+			continue;
+		err = fake_port_put(r, fake.ports[slot], NLM_F_MULTI);
+		if (err)
+			return err;
+	}
+	return fake_done(r);
+}
+
+static int fake_port_get(struct fake_req *r, struct nlattr **tb)
+{
+	struct fake_port *p;
+
+	if (r->nlh->nlmsg_flags & NLM_F_DUMP)
+		return fake_port_dump(r);
+
+	p = fake_port_lookup(tb);
+	if (!p)
+		return -ENODEV;
+	return fake_port_put(r, p, 0);
+}
+
+static int fake_port_set(struct fake_req *r, struct nlattr **tb)
+{
+	struct nlattr *fn[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {};
+	struct nlattr *addr;
+	struct nlattr *state;
+	struct fake_port *p;
+
+	p = fake_port_lookup(tb);
+	if (!p)
+		return -ENODEV;
+	if (!tb[MLXDEVM_ATTR_PORT_FUNCTION] ||
+	    mnl_attr_parse_nested(tb[MLXDEVM_ATTR_PORT_FUNCTION], fake_fn_attr_cb,
+				  fn) != MNL_CB_OK)
+		return -EINVAL;
+
+	addr = fn[MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR];
+	state = fn[MLXDEVM_PORT_FN_ATTR_STATE];
+	if (addr && mnl_attr_get_payload_len(addr) != sizeof(p->hw_addr))
+		return -EINVAL;
+	if (state && mnl_attr_get_u8(state) > MLXDEVM_PORT_FN_STATE_ACTIVE)
+		return -EINVAL;
+
+	if (addr)
+		memcpy(p->hw_addr, mnl_attr_get_payload(addr),
+		       sizeof(p->hw_addr));
+	if (state && mnl_attr_get_u8(state) != p->state)
+		fake_port_state_set(p, mnl_attr_get_u8(state));
+	return 0;
+}
+
+static int fake_port_del(struct fake_req *r, struct nlattr **tb)
+{
+	struct fake_port *p;
+
+	p = fake_port_lookup(tb);
+	if (!p)
+		return -ENODEV;
+
+	LIST_REMOVE(p, sfnum_entry);
+	fake.ports[p->slot] = NULL;
+	if (p->slot < fake.next_free)
+		fake.next_free = p->slot;
+	while (fake.end && !fake.ports[fake.end - 1])
+		fake.end--;
+	fake.count--;
+	free(p);
+	return 0;
+}
+
+/* Capabilities can only change while the function is inactive */
+static int fake_ext_cap_set(struct fake_req *r, struct nlattr **tb)
+{
+	struct nlattr *fn[MLXDEVM_PORT_FUNCTION_ATTR_MAX + 1] = {};
+	struct fake_port *p;
+
+	p = fake_port_lookup(tb);
+	if (!p)
+		return -ENODEV;
+	if (!tb[MLXDEVM_ATTR_EXT_PORT_FN_CAP] ||
+	    mnl_attr_parse_nested(tb[MLXDEVM_ATTR_EXT_PORT_FN_CAP],
+				  fake_fn_attr_cb, fn) != MNL_CB_OK)
+		return -EINVAL;
+	if (p->state == MLXDEVM_PORT_FN_STATE_ACTIVE)
+		return -EBUSY;
+
+	if (fn[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE])
+		p->roce = mnl_attr_get_u8(fn[MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE]);
+	if (fn[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST])
+		p->max_uc_macs =
+			mnl_attr_get_u32(fn[MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST]);
+	return 0;
+}
+
+static struct fake_dev *fake_dev_get(struct nlattr **tb)
+{
+	const char *bus;
+	const char *dev;
+	struct fake_dev *d;
+	unsigned int i;
+
+	if (!tb[MLXDEVM_ATTR_DEV_BUS_NAME] || !tb[MLXDEVM_ATTR_DEV_NAME])
+		return NULL;
+	bus = mnl_attr_get_str(tb[MLXDEVM_ATTR_DEV_BUS_NAME]);
+	dev = mnl_attr_get_str(tb[MLXDEVM_ATTR_DEV_NAME]);
+
+	LIST_FOREACH(d, &fake.devs, entry) {
+		if (!strcmp(d->bus, bus) && !strcmp(d->dev, dev)) {
+			/* Devices are usually configured one after the other */
+			LIST_REMOVE(d, entry);
+			goto found;
+		}
+	}
+
+	if (strlen(bus) >= FAKE_NAME_LEN || strlen(dev) >= FAKE_NAME_LEN)
+		return NULL;
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+	strcpy(d->bus, bus);
+	strcpy(d->dev, dev);
+	for (i = 0; i < ARRAY_SIZE(fake_param_defs); i++)
+		d->values[i] = fake_param_defs[i].value;
+found:
+	LIST_INSERT_HEAD(&fake.devs, d, entry);
+	return d;
+}
+
+static int fake_param_find(struct nlattr **tb)
+{
+	const char *name;
+	unsigned int i;
+
+	if (!tb[MLXDEVM_ATTR_PARAM_NAME])
+		return -EINVAL;
+	name = mnl_attr_get_str(tb[MLXDEVM_ATTR_PARAM_NAME]);
+	for (i = 0; i < ARRAY_SIZE(fake_param_defs); i++) {
+		if (!strcmp(fake_param_defs[i].name, name))
+			return i;
+	}
+	return -EINVAL;
+}
+
+static int fake_param_put(struct fake_req *r, const struct fake_dev *d,
+			  unsigned int i, uint16_t flags)
+{
+	const struct fake_param_def *def = &fake_param_defs[i];
+	struct nlf_param_value value = {
+		.cmode = MLXDEVM_PARAM_CMODE_DRIVERINIT,
+		.data = d->values[i],
+	};
+
+	return nlf_param_put(&r->b, d->bus, d->dev, def->name, def->type,
+			     &value, 1, flags);
+}
+
+static int fake_param_dump(struct fake_req *r, struct nlattr **tb)
+{
+	struct fake_dev *d;
+	unsigned int i;
+	int err;
+
+	/* Without a device, the parameters of all of them are dumped */
+	if (tb[MLXDEVM_ATTR_DEV_BUS_NAME] && tb[MLXDEVM_ATTR_DEV_NAME]) {
+		d = fake_dev_get(tb);
+		if (!d)
+			return -ENOMEM;
+		for (i = 0; i < ARRAY_SIZE(fake_param_defs); i++) {
+			err = fake_param_put(r, d, i, NLM_F_MULTI);
+			if (err)
+				return err;
+		}
+		return fake_done(r);
+	}
+
+	LIST_FOREACH(d, &fake.devs, entry) {
+		for (i = 0; i < ARRAY_SIZE(fake_param_defs); i++) {
+			err = fake_param_put(r, d, i, NLM_F_MULTI);
+			if (err)
+				return err;
+		}
+	}
+	return fake_done(r);
+}
+
+static int fake_param_get(struct fake_req *r, struct nlattr **tb)
+{
+	struct fake_dev *d;
+	int i;
+
+	if (r->nlh->nlmsg_flags & NLM_F_DUMP)
+		return fake_param_dump(r, tb);
+
+	d = fake_dev_get(tb);
+	if (!d)
+		return -ENODEV;
+	i = fake_param_find(tb);
+	if (i < 0)
+		return i;
+	return fake_param_put(r, d, i, 0);
+}
+
+static int fake_param_set(struct fake_req *r, struct nlattr **tb)
+{
+	struct nlattr *data = tb[MLXDEVM_ATTR_PARAM_VALUE_DATA];
+	const struct fake_param_def *def;
+	struct fake_dev *d;
+	uint32_t value;
+	int i;
+
+	d = fake_dev_get(tb);
+	if (!d)
+		return -ENODEV;
+	i = fake_param_find(tb);
+	if (i < 0)
+		return i;
+	def = &fake_param_defs[i];
+
+	if (!tb[MLXDEVM_ATTR_PARAM_TYPE] ||
+	    mnl_attr_get_u8(tb[MLXDEVM_ATTR_PARAM_TYPE]) != def->type ||
+	    !tb[MLXDEVM_ATTR_PARAM_VALUE_CMODE] ||
+	    (def->type != MNL_TYPE_FLAG && !data))
+		return -EINVAL;
+	if (mnl_attr_get_u8(tb[MLXDEVM_ATTR_PARAM_VALUE_CMODE]) !=
+	    MLXDEVM_PARAM_CMODE_DRIVERINIT)
+		return -EOPNOTSUPP;
+
+	switch (def->type) {
+	case MNL_TYPE_U8:
+		value = mnl_attr_get_u8(data);
+		break;
+	case MNL_TYPE_U16:
+		value = mnl_attr_get_u16(data);
+		break;
+	case MNL_TYPE_U32:
+		value = mnl_attr_get_u32(data);
+		break;
+	default:
+		value = !!data;
+		break;
+	}
+	d->values[i] = value;
+	return 0;
+}
+
+static int fake_cmd_rcv(struct fake_req *r)
+{
+	const struct genlmsghdr *genl = mnl_nlmsg_get_payload(r->nlh);
+	struct nlattr **tb = r->sk->tb;
+
+	memset(tb, 0, (MLXDEVM_ATTR_MAX + 1) * sizeof(*tb));
+	if (mnl_attr_parse(r->nlh, sizeof(*genl), fake_attr_cb,
+			   tb) != MNL_CB_OK)
+		return -EINVAL;
+
+	switch (genl->cmd) {
+	case MLXDEVM_CMD_PORT_NEW:
+		return fake_port_new(r, tb);
+	case MLXDEVM_CMD_PORT_GET:
+		return fake_port_get(r, tb);
+	case MLXDEVM_CMD_PORT_SET:
+		return fake_port_set(r, tb);
+	case MLXDEVM_CMD_PORT_DEL:
+		return fake_port_del(r, tb);
+	case MLXDEVM_CMD_EXT_CAP_SET:
+		return fake_ext_cap_set(r, tb);
+	case MLXDEVM_CMD_PARAM_GET:
+		return fake_param_get(r, tb);
+	case MLXDEVM_CMD_PARAM_SET:
+		return fake_param_set(r, tb);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void fake_rcv(struct fake_sock *sk, const struct nlmsghdr *nlh)
+{
+	struct fake_req r = {
+		.sk = sk,
+		.nlh = nlh,
+		.b = {
+			.size = fake.dgram_size,
+			.seq = nlh->nlmsg_seq,
+			.portid = sk->portid,
+			.dgram_new = fake_dgram_new,
+			.priv = sk,
+		},
+	};
+	int err;
+
+	if (!(nlh->nlmsg_flags & NLM_F_REQUEST))
+		return;
+
+	pthread_mutex_lock(&fake.lock);
+	if (nlh->nlmsg_type == GENL_ID_CTRL)
+		err = fake_ctrl_rcv(&r);
+	else if (nlh->nlmsg_type == NLF_FAMILY_ID)
+		err = fake_cmd_rcv(&r);
+	else
+		err = -ENOENT;
+	pthread_mutex_unlock(&fake.lock);
+
+	if (err < 0 || (err != FAKE_DUMPED && nlh->nlmsg_flags & NLM_F_ACK))
+		nlf_ack(&r.b, nlh, err);
+}
+
+static void *fake_open(void *priv)
+{
+	struct fake_sock *sk;
+
+	sk = calloc(1, sizeof(*sk));
+	if (!sk)
+		return NULL;
+	/* Too large for the stack with the extended attribute numbers */
+	sk->tb = calloc(MLXDEVM_ATTR_MAX + 1, sizeof(*sk->tb));
+	if (!sk->tb) {
+		free(sk);
+		return NULL;
+	}
+
+	sk->portid = __atomic_add_fetch(&fake.portid, 1, __ATOMIC_RELAXED);
+	sk->efd = -1;
+	TAILQ_INIT(&sk->rxq);
+	TAILQ_INIT(&sk->free);
+	return sk;
+}
+
+static void fake_dgrams_free(struct fake_dgram_head *head)
+{
+	struct fake_dgram *dg;
+
+	while ((dg = TAILQ_FIRST(head))) {
+		TAILQ_REMOVE(head, dg, entry);
+		free(dg);
+	}
+}
+
+static void fake_close(void *data)
+{
+	struct fake_sock *sk = data;
+
+	fake_dgrams_free(&sk->rxq);
+	fake_dgrams_free(&sk->free);
+	if (sk->efd >= 0)
+		close(sk->efd);
+	free(sk->tb);
+	free(sk);
+}
+
+static ssize_t fake_sendto(void *data, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+	struct fake_sock *sk = data;
+	int rem = len;
+
+	for (; mnl_nlmsg_ok(nlh, rem); nlh = mnl_nlmsg_next(nlh, &rem))
+		fake_rcv(sk, nlh);
+	return len;
+}
+
+/* Replies are queued by the requests, so there is never anything to
+ * wait for: EAGAIN is returned even to a blocking receive.
+ */
+static ssize_t fake_recvfrom(void *data, void *buf, size_t len, int flags)
+{
+	struct fake_sock *sk = data;
+	struct fake_dgram *dg;
+	eventfd_t cnt;
+
+	dg = TAILQ_FIRST(&sk->rxq);
+	if (!dg) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	TAILQ_REMOVE(&sk->rxq, dg, entry);
+	TAILQ_INSERT_HEAD(&sk->free, dg, entry);
+	if (sk->efd >= 0)
+		eventfd_read(sk->efd, &cnt);
+
+	if (dg->len > len) {
+		errno = ENOSPC;
+		return -1;
+	}
+	memcpy(buf, dg->buf, dg->len);
+	return dg->len;
+}
+
+static unsigned int fake_portid(void *data)
+{
+	struct fake_sock *sk = data;
+
+	return sk->portid;
+}
+
+static int fake_fd(void *data)
+{
+	struct fake_sock *sk = data;
+	struct fake_dgram *dg;
+
+	if (sk->efd >= 0)
+		return sk->efd;
+
+	sk->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if (sk->efd < 0)
+		return -errno;
+	TAILQ_FOREACH(dg, &sk->rxq, entry)
+		eventfd_write(sk->efd, 1);
+	return sk->efd;
+}
+
+static const struct netlink_transport fake_transport = {
+	.open = fake_open,
+	.close = fake_close,
+	.sendto = fake_sendto,
+	.recvfrom = fake_recvfrom,
+	.portid = fake_portid,
+	.fd = fake_fd,
+};
+
+int fake_mlxdevm_start(const struct fake_mlxdevm_config *cfg)
+{
+	unsigned int i;
+
+	if (strlen(cfg->bus) >= FAKE_NAME_LEN ||
+	    strlen(cfg->dev) >= FAKE_NAME_LEN)
+		return -EINVAL;
+
+	fake.max_ports = cfg->max_ports ? cfg->max_ports : FAKE_MAX_PORTS;
+	fake.ports = calloc(fake.max_ports, sizeof(*fake.ports));
+	if (!fake.ports)
+		return -ENOMEM;
+
+	strcpy(fake.bus, cfg->bus);
+	strcpy(fake.dev, cfg->dev);
+	fake.attach_ns = cfg->attach_usec * 1000ll;
+	fake.dgram_size = MNL_SOCKET_BUFFER_SIZE;
+	fake.end = 0;
+	fake.next_free = 0;
+	fake.count = 0;
+	for (i = 0; i < FAKE_SFNUM_HASH; i++)
+		LIST_INIT(&fake.sfnums[i]);
+	LIST_INIT(&fake.devs);
+
+	netlink_transport_set(&fake_transport);
+	return 0;
+}
+
+void fake_mlxdevm_stop(void)
+{
+	struct fake_dev *d;
+	unsigned int slot;
+
+	netlink_transport_set(NULL);
+
+	for (slot = 0; slot < fake.end; slot++)
+		free(fake.ports[slot]);
+	free(fake.ports);
+	fake.ports = NULL;
+	fake.end = 0;
+	fake.count = 0;
+
+	while ((d = LIST_FIRST(&fake.devs))) {
+		LIST_REMOVE(d, entry);
+		free(d);
+	}
+}
+
+unsigned int fake_mlxdevm_port_count(void)
+{
+	unsigned int count;
+
+	pthread_mutex_lock(&fake.lock);
+	count = fake.count;
+	pthread_mutex_unlock(&fake.lock);
+	return count;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#ifndef _FAKE_MLXDEVM_H
+#define _FAKE_MLXDEVM_H
+
+#include <stdint.h>
+
+/*
+ * Userspace model of the mlxdevm generic netlink family. Once started, the
+ * handles opened by the library talk to it instead of the kernel, so that
+ * tests and benchmarks run without a device supporting SFs.
+ *
+ * Ports of device @bus/@dev are added, changed and deleted like by the
+ * driver. The function of a port becomes attached @attach_usec after it is
+ * activated and detached as long after it is deactivated. Every device has
+ * the driverinit parameters of an SF.
+ *
+ * Unlike the kernel, the model has no multicast group: mlxdevm has no
+ * "config" group in its family, so the library polls the ports during
+ * opstate waits instead of waiting for notifications. Receiving with
+ * nothing queued fails with EAGAIN where a blocking kernel socket would
+ * block; replies are queued by the requests themselves, so only a
+ * receive without a request outstanding can hit that.
+ */
+struct fake_mlxdevm_config {
+	const char *bus;
+	const char *dev;
+	unsigned int max_ports;
+	unsigned int attach_usec;
+};
+
+/**
+ * fake_mlxdevm_start - Start the model and use it for the handles opened
+ * from now on. Return: 0 or negative errno.
+ */
+int fake_mlxdevm_start(const struct fake_mlxdevm_config *cfg);
+
+/**
+ * fake_mlxdevm_stop - Go back to the kernel and free the model. Handles
+ * opened on the model must be closed before.
+ */
+void fake_mlxdevm_stop(void);
+
+/* Number of ports currently present in the model */
+unsigned int fake_mlxdevm_port_count(void);
+
+#endif
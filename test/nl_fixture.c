@@ -0,0 +1,358 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nl_fixture.h"
+
+struct nlmsghdr *nlf_msg_start(struct nlf_builder *b, uint16_t type,
+			       uint16_t flags)
+{
+	struct nlmsghdr *nlh;
+
+	if (!b->dgram || b->size - *b->len < NLF_MSG_MAX) {
+		if (b->dgram_new(b))
+			return NULL;
+	}
+
+	nlh = mnl_nlmsg_put_header(b->dgram + *b->len);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = flags;
+	nlh->nlmsg_seq = b->seq;
+	nlh->nlmsg_pid = b->portid;
+	return nlh;
+}
+
+struct nlmsghdr *nlf_genl_start(struct nlf_builder *b, uint16_t family,
+				uint8_t cmd, uint16_t flags)
+{
+	struct genlmsghdr *genl;
+	struct nlmsghdr *nlh;
+
+	nlh = nlf_msg_start(b, family, flags);
+	if (!nlh)
+		return NULL;
+
+	genl = mnl_nlmsg_put_extra_header(nlh, sizeof(*genl));
+	genl->cmd = cmd;
+	genl->version = MLXDEVM_GENL_VERSION;
+	return nlh;
+}
+
+void nlf_msg_end(struct nlf_builder *b, const struct nlmsghdr *nlh)
+{
+	*b->len += MNL_ALIGN(nlh->nlmsg_len);
+	if (nlh->nlmsg_type >= NLMSG_MIN_TYPE)
+		b->msgs++;
+}
+
+int nlf_ack(struct nlf_builder *b, const struct nlmsghdr *req, int err)
+{
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *e;
+
+	nlh = nlf_msg_start(b, NLMSG_ERROR, NLM_F_ACK_REQ_CAPPED);
+	if (!nlh)
+		return -ENOMEM;
+
+	e = mnl_nlmsg_put_extra_header(nlh, sizeof(*e));
+	e->error = err;
+	if (req)
+		e->msg = *req;
+	nlf_msg_end(b, nlh);
+	return 0;
+}
+
+int nlf_done(struct nlf_builder *b)
+{
+	struct nlmsghdr *nlh;
+	int *len;
+
+	nlh = nlf_msg_start(b, NLMSG_DONE, NLM_F_MULTI);
+	if (!nlh)
+		return -ENOMEM;
+
+	len = mnl_nlmsg_put_extra_header(nlh, sizeof(*len));
+	*len = 0;
+	nlf_msg_end(b, nlh);
+	return 0;
+}
+
+int nlf_family_put(struct nlf_builder *b)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = nlf_genl_start(b, GENL_ID_CTRL, CTRL_CMD_NEWFAMILY, 0);
+	if (!nlh)
+		return -ENOMEM;
+
+	mnl_attr_put_u16(nlh, CTRL_ATTR_FAMILY_ID, NLF_FAMILY_ID);
+	mnl_attr_put_strz(nlh, CTRL_ATTR_FAMILY_NAME, MLXDEVM_GENL_NAME);
+	mnl_attr_put_u32(nlh, CTRL_ATTR_VERSION, MLXDEVM_GENL_VERSION);
+	nlf_msg_end(b, nlh);
+	return 0;
+}
+
+void nlf_port_init(struct nlf_port *p, const char *bus, const char *dev,
+		   uint32_t sfnum)
+{
+	memset(p, 0, sizeof(*p));
+	p->bus = bus;
+	p->dev = dev;
+	p->port_index = 0x8000 + sfnum;
+	p->ifindex = 100 + sfnum;
+	snprintf(p->ifname, sizeof(p->ifname), "en3f0pf0sf%u", sfnum);
+	p->sfnum = sfnum;
+	p->hw_addr[1] = 0x11;
+	p->hw_addr[2] = 0x22;
+	p->hw_addr[3] = sfnum >> 16;
+	p->hw_addr[4] = sfnum >> 8;
+	p->hw_addr[5] = sfnum;
+	p->state = MLXDEVM_PORT_FN_STATE_ACTIVE;
+	p->opstate = MLXDEVM_PORT_FN_OPSTATE_ATTACHED;
+	p->roce = 1;
+	p->max_uc_macs = 128;
+}
+
+int nlf_port_put(struct nlf_builder *b, const struct nlf_port *p,
+		 uint16_t flags)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *nest;
+
+	nlh = nlf_genl_start(b, NLF_FAMILY_ID, MLXDEVM_CMD_PORT_NEW, flags);
+	if (!nlh)
+		return -ENOMEM;
+
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_BUS_NAME, p->bus);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_NAME, p->dev);
+	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_INDEX, p->port_index);
+	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_TYPE, MLXDEVM_PORT_TYPE_ETH);
+	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_NETDEV_IFINDEX, p->ifindex);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_PORT_NETDEV_NAME, p->ifname);
+	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_FLAVOUR,
+			 MLXDEVM_PORT_FLAVOUR_PCI_SF);
+	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_CONTROLLER_NUMBER, 0);
+	mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PORT_PCI_PF_NUMBER, p->pfnum);
+	mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PORT_PCI_SF_NUMBER, p->sfnum);
+	mnl_attr_put_u8(nlh, MLXDEVM_ATTR_PORT_EXTERNAL, 0);
+
+	nest = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_PORT_FUNCTION);
+	mnl_attr_put(nlh, MLXDEVM_PORT_FUNCTION_ATTR_HW_ADDR,
+		     sizeof(p->hw_addr), p->hw_addr);
+	mnl_attr_put_u8(nlh, MLXDEVM_PORT_FN_ATTR_STATE, p->state);
+	mnl_attr_put_u8(nlh, MLXDEVM_PORT_FN_ATTR_OPSTATE, p->opstate);
+	mnl_attr_put_u8(nlh, MLXDEVM_PORT_FN_ATTR_EXT_CAP_ROCE, p->roce);
+	mnl_attr_put_u32(nlh, MLXDEVM_PORT_FN_ATTR_EXT_CAP_UC_LIST,
+			 p->max_uc_macs);
+	mnl_attr_nest_end(nlh, nest);
+
+	nlf_msg_end(b, nlh);
+	return 0;
+}
+
+static void param_value_put(struct nlmsghdr *nlh, uint8_t type,
+			    const struct nlf_param_value *value)
+{
+	struct nlattr *nest;
+
+	nest = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_PARAM_VALUE);
+	mnl_attr_put_u8(nlh, MLXDEVM_ATTR_PARAM_VALUE_CMODE, value->cmode);
+	switch (type) {
+	case MNL_TYPE_U8:
+		mnl_attr_put_u8(nlh, MLXDEVM_ATTR_PARAM_VALUE_DATA, value->data);
+		break;
+	case MNL_TYPE_U16:
+		mnl_attr_put_u16(nlh, MLXDEVM_ATTR_PARAM_VALUE_DATA, value->data);
+		break;
+	case MNL_TYPE_U32:
+		mnl_attr_put_u32(nlh, MLXDEVM_ATTR_PARAM_VALUE_DATA, value->data);
+		break;
+	case MNL_TYPE_FLAG:
+		if (value->data)
+			mnl_attr_put(nlh, MLXDEVM_ATTR_PARAM_VALUE_DATA, 0, NULL);
+		break;
+	}
+	mnl_attr_nest_end(nlh, nest);
+}
+
+int nlf_param_put(struct nlf_builder *b, const char *bus, const char *dev,
+		  const char *name, uint8_t type,
+		  const struct nlf_param_value *values, unsigned int nvalues,
+		  uint16_t flags)
+{
+	struct nlattr *param, *list;
+	struct nlmsghdr *nlh;
+	unsigned int i;
+
+	nlh = nlf_genl_start(b, NLF_FAMILY_ID, MLXDEVM_CMD_PARAM_GET, flags);
+	if (!nlh)
+		return -ENOMEM;
+
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_BUS_NAME, bus);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_DEV_NAME, dev);
+	param = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_PARAM);
+	mnl_attr_put_strz(nlh, MLXDEVM_ATTR_PARAM_NAME, name);
+	mnl_attr_put_u8(nlh, MLXDEVM_ATTR_PARAM_TYPE, type);
+	list = mnl_attr_nest_start(nlh, MLXDEVM_ATTR_PARAM_VALUES_LIST);
+	for (i = 0; i < nvalues; i++)
+		param_value_put(nlh, type, &values[i]);
+	mnl_attr_nest_end(nlh, list);
+	mnl_attr_nest_end(nlh, param);
+
+	nlf_msg_end(b, nlh);
+	return 0;
+}
+
+static int replay_dgram_new(struct nlf_builder *b)
+{
+	struct nlf_replay *r = b->priv;
+	unsigned int capacity;
+	char **dgrams;
+	size_t *lens;
+
+	if (r->count == r->capacity) {
+		capacity = r->capacity ? r->capacity * 2 : 16;
+		dgrams = realloc(r->dgrams, capacity * sizeof(*dgrams));
+		if (!dgrams)
+			return -ENOMEM;
+		r->dgrams = dgrams;
+		lens = realloc(r->lens, capacity * sizeof(*lens));
+		if (!lens)
+			return -ENOMEM;
+		r->lens = lens;
+		r->capacity = capacity;
+	}
+
+	r->dgrams[r->count] = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (!r->dgrams[r->count])
+		return -ENOMEM;
+	r->lens[r->count] = 0;
+	b->dgram = r->dgrams[r->count];
+	b->len = &r->lens[r->count];
+	r->count++;
+	return 0;
+}
+
+/* Replies are left with sequence number and port id 0, which the library
+ * accepts as the reply of any request.
+ */
+void nlf_replay_init(struct nlf_replay *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->b.size = MNL_SOCKET_BUFFER_SIZE;
+	r->b.dgram_new = replay_dgram_new;
+	r->b.priv = r;
+}
+
+void nlf_replay_free(struct nlf_replay *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->count; i++)
+		free(r->dgrams[i]);
+	free(r->dgrams);
+	free(r->lens);
+	nlf_replay_init(r);
+}
+
+static struct nlf_replay family_replay;
+static const struct nlf_replay *cur_replay;
+/* Replay being received and its next datagram */
+static const struct nlf_replay *rx_replay;
+static unsigned int rx_next;
+
+static void *replay_open(void *priv)
+{
+	return &family_replay;
+}
+
+static void replay_close(void *sk)
+{
+}
+
+static ssize_t replay_sendto(void *sk, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+
+	rx_replay = nlh->nlmsg_type == GENL_ID_CTRL ?
+		    &family_replay : cur_replay;
+	rx_next = 0;
+	return len;
+}
+
+static ssize_t replay_recvfrom(void *sk, void *buf, size_t len, int flags)
+{
+	const struct nlf_replay *r = rx_replay;
+
+	if (!r || rx_next == r->count) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (r->lens[rx_next] > len) {
+		errno = ENOSPC;
+		return -1;
+	}
+	memcpy(buf, r->dgrams[rx_next], r->lens[rx_next]);
+	return r->lens[rx_next++];
+}
+
+static unsigned int replay_portid(void *sk)
+{
+	return 0;
+}
+
+static int replay_fd(void *sk)
+{
+	return -EOPNOTSUPP;
+}
+
+static const struct netlink_transport replay_transport = {
+	.open = replay_open,
+	.close = replay_close,
+	.sendto = replay_sendto,
+	.recvfrom = replay_recvfrom,
+	.portid = replay_portid,
+	.fd = replay_fd,
+};
+
+struct mlxdevm *nlf_replay_open(const char *bus, const char *dev)
+{
+	struct mlxdevm *dl;
+	int err;
+
+	if (!family_replay.count) {
+		nlf_replay_init(&family_replay);
+		err = nlf_family_put(&family_replay.b);
+		if (!err)
+			err = nlf_ack(&family_replay.b, NULL, 0);
+		if (err) {
+			nlf_replay_free(&family_replay);
+			errno = -err;
+			return NULL;
+		}
+	}
+
+	/* Sockets keep the transport they were opened with */
+	netlink_transport_set(&replay_transport);
+	dl = mlxdevm_open(MLXDEVM_GENL_NAME, bus, dev);
+	netlink_transport_set(NULL);
+	return dl;
+}
+
+void nlf_replay_set(const struct nlf_replay *r)
+{
+	cur_replay = r;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#ifndef _NL_FIXTURE_H
+#define _NL_FIXTURE_H
+
+#include <stdint.h>
+#include <net/if.h>
+#include <libmnl/libmnl.h>
+
+/*
+ * Reply messages of the mlxdevm family as the kernel builds them, for the
+ * tests and benchmarks which feed the library without a device.
+ */
+
+struct mlxdevm;
+
+/* Family id given to mlxdevm by the fixtures */
+#define NLF_FAMILY_ID		0x7f
+/* Room left in a datagram for one more message */
+#define NLF_MSG_MAX		1024
+
+/**
+ * nlf_builder - appends messages to reply datagrams
+ * @dgram: datagram messages are appended to, @len bytes of its @size used
+ * @seq: sequence number and @portid of the built messages
+ * @msgs: data messages built so far
+ * @dgram_new: called when a message would not fit; points @dgram and @len
+ * to a new empty datagram. Return: 0 or negative errno.
+ */
+struct nlf_builder {
+	char *dgram;
+	size_t *len;
+	size_t size;
+	uint32_t seq;
+	uint32_t portid;
+	unsigned int msgs;
+	int (*dgram_new)(struct nlf_builder *b);
+	void *priv;
+};
+
+/**
+ * nlf_msg_start - Start a message of @type; NULL when no datagram is
+ * available. Finish it with nlf_msg_end().
+ */
+struct nlmsghdr *nlf_msg_start(struct nlf_builder *b, uint16_t type,
+			       uint16_t flags);
+struct nlmsghdr *nlf_genl_start(struct nlf_builder *b, uint16_t family,
+				uint8_t cmd, uint16_t flags);
+void nlf_msg_end(struct nlf_builder *b, const struct nlmsghdr *nlh);
+
+/**
+ * nlf_ack - ACK capped to the header of @req, as with NETLINK_CAP_ACK, or
+ * to an empty header when @req is NULL. Return: 0 or negative errno.
+ */
+int nlf_ack(struct nlf_builder *b, const struct nlmsghdr *req, int err);
+
+/* End of a dump. Return: 0 or negative errno. */
+int nlf_done(struct nlf_builder *b);
+
+/* CTRL_CMD_NEWFAMILY reply for mlxdevm, without multicast group */
+int nlf_family_put(struct nlf_builder *b);
+
+/* An SF port as reported by PORT_NEW and PORT_GET */
+struct nlf_port {
+	const char *bus;
+	const char *dev;
+	uint32_t port_index;
+	uint32_t ifindex;
+	char ifname[IFNAMSIZ];
+	uint16_t pfnum;
+	uint32_t sfnum;
+	uint8_t hw_addr[6];
+	uint8_t state;
+	uint8_t opstate;
+	uint8_t roce;
+	uint32_t max_uc_macs;
+};
+
+/**
+ * nlf_port_init - Active and attached SF @sfnum of PF 0, with index
+ * 0x8000 + @sfnum and the netdev and capabilities mlx5 gives it.
+ */
+void nlf_port_init(struct nlf_port *p, const char *bus, const char *dev,
+		   uint32_t sfnum);
+int nlf_port_put(struct nlf_builder *b, const struct nlf_port *p,
+		 uint16_t flags);
+
+struct nlf_param_value {
+	uint8_t cmode;
+	uint32_t data;
+};
+
+/**
+ * nlf_param_put - Parameter @name of @type, an MNL_TYPE_*, with one value
+ * per configuration mode. A flag is present when its data is not 0.
+ * Return: 0 or negative errno.
+ */
+int nlf_param_put(struct nlf_builder *b, const char *bus, const char *dev,
+		  const char *name, uint8_t type,
+		  const struct nlf_param_value *values, unsigned int nvalues,
+		  uint16_t flags);
+
+/**
+ * nlf_replay - datagrams replayed by the replay transport as the reply of
+ * every request, built with @b
+ */
+struct nlf_replay {
+	struct nlf_builder b;
+	char **dgrams;
+	size_t *lens;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+void nlf_replay_init(struct nlf_replay *r);
+void nlf_replay_free(struct nlf_replay *r);
+
+/**
+ * nlf_replay_open - Open a handle whose requests are answered by the
+ * replay set with nlf_replay_set(); the family lookup is answered by the
+ * fixture. Return: handle or NULL with errno set.
+ */
+struct mlxdevm *nlf_replay_open(const char *bus, const char *dev);
+
+/* Answer the following requests with @r, which must stay valid */
+void nlf_replay_set(const struct nlf_replay *r);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+/*
+ * Measure the cost of opening and closing a handle: the first open which
+ * resolves the family, later opens which use the family id cache, and
+ * handles sharing the socket of an open handle.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdlib.h>
+
+#include "ts.h"
+
+#define OPEN_BENCH_ITERATIONS	10000
+
+static void bench_report(const char *name, const struct ts_time *ts,
+			 int iterations)
+{
+	printf("%-16s %8d handles %10.1f ns/handle\n", name, iterations,
+	       (double)ts->latency / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = OPEN_BENCH_ITERATIONS;
+	struct ts_time ts = { 0 };
+	struct mlxdevm *parent;
+	struct mlxdevm *dl;
+	int err = 0;
+	int i;
+
+	if (argc < 4) {
+		printf("format is %s <dl> <bus> <dev> [iterations]\n", argv[0]);
+		printf("example %s mlxdevm pci 0000:03:00.0 10000\n", argv[0]);
+		return EINVAL;
+	}
+	if (argc > 4)
+		iterations = atoi(argv[4]);
+
+	ts_log_start_time(&ts);
+	parent = mlxdevm_open(argv[1], argv[2], argv[3]);
+	ts_log_end_time(&ts);
+	if (!parent) {
+		fprintf(stderr, "%s fail to connect to mlxdevm %d\n", __func__, errno);
+		return errno;
+	}
+	bench_report("first open", &ts, 1);
+
+	ts_log_start_time(&ts);
+	for (i = 0; i < iterations; i++) {
+		dl = mlxdevm_open(argv[1], argv[2], argv[3]);
+		if (!dl) {
+			err = errno;
+			fprintf(stderr, "open %d fail %d\n", i, err);
+			goto out;
+		}
+		mlxdevm_close(dl);
+	}
+	ts_log_end_time(&ts);
+	bench_report("open/close", &ts, iterations);
+
+	ts_log_start_time(&ts);
+	for (i = 0; i < iterations; i++) {
+		dl = mlxdevm_open_shared(parent, argv[2], argv[3]);
+		if (!dl) {
+			err = errno;
+			fprintf(stderr, "shared open %d fail %d\n", i, err);
+			goto out;
+		}
+		mlxdevm_close(dl);
+	}
+	ts_log_end_time(&ts);
+	bench_report("shared open/close", &ts, iterations);
+
+out:
+	mlxdevm_close(parent);
+	return err;
+}
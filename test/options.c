@@ -11,17 +11,18 @@
  */
 
 #include <stdio.h>
-#include <sys/time.h>
+#include <time.h>
 
 #define NSEC_PER_SEC	1000000000ll
 
 long long current_time(void)
 {
-	struct timeval tv;
+	struct timespec ts;
 
-	gettimeofday(&tv, NULL);
+	/* Unaffected by wall clock adjustments during a run */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return tv.tv_usec * 1000ll + tv.tv_sec * NSEC_PER_SEC;
+	return ts.tv_nsec + ts.tv_sec * NSEC_PER_SEC;
 }
 
 struct suffix_map {
@@ -13,6 +13,8 @@
 #ifndef _OPTIONS_H
 #define _OPTIONS_H
 
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
 long long current_time(void);
 void print_time(long long val);
 
@@ -0,0 +1,452 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+/*
+ * Measure the decode path of large dumps: reply datagrams of 1k, 10k and 64k
+ * SF ports and of large parameter lists are built once, then replayed to a
+ * handle through a netlink transport, so that they go through mnl_cb_run2()
+ * and the library callbacks exactly like replies of the kernel. Reported
+ * per message: time, memory allocations, and cycles, instructions and
+ * cache misses when perf counters are available.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "ts.h"
+#include "nl_fixture.h"
+
+#define BENCH_BUS		"pci"
+#define BENCH_DEV		"0000:03:00.0"
+/* Index nlf_port_init() gives to SF 0 */
+#define BENCH_PORT_INDEX_BASE	0x8000
+/* Rounds of a case are repeated until this many messages were parsed */
+#define BENCH_MSGS		1000000
+#define BENCH_ROUNDS_MIN	5
+
+/* Allocations made by the process, counted by the wrappers below */
+static unsigned long long alloc_count;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, size);
+}
+
+static int ports_replay_build(struct nlf_replay *r, unsigned int nports)
+{
+	struct nlf_port p;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < nports; i++) {
+		nlf_port_init(&p, BENCH_BUS, BENCH_DEV, i + 1);
+		err = nlf_port_put(&r->b, &p, NLM_F_MULTI);
+		if (err)
+			return err;
+	}
+	return nlf_done(&r->b);
+}
+
+static const uint8_t param_types[] = {
+	MNL_TYPE_U8, MNL_TYPE_U16, MNL_TYPE_U32, MNL_TYPE_FLAG,
+};
+
+/* A parameter with a runtime and a driverinit value, as most have */
+static int param_msg_put(struct nlf_replay *r, unsigned int i, uint16_t flags)
+{
+	uint8_t type = param_types[i % ARRAY_SIZE(param_types)];
+	struct nlf_param_value values[] = {
+		{ MLXDEVM_PARAM_CMODE_RUNTIME, i },
+		{ MLXDEVM_PARAM_CMODE_DRIVERINIT, i + 1 },
+	};
+	char name[32];
+
+	if (type == MNL_TYPE_FLAG) {
+		values[0].data &= 1;
+		values[1].data &= 1;
+	}
+	snprintf(name, sizeof(name), "param_%u", i);
+	return nlf_param_put(&r->b, BENCH_BUS, BENCH_DEV, name, type, values,
+			     ARRAY_SIZE(values), flags);
+}
+
+static int params_replay_build(struct nlf_replay *r, unsigned int nparams)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < nparams; i++) {
+		err = param_msg_put(r, i, NLM_F_MULTI);
+		if (err)
+			return err;
+	}
+	return nlf_done(&r->b);
+}
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+} perf_events[] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+	{ PERF_TYPE_HW_CACHE,
+	  PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "L1d-misses" },
+};
+
+#define PERF_EVENTS	ARRAY_SIZE(perf_events)
+
+/* Counters of the calling thread, in a group read at once */
+struct perf_group {
+	int fds[PERF_EVENTS];
+	unsigned int count;
+	unsigned int idx[PERF_EVENTS];
+	uint64_t values[PERF_EVENTS];
+};
+
+static void perf_group_open(struct perf_group *pg)
+{
+	struct perf_event_attr attr;
+	unsigned int i;
+	int fd;
+
+	pg->count = 0;
+	for (i = 0; i < PERF_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.disabled = !pg->count;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+			     pg->count ? pg->fds[0] : -1, 0);
+		if (fd < 0)
+			continue;
+		pg->fds[pg->count] = fd;
+		pg->idx[pg->count++] = i;
+	}
+	if (!pg->count)
+		printf("perf counters unavailable: %s\n", strerror(errno));
+}
+
+static void perf_group_close(struct perf_group *pg)
+{
+	unsigned int i;
+
+	for (i = 0; i < pg->count; i++)
+		close(pg->fds[i]);
+}
+
+static void perf_group_start(struct perf_group *pg)
+{
+	if (!pg->count)
+		return;
+	ioctl(pg->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(pg->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Add the counts since perf_group_start() to @values */
+static void perf_group_stop(struct perf_group *pg, uint64_t *values)
+{
+	uint64_t buf[1 + PERF_EVENTS];
+	unsigned int i;
+
+	if (!pg->count)
+		return;
+	ioctl(pg->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	if (read(pg->fds[0], buf, sizeof(buf)) < 0)
+		return;
+	for (i = 0; i < buf[0] && i < pg->count; i++)
+		values[pg->idx[i]] += buf[1 + i];
+}
+
+struct bench_ctx {
+	struct mlxdevm *dl;
+	struct perf_group pg;
+	/* Replay being measured, and the buffer it is received into */
+	const struct nlf_replay *replay;
+	char *buf;
+	struct mlxdevm_port *ports;
+	struct mlxdevm_port **port_ptrs;
+	unsigned int nports;
+	struct mlxdevm_params params;
+	unsigned long long visited;
+};
+
+/* One decode path; returns 0 or negative errno */
+struct bench_case {
+	const char *name;
+	int (*run)(struct bench_ctx *ctx);
+	/* Undo what run() built, outside of the measurement */
+	void (*reset)(struct bench_ctx *ctx);
+};
+
+static int msg_skip_cb(const struct nlmsghdr *nlh, void *data)
+{
+	return MNL_CB_OK;
+}
+
+/* Baseline: the walk of the messages by libmnl, nothing decoded. The
+ * datagrams are copied to a receive buffer first, as the replay transport
+ * does for the library.
+ */
+static int mnl_walk_run(struct bench_ctx *ctx)
+{
+	const struct nlf_replay *r = ctx->replay;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < r->count; i++) {
+		memcpy(ctx->buf, r->dgrams[i], r->lens[i]);
+		ret = mnl_cb_run2(ctx->buf, r->lens[i], 0, 0, msg_skip_cb,
+				  NULL, NULL, 0);
+		if (ret <= MNL_CB_STOP)
+			return ret < 0 ? -errno : 0;
+	}
+	return 0;
+}
+
+static struct mlxdevm_port_list_head port_list =
+	TAILQ_HEAD_INITIALIZER(port_list);
+
+static int port_list_run(struct bench_ctx *ctx)
+{
+	return mlxdevm_sf_port_list_dump(ctx->dl, &port_list);
+}
+
+static void port_list_reset(struct bench_ctx *ctx)
+{
+	struct mlxdevm_port_list *cur;
+
+	while ((cur = TAILQ_FIRST(&port_list))) {
+		TAILQ_REMOVE(&port_list, cur, entry);
+		free(cur);
+	}
+}
+
+static int port_visit(struct mlxdevm *dl, const struct mlxdevm_port *port,
+		      void *priv)
+{
+	struct bench_ctx *ctx = priv;
+
+	ctx->visited += port->sfnum;
+	return 0;
+}
+
+static int port_foreach_run(struct bench_ctx *ctx)
+{
+	return mlxdevm_sf_port_foreach(ctx->dl, port_visit, ctx);
+}
+
+static int ports_refresh_run(struct bench_ctx *ctx)
+{
+	return mlxdevm_ports_refresh(ctx->dl, ctx->port_ptrs, ctx->nports);
+}
+
+static int params_dump_run(struct bench_ctx *ctx)
+{
+	return mlxdevm_dev_driver_params_dump(ctx->dl, &ctx->params);
+}
+
+static void params_dump_reset(struct bench_ctx *ctx)
+{
+	mlxdevm_params_free(&ctx->params);
+}
+
+static int param_get_run(struct bench_ctx *ctx)
+{
+	struct mlxdevm_param param = {};
+
+	return mlxdevm_dev_driver_param_get(ctx->dl, "param_0", &param);
+}
+
+static const struct bench_case port_cases[] = {
+	{ "mnl_cb_run2", mnl_walk_run, NULL },
+	{ "port list dump", port_list_run, port_list_reset },
+	{ "port foreach", port_foreach_run, NULL },
+	{ "ports refresh", ports_refresh_run, NULL },
+};
+
+static const struct bench_case param_cases[] = {
+	{ "mnl_cb_run2", mnl_walk_run, NULL },
+	{ "params dump", params_dump_run, params_dump_reset },
+};
+
+static const struct bench_case param_get_case = {
+	"param get", param_get_run, NULL,
+};
+
+static void bench_case_run(struct bench_ctx *ctx, const struct bench_case *c,
+			   const struct nlf_replay *r, unsigned int size)
+{
+	uint64_t values[PERF_EVENTS] = {};
+	unsigned long long allocs = 0;
+	unsigned long long start;
+	struct ts_time ts = { 0 };
+	long long best = 0;
+	long long total = 0;
+	unsigned int rounds;
+	unsigned int i, j;
+	double msgs;
+	int err;
+
+	rounds = BENCH_MSGS / r->b.msgs;
+	if (rounds < BENCH_ROUNDS_MIN)
+		rounds = BENCH_ROUNDS_MIN;
+	ctx->replay = r;
+	nlf_replay_set(r);
+
+	for (i = 0; i < rounds; i++) {
+		start = alloc_count;
+		perf_group_start(&ctx->pg);
+		ts_log_start_time(&ts);
+		err = c->run(ctx);
+		ts_log_end_time(&ts);
+		perf_group_stop(&ctx->pg, values);
+		allocs += alloc_count - start;
+		if (c->reset)
+			c->reset(ctx);
+		if (err) {
+			printf("%s %u: error %d\n", c->name, size, err);
+			return;
+		}
+		total += ts.latency;
+		if (!best || ts.latency < best)
+			best = ts.latency;
+	}
+
+	msgs = (double)r->b.msgs * rounds;
+	printf("%-16s %6u msgs %9.1f ns/msg (best %7.1f) %6.2f allocs/msg",
+	       c->name, r->b.msgs, total / msgs, (double)best / r->b.msgs,
+	       allocs / msgs);
+	for (j = 0; j < ctx->pg.count; j++)
+		printf(" %7.1f %s/msg", values[ctx->pg.idx[j]] / msgs,
+		       perf_events[ctx->pg.idx[j]].name);
+	printf("\n");
+}
+
+static int ports_alloc(struct bench_ctx *ctx, unsigned int nports)
+{
+	unsigned int i;
+
+	ctx->ports = calloc(nports, sizeof(*ctx->ports));
+	ctx->port_ptrs = calloc(nports, sizeof(*ctx->port_ptrs));
+	if (!ctx->ports || !ctx->port_ptrs)
+		return -ENOMEM;
+
+	for (i = 0; i < nports; i++) {
+		ctx->ports[i].port_index = BENCH_PORT_INDEX_BASE + i + 1;
+		ctx->ports[i].sfnum = i + 1;
+		ctx->port_ptrs[i] = &ctx->ports[i];
+	}
+	ctx->nports = nports;
+	return 0;
+}
+
+static void ports_free(struct bench_ctx *ctx)
+{
+	free(ctx->ports);
+	free(ctx->port_ptrs);
+	ctx->ports = NULL;
+	ctx->port_ptrs = NULL;
+}
+
+static const unsigned int port_sizes[] = { 1000, 10000, 65536 };
+static const unsigned int param_sizes[] = { 100, 1000, 10000 };
+
+int main(int argc, char **argv)
+{
+	struct bench_ctx ctx = {};
+	struct nlf_replay r;
+	unsigned int i, j;
+	int err;
+
+	nlf_replay_init(&r);
+	ctx.buf = malloc(MNL_SOCKET_BUFFER_SIZE);
+	if (!ctx.buf)
+		return ENOMEM;
+	ctx.dl = nlf_replay_open(BENCH_BUS, BENCH_DEV);
+	if (!ctx.dl) {
+		err = errno;
+		fprintf(stderr, "%s fail to open handle %d\n", __func__, err);
+		free(ctx.buf);
+		return err;
+	}
+	perf_group_open(&ctx.pg);
+
+	for (i = 0; i < ARRAY_SIZE(port_sizes); i++) {
+		err = ports_replay_build(&r, port_sizes[i]);
+		if (!err)
+			err = ports_alloc(&ctx, port_sizes[i]);
+		if (err)
+			goto out;
+		for (j = 0; j < ARRAY_SIZE(port_cases); j++)
+			bench_case_run(&ctx, &port_cases[j], &r, port_sizes[i]);
+		ports_free(&ctx);
+		nlf_replay_free(&r);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(param_sizes); i++) {
+		err = params_replay_build(&r, param_sizes[i]);
+		if (err)
+			goto out;
+		for (j = 0; j < ARRAY_SIZE(param_cases); j++)
+			bench_case_run(&ctx, &param_cases[j], &r, param_sizes[i]);
+		nlf_replay_free(&r);
+	}
+
+	/* A parameter get is a request of its own for every message */
+	err = param_msg_put(&r, 0, 0);
+	if (!err)
+		err = nlf_ack(&r.b, NULL, 0);
+	if (err)
+		goto out;
+	bench_case_run(&ctx, &param_get_case, &r, 1);
+
+out:
+	if (err)
+		fprintf(stderr, "%s fail to build replies %d\n", __func__, err);
+	ports_free(&ctx);
+	nlf_replay_free(&r);
+	perf_group_close(&ctx.pg);
+	mlxdevm_close(ctx.dl);
+	free(ctx.buf);
+	return -err;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+/*
+ * Check the port table lookups on synthetic ports while inserting and
+ * removing them, and report the lookup cost.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdlib.h>
+
+#include "ts.h"
+
+#define TABLE_PORTS	10000
+#define TABLE_PFNUM	0
+
+static int ports_check(struct mlxdevm_port_table *t, struct mlxdevm_port *ports,
+		       unsigned int n, bool present)
+{
+	struct mlxdevm_port *want;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		want = present ? &ports[i] : NULL;
+		if (mlxdevm_port_table_find_index(t, ports[i].port_index) != want ||
+		    mlxdevm_port_table_find_sfnum(t, ports[i].pfnum,
+						  ports[i].sfnum) != want ||
+		    mlxdevm_port_table_find_ifindex(t, ports[i].ndev_ifindex) != want) {
+			printf("port %u lookup mismatch\n", i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct mlxdevm_port *ports;
+	struct mlxdevm_port_table *t;
+	struct ts_time ts = { 0 };
+	unsigned int i;
+	int ret = -1;
+
+	ports = calloc(TABLE_PORTS, sizeof(*ports));
+	if (!ports)
+		return -1;
+
+	for (i = 0; i < TABLE_PORTS; i++) {
+		ports[i].port_index = 0x8000 + i * 4;
+		ports[i].pfnum = TABLE_PFNUM;
+		ports[i].sfnum = 88 + i;
+		ports[i].ndev_ifindex = 100 + i;
+	}
+
+	/* Start small so that the table grows while inserting */
+	t = mlxdevm_port_table_create(0);
+	if (!t)
+		goto table_err;
+
+	for (i = 0; i < TABLE_PORTS; i++) {
+		if (mlxdevm_port_table_insert(t, &ports[i])) {
+			printf("port %u insert fail\n", i);
+			goto out;
+		}
+	}
+	if (mlxdevm_port_table_insert(t, &ports[0]) != -EEXIST) {
+		printf("duplicate insert not rejected\n");
+		goto out;
+	}
+
+	ts_log_start_time(&ts);
+	if (ports_check(t, ports, TABLE_PORTS, true))
+		goto out;
+	ts_log_end_time(&ts);
+	printf("lookups: %u ports %.1f ns/lookup\n", TABLE_PORTS,
+	       (double)ts.latency / (TABLE_PORTS * 3));
+
+	/* Remove every other port and re-index some of the others */
+	for (i = 0; i < TABLE_PORTS; i += 2) {
+		if (mlxdevm_port_table_remove(t, &ports[i])) {
+			printf("port %u remove fail\n", i);
+			goto out;
+		}
+	}
+	for (i = 1; i < TABLE_PORTS; i += 4) {
+		ports[i].ndev_ifindex += TABLE_PORTS * 2;
+		mlxdevm_port_table_update(t, &ports[i]);
+	}
+	for (i = 0; i < TABLE_PORTS; i++) {
+		if (ports_check(t, &ports[i], 1, i & 1))
+			goto out;
+	}
+	if (mlxdevm_port_table_find_ifindex(t, 101) ||
+	    mlxdevm_port_table_count(t) != TABLE_PORTS / 2) {
+		printf("stale entries after remove/update\n");
+		goto out;
+	}
+
+	printf("port table test passed\n");
+	ret = 0;
+out:
+	mlxdevm_port_table_destroy(t);
+table_err:
+	free(ports);
+	return ret;
+}
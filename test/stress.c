@@ -22,6 +22,27 @@
 
 #include "ts.h"
 
+enum stress_stage {
+	STRESS_STAGE_PORT_ADD,
+	STRESS_STAGE_PORT_CAP,
+	STRESS_STAGE_PORT_ACTIVATE,
+	STRESS_STAGE_UDEV_BIND,
+	STRESS_STAGE_CFG_PARAMS,
+	STRESS_STAGE_DRV_BIND,
+	STRESS_STAGE_PORT_ATTACHED,
+	STRESS_STAGE_MAX,
+};
+
+static const char * const stage_names[STRESS_STAGE_MAX] = {
+	[STRESS_STAGE_PORT_ADD] = "port add",
+	[STRESS_STAGE_PORT_CAP] = "port cap set",
+	[STRESS_STAGE_PORT_ACTIVATE] = "port activate",
+	[STRESS_STAGE_UDEV_BIND] = "udev bind",
+	[STRESS_STAGE_CFG_PARAMS] = "cfg param",
+	[STRESS_STAGE_DRV_BIND] = "drv bind",
+	[STRESS_STAGE_PORT_ATTACHED] = "port_attached",
+};
+
 struct sf_dev {
 	struct mlxdevm_port *port;
 	char sf_sys_name[512];
@@ -29,6 +50,7 @@ struct sf_dev {
 };
 
 struct thread_params {
+	struct mlxdevm_mt *mt;
 	struct mlxdevm *dl_fd;
 	const char *dl;
 	const char *bus;
@@ -39,13 +61,8 @@ struct thread_params {
 	uint32_t start_sfnum;
 	uint16_t pfnum;
 	int success_count;
-	struct time_stats port_add_stats;
-	struct time_stats port_cap_stats;
-	struct time_stats port_activate_stats;
-	struct time_stats dev_udev_bind_stats;
-	struct time_stats dev_cfg_params_stats;
-	struct time_stats dev_drv_bind_stats;
-	struct time_stats port_attached_stats;
+	/* STRESS_STAGE_MAX stages in the stats of all threads */
+	struct time_stats *stats;
 	struct sf_dev *sfs;
 };
 
@@ -67,7 +84,7 @@ sf_active_port_create(struct mlxdevm *dl, struct thread_params *params, uint32_t
 		return NULL;
 	}
 	ts_log_end_time(&port_add_stat);
-	ts_update_time_stats(&port_add_stat, &params->port_add_stats);
+	ts_update_time_stats(&port_add_stat, &params->stats[STRESS_STAGE_PORT_ADD]);
 
 	ts_log_start_time(&port_cap_stat);
 	if (port->ext_cap.roce_valid || port->ext_cap.max_uc_macs_valid) {
@@ -84,7 +101,7 @@ sf_active_port_create(struct mlxdevm *dl, struct thread_params *params, uint32_t
 		}
 	}
 	ts_log_end_time(&port_cap_stat);
-	ts_update_time_stats(&port_cap_stat, &params->port_cap_stats);
+	ts_update_time_stats(&port_cap_stat, &params->stats[STRESS_STAGE_PORT_CAP]);
 
 	state = MLXDEVM_PORT_FN_STATE_ACTIVE;
 	ts_log_start_time(&port_act_stat);
@@ -94,7 +111,7 @@ sf_active_port_create(struct mlxdevm *dl, struct thread_params *params, uint32_t
 		return NULL;
 	}
 	ts_log_end_time(&port_act_stat);
-	ts_update_time_stats(&port_act_stat, &params->port_activate_stats);
+	ts_update_time_stats(&port_act_stat, &params->stats[STRESS_STAGE_PORT_ACTIVATE]);
 	params->sfs[i].port = port;
 	return port;
 }
@@ -215,40 +232,28 @@ static int sf_udev_fetch(struct thread_params *params, uint32_t sfnum, int i)
 	udev_monitor_unref(monitor);
 	udev_unref(udev);
 	ts_log_end_time(&ts);
-	ts_update_time_stats(&ts, &params->dev_udev_bind_stats);
+	ts_update_time_stats(&ts, &params->stats[STRESS_STAGE_UDEV_BIND]);
 	return ret;
 }
 
 static void set_params(struct mlxdevm *dl)
 {
-	struct mlxdevm_param param = {};
-	int err;
-
-	err = mlxdevm_dev_driver_param_get(dl, "cmpl_eq_depth", &param);
-	if (!err) {
-		param.u.val_u32 = 64;
-		mlxdevm_dev_driver_param_set(dl, "cmpl_eq_depth", &param);
-	}
-	err = mlxdevm_dev_driver_param_get(dl, "async_eq_depth", &param);
-	if (!err) {
-		param.u.val_u32 = 64;
-		mlxdevm_dev_driver_param_set(dl, "async_eq_depth", &param);
-	}
-	err = mlxdevm_dev_driver_param_get(dl, "disable_fc", &param);
-	if (!err) {
-		param.u.val_bool = false;
-		mlxdevm_dev_driver_param_set(dl, "disable_fc", &param);
-	}
-	err = mlxdevm_dev_driver_param_get(dl, "disable_netdev", &param);
-	if (!err) {
-		param.u.val_bool = true;
-		mlxdevm_dev_driver_param_set(dl, "disable_netdev", &param);
-	}
-	err = mlxdevm_dev_driver_param_get(dl, "max_cmpl_eqs", &param);
-	if (!err) {
-		param.u.val_u16 = 1;
-		mlxdevm_dev_driver_param_set(dl, "max_cmpl_eqs", &param);
-	}
+	union mlxdevm_param_value val;
+	uint8_t cmode = MLXDEVM_PARAM_CMODE_DRIVERINIT;
+
+	/* Parameter types come from the schema cached for the SF driver, so
+	 * no get is needed before each set.
+	 */
+	val.val_u32 = 64;
+	mlxdevm_dev_driver_param_set_by_name(dl, "cmpl_eq_depth", cmode, &val);
+	val.val_u32 = 64;
+	mlxdevm_dev_driver_param_set_by_name(dl, "async_eq_depth", cmode, &val);
+	val.val_bool = false;
+	mlxdevm_dev_driver_param_set_by_name(dl, "disable_fc", cmode, &val);
+	val.val_bool = true;
+	mlxdevm_dev_driver_param_set_by_name(dl, "disable_netdev", cmode, &val);
+	val.val_u16 = 1;
+	mlxdevm_dev_driver_param_set_by_name(dl, "max_cmpl_eqs", cmode, &val);
 }
 
 static int sf_cfg_params_set(struct thread_params *params, uint32_t sfnum, int i)
@@ -269,70 +274,20 @@ static int sf_cfg_params_set(struct thread_params *params, uint32_t sfnum, int i
 	mlxdevm_close(dl);
 out:
 	ts_log_end_time(&ts);
-	ts_update_time_stats(&ts, &params->dev_cfg_params_stats);
+	ts_update_time_stats(&ts, &params->stats[STRESS_STAGE_CFG_PARAMS]);
 	return 0;
 }
 
-static bool sf_sysfs_validate(const char *sysfs)
-{
-	bool ret;
-	int fd;
-
-	fd = open(sysfs, O_WRONLY);
-	ret = fd < 0 ? false : true;
-	close(fd);
-
-	return ret;
-}
-
-static int
-sf_sysfs_write(const char *sysfs, const char *string_to_write)
-{
-	int fd, ret;
-
-	fd = open(sysfs, O_WRONLY);
-	if (fd < 0) {
-		printf("sysfs[%s] doesn't exist", sysfs);
-		return -1;
-	}
-	ret = write(fd, string_to_write, strlen(string_to_write));
-	ret = ret > 0 ? 0 : -1;
-	if (ret)
-		printf("failed to write %s to %s", string_to_write, sysfs);
-	close(fd);
-	return ret;
-}
-
-static int sf_unbind_cfg_drv(const char *name)
-{
-	char sysfs[PATH_MAX] =
-		"/sys/bus/auxiliary/drivers/mlx5_core.sf_cfg/unbind";
-
-	if (!sf_sysfs_validate(sysfs))
-		return 0;
-
-	return sf_sysfs_write(sysfs, name);
-}
-
-static int sf_bind_drv(const char *name)
-{
-	char sysfs[PATH_MAX] = "/sys/bus/auxiliary/drivers/mlx5_core.sf/bind";
-
-	if (!sf_sysfs_validate(sysfs))
-		return 0;
-
-	return sf_sysfs_write(sysfs, name);
-}
-
 static int sf_bind(struct thread_params *params, uint32_t sfnum, int i)
 {
+	const char *name = params->sfs[i].sf_sys_name;
 	struct ts_time ts = { 0 };
+	int err;
 
 	ts_log_start_time(&ts);
-	sf_unbind_cfg_drv(params->sfs[i].sf_sys_name);
-	sf_bind_drv(params->sfs[i].sf_sys_name);
+	mlxdevm_sf_driver_rebind(params->dl_fd, &name, 1, &err);
 	ts_log_end_time(&ts);
-	ts_update_time_stats(&ts, &params->dev_drv_bind_stats);
+	ts_update_time_stats(&ts, &params->stats[STRESS_STAGE_DRV_BIND]);
 	return 0;
 }
 
@@ -348,7 +303,7 @@ static int port_attach_wait(struct thread_params *params, uint32_t sfnum, int i)
 			params->sfs[i].sf_sys_name);
 
 	ts_log_end_time(&ts);
-	ts_update_time_stats(&ts, &params->port_attached_stats);
+	ts_update_time_stats(&ts, &params->stats[STRESS_STAGE_PORT_ATTACHED]);
 	return ret;
 }
 
@@ -365,7 +320,7 @@ static void *worker(void *arg)
 	if (err)
 		return NULL;
 
-	dl = mlxdevm_open(params->dl, params->bus, params->dev);
+	dl = mlxdevm_mt_handle(params->mt);
 	if (!dl) {
 		fprintf(stderr, "%s fail to connect to mlxdevm %d\n", __func__, errno);
 		goto out;
@@ -398,15 +353,29 @@ static void *worker(void *arg)
 	}
 out:
 	_udev_destroy(params);
-	mlxdevm_close(dl);
 	return NULL;
 }
 
+static void stages_print(const struct time_stats *stats, int thread_count)
+{
+	int i;
+
+	for (i = 0; i < thread_count; i++) {
+		printf("thread = %d\n", i);
+		ts_print_stages(&stats[i * STRESS_STAGE_MAX], 1, stage_names,
+				STRESS_STAGE_MAX);
+	}
+	printf("all threads\n");
+	ts_print_stages(stats, thread_count, stage_names, STRESS_STAGE_MAX);
+}
+
 int main(int argc, char **argv)
 {
 	struct ts_time ts = { 0 };
 	struct time_stats total_stats;
 	struct thread_params *params;
+	struct time_stats *stats;
+	struct mlxdevm_mt *mt;
 	int success_count = 0;
 	int expected_count;
 	int sfs_per_thread;
@@ -426,13 +395,22 @@ int main(int argc, char **argv)
 	sfs_per_thread = atol(argv[5]);
 
 	params = calloc(thread_count, sizeof(*params));
-	if (!params)
+	stats = ts_stats_alloc(thread_count * STRESS_STAGE_MAX);
+	if (!params || !stats)
 		return ENOMEM;
 	tids = calloc(thread_count, sizeof(*tids));
 	if (!tids)
 		return ENOMEM;
 
+	/* Each worker gets its own socket from the shared handle */
+	mt = mlxdevm_mt_open(argv[1], argv[2], argv[3]);
+	if (!mt) {
+		fprintf(stderr, "%s fail to connect to mlxdevm %d\n", __func__, errno);
+		return errno;
+	}
+
 	for (i = 0; i < thread_count; i++) {
+		params[i].mt = mt;
 		params[i].dl = argv[1];
 		params[i].bus = argv[2];
 		params[i].dev = argv[3];
@@ -441,13 +419,7 @@ int main(int argc, char **argv)
 		params[i].start_sfnum = (i * sfs_per_thread) + 1;
 		params[i].success_count = 0;
 		params[i].sfs = calloc(sfs_per_thread, sizeof(struct sf_dev));
-		ts_init(&params[i].port_add_stats);
-		ts_init(&params[i].port_cap_stats);
-		ts_init(&params[i].port_activate_stats);
-		ts_init(&params[i].dev_udev_bind_stats);
-		ts_init(&params[i].dev_cfg_params_stats);
-		ts_init(&params[i].dev_drv_bind_stats);
-		ts_init(&params[i].port_attached_stats);
+		params[i].stats = &stats[i * STRESS_STAGE_MAX];
 	}
 
 	ts_init(&total_stats);
@@ -463,19 +435,11 @@ int main(int argc, char **argv)
 		pthread_join(tids[i], NULL);
 	}
 	ts_log_end_time(&ts);
+	mlxdevm_mt_close(mt);
 	ts_update_time_stats(&ts, &total_stats);
 	ts_print_lat_stats(&total_stats, "total time");
 
-	for (i = 0; i < thread_count; i++) {
-		printf("thread = %d\n", i);
-		ts_print_lat_stats(&params[i].port_add_stats, "port add");
-		ts_print_lat_stats(&params[i].port_cap_stats, "port cap set");
-		ts_print_lat_stats(&params[i].port_activate_stats, "port activate");
-		ts_print_lat_stats(&params[i].dev_udev_bind_stats, "udev bind");
-		ts_print_lat_stats(&params[i].dev_cfg_params_stats, "cfg param");
-		ts_print_lat_stats(&params[i].dev_drv_bind_stats, "drv bind");
-		ts_print_lat_stats(&params[i].port_attached_stats , "port_attached");
-	}
+	stages_print(stats, thread_count);
 
 	for (i = 0; i < thread_count; i++)
 		success_count += params[i].success_count;
@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2021 NVIDIA CORPORATION & AFFILIATES. ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of Nvidia Corporation and its
+ * affiliates (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ */
+
+#include <mlxdevm_netlink.h>
+#include <mlxdevm.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ts.h"
+
+/* Highest value recorded in bucket @idx */
+static long long ts_hist_value(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < TS_HIST_SUB)
+		return idx;
+	shift = idx / TS_HIST_HALF - 1;
+	return (((long long)idx - shift * TS_HIST_HALF + 1) << shift) - 1;
+}
+
+long long ts_percentile(const struct time_stats *t, double pct)
+{
+	unsigned long long target;
+	unsigned long long seen = 0;
+	unsigned int i;
+
+	if (!t->count)
+		return 0;
+
+	target = (unsigned long long)(pct / 100 * t->count + 0.5);
+	if (!target)
+		target = 1;
+
+	for (i = 0; i < TS_HIST_BUCKETS; i++) {
+		seen += t->hist[i];
+		if (seen >= target)
+			break;
+	}
+	/* Buckets are coarser than the exact extremes */
+	if (ts_hist_value(i) > t->max)
+		return t->max;
+	if (ts_hist_value(i) < t->min)
+		return t->min;
+	return ts_hist_value(i);
+}
+
+void ts_merge_time_stats(struct time_stats *to, const struct time_stats *from)
+{
+	unsigned int i;
+
+	if (!from->count)
+		return;
+	if (from->min < to->min)
+		to->min = from->min;
+	if (from->max > to->max)
+		to->max = from->max;
+	for (i = 0; i < TS_HIST_BUCKETS; i++)
+		to->hist[i] += from->hist[i];
+	to->total_latency += from->total_latency;
+	to->count += from->count;
+}
+
+void ts_print_lat_stats(const struct time_stats *s, const char *str)
+{
+	printf("%s lat: ", str);
+	if (!s->count) {
+		printf(" no samples\n");
+		return;
+	}
+	printf(" count=%lld,", s->count);
+	printf(" min="); print_time(s->min); printf(",");
+	printf(" p50="); print_time(ts_percentile(s, 50)); printf(",");
+	printf(" p90="); print_time(ts_percentile(s, 90)); printf(",");
+	printf(" p99="); print_time(ts_percentile(s, 99)); printf(",");
+	printf(" p99.9="); print_time(ts_percentile(s, 99.9)); printf(",");
+	printf(" max="); print_time(s->max); printf(",");
+	printf(" avg="); print_time(s->total_latency / s->count); printf(",");
+	printf(" tot="); print_time(s->total_latency);
+	printf("\n");
+}
+
+struct time_stats *ts_stats_alloc(int n)
+{
+	struct time_stats *stats;
+	int i;
+
+	stats = calloc(n, sizeof(*stats));
+	if (!stats)
+		return NULL;
+	for (i = 0; i < n; i++)
+		ts_init(&stats[i]);
+	return stats;
+}
+
+/* Percentiles of a stage only mean something over the samples of all threads */
+void ts_print_stages(const struct time_stats *stats, int nthreads,
+		     const char * const *names, int nstages)
+{
+	struct time_stats *merged;
+	int s, i;
+
+	merged = malloc(sizeof(*merged));
+	if (!merged)
+		return;
+	for (s = 0; s < nstages; s++) {
+		ts_init(merged);
+		for (i = 0; i < nthreads; i++)
+			ts_merge_time_stats(merged, &stats[i * nstages + s]);
+		ts_print_lat_stats(merged, names[s]);
+	}
+	free(merged);
+}
+
+const struct mlxdevm_param_profile sf_params[SF_PARAMS_NUM] = {
+	{ "cmpl_eq_depth", MLXDEVM_PARAM_CMODE_DRIVERINIT, { .val_u32 = 64 } },
+	{ "async_eq_depth", MLXDEVM_PARAM_CMODE_DRIVERINIT, { .val_u32 = 64 } },
+	{ "disable_fc", MLXDEVM_PARAM_CMODE_DRIVERINIT, { .val_bool = false } },
+	{ "disable_netdev", MLXDEVM_PARAM_CMODE_DRIVERINIT, { .val_bool = true } },
+	{ "max_cmpl_eqs", MLXDEVM_PARAM_CMODE_DRIVERINIT, { .val_u16 = 1 } },
+};
+
+static const char * const cmd_names[MLXDEVM_STATS_CMD_MAX + 1] = {
+	[MLXDEVM_CMD_PORT_GET] = "port get",
+	[MLXDEVM_CMD_PORT_SET] = "port set",
+	[MLXDEVM_CMD_PORT_NEW] = "port new",
+	[MLXDEVM_CMD_PORT_DEL] = "port del",
+	[MLXDEVM_CMD_PARAM_GET] = "param get",
+	[MLXDEVM_CMD_PARAM_SET] = "param set",
+	[MLXDEVM_CMD_EXT_CAP_SET] = "ext cap set",
+};
+
+void ts_print_cmd_stats(void)
+{
+	const struct mlxdevm_cmd_stats *c;
+	struct mlxdevm_stats *stats;
+	int i;
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return;
+	mlxdevm_stats_get(NULL, stats);
+	for (i = 0; i <= MLXDEVM_STATS_CMD_MAX; i++) {
+		c = &stats->cmds[i];
+		if (!c->count)
+			continue;
+		if (cmd_names[i])
+			printf("%s cmd: ", cmd_names[i]);
+		else
+			printf("cmd %d: ", i);
+		printf(" count=%llu, errors=%llu, tx=%llu, rx=%llu,",
+		       (unsigned long long)c->count,
+		       (unsigned long long)c->errors,
+		       (unsigned long long)c->tx_bytes,
+		       (unsigned long long)c->rx_bytes);
+		printf(" min="); print_time(c->min_ns); printf(",");
+		printf(" max="); print_time(c->max_ns); printf(",");
+		printf(" avg="); print_time(c->total_ns / c->count);
+		printf("\n");
+	}
+	free(stats);
+}
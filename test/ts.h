@@ -13,21 +13,35 @@
 #ifndef _TS_H
 #define _TS_H
 
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
-#include <sys/time.h>
 #include <limits.h>
+#include <mlxdevm.h>
 
 #include "options.h"
 
+/*
+ * Latencies are kept in a log-bucketed histogram: values below TS_HIST_SUB
+ * have a bucket each and each power of two range above is split in
+ * TS_HIST_HALF linear buckets, so any recorded value is known within
+ * 1/TS_HIST_HALF of its magnitude whatever its scale.
+ */
+#define TS_HIST_SUB_BITS	7
+#define TS_HIST_SUB		(1 << TS_HIST_SUB_BITS)
+#define TS_HIST_HALF		(TS_HIST_SUB / 2)
+#define TS_HIST_BUCKETS		((64 - TS_HIST_SUB_BITS + 1) * TS_HIST_HALF + \
+				 TS_HIST_HALF)
+
 struct ts_time {
 	long long start, end, latency;
 };
 
 struct time_stats {
-	struct ts_time total;
-	long long min, max, avg;
+	long long min, max;
 	long long total_latency;
 	long long count;
+	uint64_t hist[TS_HIST_BUCKETS];
 };
 
 static inline void ts_log_start_time(struct ts_time *s)
@@ -41,57 +55,74 @@ static inline void ts_log_end_time(struct ts_time *s)
 	s->latency = s->end - s->start;
 }
 
-static inline void
-update_min(const struct ts_time *stat, struct time_stats *t)
+static inline unsigned int ts_hist_index(unsigned long long val)
 {
-	if (stat->latency < t->min)
-		t->min = stat->latency;
-}
+	unsigned int shift;
 
-static inline void
-update_max(const struct ts_time *stat, struct time_stats *t)
-{
-	if (stat->latency > t->max)
-		t->max = stat->latency;
+	if (val < TS_HIST_SUB)
+		return val;
+	shift = 63 - __builtin_clzll(val) - TS_HIST_SUB_BITS + 1;
+	return shift * TS_HIST_HALF + (val >> shift);
 }
 
-static inline void
-update_avg(const struct ts_time *stat, struct time_stats *t)
+static inline void ts_record(struct time_stats *t, long long latency)
 {
-	long long avg = t->avg;
-	long long old_sum = avg * t->count;
-	long long new_avg = (old_sum + stat->latency) / (t->count + 1);
-
-	t->avg = new_avg;
+	if (latency < 0)
+		latency = 0;
+	if (latency < t->min)
+		t->min = latency;
+	if (latency > t->max)
+		t->max = latency;
+	t->hist[ts_hist_index(latency)]++;
+	t->total_latency += latency;
+	t->count++;
 }
 
 static inline void
 ts_update_time_stats(const struct ts_time *stat, struct time_stats *t)
 {
-	update_min(stat, t);
-	update_max(stat, t);
-	update_avg(stat, t);
-	t->total_latency += stat->latency;
-	t->count++;
-}
-
-static inline void ts_print_lat_stats(const struct time_stats *s, char *str)
-{
-	printf("%s lat: ", str);
-	printf(" min="); print_time(s->min); printf(",");
-	printf(" max="); print_time(s->max); printf(",");
-	printf(" avg="); print_time(s->avg); printf(",");
-	printf(" tot="); print_time(s->total_latency);
-	printf("\n");
-
+	ts_record(t, stat->latency);
 }
 
 static inline void ts_init(struct time_stats *t)
 {
+	memset(t, 0, sizeof(*t));
 	t->min = LLONG_MAX;
 	t->max = LLONG_MIN;
-	t->count = 0;
-	t->total_latency = 0;
 }
 
+/**
+ * ts_percentile - Latency below which @pct percent of the samples are
+ */
+long long ts_percentile(const struct time_stats *t, double pct);
+
+/**
+ * ts_merge_time_stats - Add the samples of @from, such as the stats of
+ * another thread, to @to
+ */
+void ts_merge_time_stats(struct time_stats *to, const struct time_stats *from);
+
+void ts_print_lat_stats(const struct time_stats *s, const char *str);
+
+/**
+ * ts_stats_alloc - Allocate @n initialized stats, such as @nstages stages
+ * of each of @nthreads threads for ts_print_stages()
+ * Return: stats to free(), or NULL on error.
+ */
+struct time_stats *ts_stats_alloc(int n);
+
+/**
+ * ts_print_stages - Print each of @nstages stages over all of @nthreads
+ * threads; stage s of thread i is @stats[i * @nstages + s]
+ */
+void ts_print_stages(const struct time_stats *stats, int nthreads,
+		     const char * const *names, int nstages);
+
+/* Driverinit parameters given to every SF by the tests */
+#define SF_PARAMS_NUM	5
+extern const struct mlxdevm_param_profile sf_params[SF_PARAMS_NUM];
+
+/* Print the requests the library sent on behalf of all the threads */
+void ts_print_cmd_stats(void);
+
 #endif